@@ -0,0 +1,109 @@
+#pragma once
+
+#include "utils/alloc.h"
+#include "vec3.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// the depth of samples which didn't hit anything. it's far from FLT_MAX,
+// so that computations involving it don't overflow
+#define ACCUM_FAR_DEPTH 1e10f
+
+/*
+** The running estimate of a pixel, refined as samples are added.
+** The mean and variance of the luminance are tracked using Welford's
+** algorithm, to know how confident the estimate is.
+*/
+struct accum_pixel
+{
+    // the mean color of the samples
+    float r;
+    float g;
+    float b;
+    // the mean luminance, and the sum of squared differences to it
+    float lum_mean;
+    float lum_m2;
+    uint32_t samples;
+
+    // the mean normal and distance of the first surface hit by the samples,
+    // used to guide post processing
+    float nx;
+    float ny;
+    float nz;
+    float depth;
+};
+
+/*
+** A floating point frame buffer, where renderers accumulate samples.
+*/
+struct accum_buffer
+{
+    size_t width;
+    size_t height;
+    struct accum_pixel data[];
+};
+
+struct accum_buffer *accum_buffer_alloc(size_t width, size_t height);
+void accum_buffer_clear(struct accum_buffer *buffer);
+
+static inline struct accum_pixel *accum_buffer_get(struct accum_buffer *buffer,
+                                                   size_t x, size_t y)
+{
+    return &buffer->data[buffer->width * y + x];
+}
+
+static inline double color_luminance(const struct vec3 *c)
+{
+    return 0.2126 * c->x + 0.7152 * c->y + 0.0722 * c->z;
+}
+
+/*
+** Add a sample to the pixel. Samples which didn't hit anything have a null
+** normal, and a depth of ACCUM_FAR_DEPTH.
+*/
+static inline void accum_pixel_add(struct accum_pixel *pixel,
+                                   const struct vec3 *color,
+                                   const struct vec3 *normal, double depth)
+{
+    pixel->samples++;
+    float inv_n = 1.f / pixel->samples;
+    pixel->r += (color->x - pixel->r) * inv_n;
+    pixel->g += (color->y - pixel->g) * inv_n;
+    pixel->b += (color->z - pixel->b) * inv_n;
+    pixel->nx += (normal->x - pixel->nx) * inv_n;
+    pixel->ny += (normal->y - pixel->ny) * inv_n;
+    pixel->nz += (normal->z - pixel->nz) * inv_n;
+    pixel->depth += (depth - pixel->depth) * inv_n;
+
+    float lum = color_luminance(color);
+    float delta = lum - pixel->lum_mean;
+    pixel->lum_mean += delta * inv_n;
+    pixel->lum_m2 += delta * (lum - pixel->lum_mean);
+}
+
+static inline struct vec3 accum_pixel_color(const struct accum_pixel *pixel)
+{
+    return (struct vec3){pixel->r, pixel->g, pixel->b};
+}
+
+/*
+** The variance of the mean luminance of the pixel.
+*/
+static inline double accum_pixel_variance(const struct accum_pixel *pixel)
+{
+    if (pixel->samples < 2)
+        return INFINITY;
+
+    double variance = pixel->lum_m2 / (pixel->samples - 1);
+    return variance / pixel->samples;
+}
+
+/*
+** The half width of the 95% confidence interval of the mean luminance.
+*/
+static inline double accum_pixel_error(const struct accum_pixel *pixel)
+{
+    return 1.96 * sqrt(accum_pixel_variance(pixel));
+}
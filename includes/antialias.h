@@ -2,10 +2,17 @@
 #define ANTIALIAS_H
 
 #include "image.h"
+#include "pixel_filter.h"
+#include "resample.h"
+#include "rendering.h"
+
+#include "scene.h"
 
 // Macros for antialias
 #define SSAA_2X_UPSCALE_FACTOR 2
 #define SSAA_4X_UPSCALE_FACTOR 4
+// The default number of samples of pixels refined by adaptive antialiasing
+#define AA_DEFAULT_SAMPLES 16
 
 /*
 ** Anti-aliasing method supported
@@ -14,6 +21,12 @@ enum aa_type
 {
     ANTIALIAS_SSAA_2X,
     ANTIALIAS_SSAA_4X,
+    ANTIALIAS_ADAPTIVE,
+    ANTIALIAS_BOX,
+    ANTIALIAS_TENT,
+    ANTIALIAS_GAUSSIAN,
+    ANTIALIAS_FXAA,
+    ANTIALIAS_MLAA,
     ANTIALIAS_NONE,
     ANTIALIAS_UNKNOWN
 };
@@ -23,14 +36,34 @@ enum aa_type
 */
 enum aa_type select_alias_opt(char *option);
 
+/*
+** Tells whether the anti-aliasing is done while rendering, by filtering
+** several samples per pixel, and which filter it uses.
+*/
+bool antialias_filter(enum aa_type aalias_type, enum pixel_filter *filter);
+
 /*
 ** Modify the context of the rendering based on the anti-aliasing selected
 */
 void preprocess_antialias(enum aa_type aalias_type, struct rgb_image **image);
 
+/*
+** Find the pixels on edges, where neighbors differ in color, object or depth,
+** and render those again using the given number of samples. The image must
+** have been rendered with a geometry buffer.
+*/
+void antialias_refine_edges(struct rgb_image *image, struct scene *scene,
+                            render_sample_f sample, size_t samples,
+                            size_t threads);
+
 /*
 ** Select and apply run a post processing antialiasing
+** SSAA images are downscaled using the given filter and number of threads.
+** FXAA and MLAA only filter the edges of objects when given a geometry
+** buffer, which may be NULL.
 */
-void postprocess_antialias(enum aa_type aalias_type, struct rgb_image **image);
+void postprocess_antialias(enum aa_type aalias_type, struct rgb_image **image,
+                           enum resample_filter filter,
+                           const struct gbuffer *gbuffer, size_t threads);
 
 #endif
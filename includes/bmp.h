@@ -9,3 +9,15 @@ static inline size_t ppm_from_ppi(size_t ppi)
 }
 
 int bmp_write(struct rgb_image *image, size_t pixel_density, FILE *file);
+
+/*
+** Write the image next to its path, and move it there, so that readers
+** never see a partial file. Returns 0 on success.
+*/
+int bmp_save(const struct rgb_image *image, const char *path);
+
+/*
+** Read an uncompressed 24 or 32 bits BMP image. Like in the file, the first
+** line of the image is the bottom one. Returns NULL on failure.
+*/
+struct rgb_image *bmp_read(FILE *file);
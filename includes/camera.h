@@ -50,3 +50,23 @@ static inline double focal_distance_from_fov(double width, double fov_deg)
 */
 void camera_cast_ray(struct ray *ray, const struct camera *camera, double cam_x,
                      double cam_y);
+
+/*
+** What all the rays of a camera have in common: the direction of the x
+** axis of the image plane, and the point rays come from.
+*/
+struct camera_view
+{
+    struct vec3 right;
+    struct vec3 vantage_point;
+};
+
+void camera_view_init(struct camera_view *view, const struct camera *camera);
+
+/*
+** Cast a ray like camera_cast_ray, with the view of the camera computed
+** beforehand. Both give the same rays.
+*/
+void camera_view_cast_ray(struct ray *ray, const struct camera_view *view,
+                          const struct camera *camera, double cam_x,
+                          double cam_y);
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "accum_buffer.h"
+#include "image.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The default time between checkpoints, in seconds
+#define CHECKPOINT_DEFAULT_INTERVAL 60.
+// "RTCKPT2", identifies checkpoint files
+#define CHECKPOINT_MAGIC "RTCKPT2"
+
+/*
+** The start of a checkpoint file. It is followed by one byte per tile, set
+** for the tiles saved, then by the saved tiles in order, each as packed RGB
+** rows, followed by its rows of accumulated samples if there are some.
+*/
+struct checkpoint_header
+{
+    char magic[8];
+    uint64_t width;
+    uint64_t height;
+    uint64_t tile_size;
+    uint64_t tiles;
+    // whether the tiles hold accumulated samples
+    uint64_t accum;
+    // identifies the scene, render mode and options of the render
+    uint64_t render_key;
+};
+
+/*
+** Completed tiles of a render, saved periodically by a writer thread so
+** that a render which died can be resumed. Tiles are never rendered twice,
+** so the writer reads the pixels of completed tiles while the other ones
+** are rendered, without copying them.
+*/
+struct checkpoint
+{
+    const char *path;
+    // the time between checkpoints, in seconds
+    double interval;
+    struct rgb_image *image;
+    // accumulated samples, and their counts, NULL if there are none
+    struct accum_buffer *accum;
+    size_t tile_size;
+    size_t tiles_x;
+    size_t tiles;
+    uint64_t render_key;
+    // one byte per tile, set once its pixels are final
+    uint8_t *done;
+    // the tiles loaded from a previous checkpoint, and in the last one
+    // written
+    size_t resumed;
+    size_t saved;
+
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stopping;
+    // what the writer did, and when the render started, in seconds
+    size_t writes;
+    double write_time;
+    double start;
+};
+
+/*
+** Identify a render from the arguments of the program: the scene, and the
+** options changing its pixels, whatever their order. The output path and
+** the options only changing how the render runs are left out, so that a
+** render can be resumed with other threads or checkpoint settings.
+*/
+uint64_t checkpoint_render_key(int argc, char *argv[]);
+
+/*
+** Start saving the completed tiles of the image and accumulation buffer
+** to the path every interval. When resuming, the tiles of the checkpoint
+** at the path are loaded first, and marked as done, if it was made by a
+** render of the same key. Returns 0 on success.
+*/
+int checkpoint_start(struct checkpoint *checkpoint, const char *path,
+                     double interval, struct rgb_image *image,
+                     struct accum_buffer *accum, size_t tile_size,
+                     uint64_t render_key, bool resume);
+
+/*
+** Stop the writer once the render completed, and remove the checkpoint
+*/
+void checkpoint_stop(struct checkpoint *checkpoint);
+
+/*
+** Mark a tile as done, once all its pixels are written
+*/
+static inline void checkpoint_tile_done(struct checkpoint *checkpoint,
+                                        size_t tile)
+{
+    __atomic_store_n(&checkpoint->done[tile], 1, __ATOMIC_RELEASE);
+}
+
+static inline bool checkpoint_is_done(struct checkpoint *checkpoint,
+                                      size_t tile)
+{
+    return __atomic_load_n(&checkpoint->done[tile], __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,20 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "accum_buffer.h"
+#include "image.h"
+
+// the default number of filtering passes, each twice as wide as the last
+#define DENOISE_DEFAULT_ITERATIONS 5
+
+/*
+** Denoise the accumulated samples using an edge-avoiding a-trous wavelet
+** filter, and write the result to the image. Filtering stops at edges
+** found using the normals and depths stored in the accumulation buffer,
+** and is stronger where the variance of the pixels is higher.
+*/
+void postprocess_denoise(struct rgb_image *image,
+                         const struct accum_buffer *accum, size_t iterations,
+                         size_t threads);
+
+#endif
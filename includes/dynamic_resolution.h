@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The smallest scale used when none is given
+#define DYNRES_DEFAULT_MIN_SCALE 0.5
+
+/*
+** Picks the internal resolution of realtime frames, so that they render in
+** the target time. The time of a frame is modeled as a cost per rendered
+** pixel, smoothed over the last frames, from which the largest scale fitting
+** in the target is deduced.
+*/
+struct dynres_controller
+{
+    // the size of the output image
+    size_t full_width;
+    size_t full_height;
+    // the time frames should take, in seconds
+    double target;
+    double min_scale;
+
+    // the scale of the next frame, applied to both axis
+    double scale;
+    size_t width;
+    size_t height;
+
+    // the smoothed time spent on each rendered pixel, 0 before a frame
+    double pixel_cost;
+};
+
+void dynres_init(struct dynres_controller *controller, size_t width,
+                 size_t height, double target, double min_scale);
+
+/*
+** Update the model with the time taken by a frame rendered at the current
+** size, and pick the size of the next one. Returns true if it changed.
+*/
+bool dynres_update(struct dynres_controller *controller, double frame_time);
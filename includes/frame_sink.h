@@ -0,0 +1,72 @@
+#pragma once
+
+#include "image.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The number of frames kept in a shared memory ring
+#define FRAME_RING_SLOTS 3
+// "RTFR", identifies shared memory rings
+#define FRAME_RING_MAGIC 0x52544652
+
+/*
+** The start of a shared memory ring. It is followed by the slots, each
+** holding a frame as packed RGB rows, top row first. Frame n is written to
+** slot n % slots, and is complete once frames is greater than n. Readers
+** copying a slot should check frames didn't move past n + slots - 1
+** meanwhile, in which case the slot was overwritten.
+*/
+struct frame_ring_header
+{
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t slots;
+    // the size of the header, where the first slot starts
+    uint64_t data_offset;
+    uint64_t frames;
+};
+
+enum frame_sink_type
+{
+    FRAME_SINK_NONE,
+    FRAME_SINK_STDOUT,
+    FRAME_SINK_SHM,
+};
+
+/*
+** Where the realtime runner sends its frames. Frames sent to stdout are
+** packed RGB rows, top row first, with no header, as expected by most raw
+** video players.
+*/
+struct frame_sink
+{
+    enum frame_sink_type type;
+    size_t width;
+    size_t height;
+    // a frame in the layout of the sink
+    uint8_t *buffer;
+    // the mapped shared memory ring
+    char *shm_name;
+    struct frame_ring_header *ring;
+    size_t ring_size;
+};
+
+/*
+** Open a sink: "-" for stdout, "shm:NAME" for a shared memory ring, or
+** NULL for none. Returns 0 on success.
+*/
+int frame_sink_open(struct frame_sink *sink, const char *spec, size_t width,
+                    size_t height);
+
+/*
+** Send a frame, which must have the size of the sink. Returns 0 on
+** success.
+*/
+int frame_sink_write(struct frame_sink *sink, const struct rgb_image *image);
+
+/*
+** Close the sink. Shared memory rings are removed.
+*/
+void frame_sink_close(struct frame_sink *sink);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+** The durations of the frames rendered so far, in seconds.
+*/
+struct frame_timing
+{
+    double *times;
+    size_t count;
+    size_t capacity;
+};
+
+void frame_timing_init(struct frame_timing *timing);
+void frame_timing_destroy(struct frame_timing *timing);
+
+void frame_timing_add(struct frame_timing *timing, double time);
+
+/*
+** The time under which the given fraction of the frames were rendered,
+** between 0 and 1. Returns 0 if there are no frames.
+*/
+double frame_timing_percentile(const struct frame_timing *timing,
+                               double fraction);
+
+/*
+** Log the percentiles of the frame times, and how many frames went over
+** the budget.
+*/
+void frame_timing_report(const struct frame_timing *timing, double budget);
+
+/*
+** Log how many frames took each fraction of the budget, in quarters of the
+** budget up to twice of it.
+*/
+void frame_timing_histogram(const struct frame_timing *timing, double budget);
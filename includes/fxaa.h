@@ -0,0 +1,16 @@
+#ifndef FXAA_H
+#define FXAA_H
+
+#include "gbuffer.h"
+#include "image.h"
+
+/*
+** Smooth the edges of the image using fast approximate anti-aliasing:
+** pixels on luma edges are resampled towards the edge, depending on how
+** far they are from its ends. When a geometry buffer is given, only the
+** silhouettes of objects are filtered, leaving textures and shading sharp.
+*/
+void postprocess_fxaa(struct rgb_image *image, const struct gbuffer *gbuffer,
+                      size_t threads);
+
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "object.h"
+#include "utils/alloc.h"
+
+#include <stddef.h>
+
+/*
+** What was seen through a pixel: the first object hit, or NULL for the
+** background, how far it was and its normal.
+*/
+struct gbuffer_pixel
+{
+    const struct object *object;
+    float depth;
+    struct vec3 normal;
+};
+
+/*
+** A geometry buffer, filled by render modes alongside the image. Post
+** processing passes use it to find the edges of objects.
+*/
+struct gbuffer
+{
+    size_t width;
+    size_t height;
+    struct gbuffer_pixel data[];
+};
+
+struct gbuffer *gbuffer_alloc(size_t width, size_t height);
+
+static inline struct gbuffer_pixel *gbuffer_get(struct gbuffer *buffer,
+                                               size_t x, size_t y)
+{
+    return &buffer->data[buffer->width * y + x];
+}
@@ -0,0 +1,26 @@
+#ifndef GUIDED_UPSAMPLE_H
+#define GUIDED_UPSAMPLE_H
+
+#include "image.h"
+#include "rendering.h"
+#include "scene.h"
+
+// the default ratio between the output and the shaded resolutions
+#define GUIDED_DEFAULT_FACTOR 2
+
+/*
+** Render the image with the shading done at a resolution divided by the
+** factor, and upscale it with a joint bilateral filter. The visibility
+** render mode fills the geometry buffer of the scene at full resolution,
+** and low resolution pixels only contribute to pixels seeing the same
+** object, at a similar depth and with a similar normal. Pixels no low
+** resolution pixel matches are rendered at full resolution.
+*/
+int render_guided(struct rgb_image *image, struct scene *scene,
+                  enum runner_type runner,
+                  const struct render_mode *renderer,
+                  const struct render_mode *visibility,
+                  const struct runner_options *options, size_t factor,
+                  size_t threads);
+
+#endif
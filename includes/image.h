@@ -1,6 +1,7 @@
 #pragma once
 
 #include "utils/alloc.h"
+#include "vec3.h"
 
 #include <stddef.h>
 #include <stdint.h>
@@ -22,6 +23,16 @@ struct rgb_image
 struct rgb_image *rgb_image_alloc(size_t width, size_t height);
 void rgb_image_clear(struct rgb_image *image, const struct rgb_pixel *pix);
 
+/*
+** Clear the image in bands of rows, one per thread. Pages of a fresh image
+** are placed on the NUMA node of the thread first writing them. With tiles
+** in scanline order, threads start with the tiles over the rows they
+** cleared, which makes these pages local to them. Other tile orders spread
+** the rows of a thread over the image, and only get part of this.
+*/
+void rgb_image_clear_parallel(struct rgb_image *image,
+                              const struct rgb_pixel *pix, size_t threads);
+
 static inline void rgb_image_set(struct rgb_image *image, size_t x, size_t y,
                                  struct rgb_pixel pixel)
 {
@@ -33,3 +44,25 @@ static inline struct rgb_pixel rgb_image_get(struct rgb_image *image, size_t x,
 {
     return image->data[image->width * y + x];
 }
+
+/*
+** The color of a light is encoded inside a float, from 0 to +inf,
+** where 0 is no light, and +inf a lot more light. Unfortunately,
+** regular images can't hold such a huge range, and each color channel
+** is usualy limited to [0,255]. This function does the (lossy) translation
+** by mapping the float [0,1] range to [0,255]
+*/
+static inline uint8_t translate_light_component(double light_comp)
+{
+    if (light_comp < 0.)
+        light_comp = 0.;
+    if (light_comp > 1.)
+        light_comp = 1.;
+
+    return light_comp * 255;
+}
+
+/*
+** Converts an rgb floating point light color to 24 bit rgb.
+*/
+struct rgb_pixel rgb_color_from_light(const struct vec3 *light);
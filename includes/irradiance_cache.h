@@ -0,0 +1,86 @@
+#pragma once
+
+#include "ray.h"
+#include "vec3.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct scene;
+
+// the default accuracy of the cache: lower values create more records
+#define IRRADIANCE_CACHE_DEFAULT_ACCURACY 0.2
+
+/*
+** The irradiance computed at some point of the scene.
+** Gradients give how the irradiance changes with the rotation of the normal
+** and the translation of the point, one vector per color channel.
+*/
+struct irradiance_record
+{
+    struct vec3 position;
+    struct vec3 normal;
+    struct vec3 irradiance;
+    // the harmonic mean distance to the surrounding objects
+    double mean_distance;
+    struct vec3 rot_gradient[3];
+    struct vec3 trans_gradient[3];
+};
+
+struct irradiance_node;
+
+/*
+** An octree of irradiance records. Each record is valid over a radius
+** which depends on how close surrounding objects are, so shading points
+** can interpolate the irradiance from nearby records instead of sampling
+** the whole hemisphere above them.
+** Lookups may run concurrently, insertions lock the whole cache.
+*/
+struct irradiance_cache
+{
+    pthread_rwlock_t lock;
+    struct irradiance_node *root;
+    // the maximum error tolerated when reusing records
+    double accuracy;
+    size_t records_count;
+};
+
+/*
+** Computes the radiance coming back along the ray, and the distance to the
+** first object hit (or INFINITY).
+*/
+typedef struct vec3 (*irradiance_radiance_f)(const struct scene *scene,
+                                              const struct ray *ray,
+                                              double *distance);
+
+void irradiance_cache_init(struct irradiance_cache *cache, double accuracy);
+void irradiance_cache_destroy(struct irradiance_cache *cache);
+
+/*
+** Interpolate the irradiance at a point from the records around it.
+** Returns false when no record is close enough.
+*/
+bool irradiance_cache_lookup(struct irradiance_cache *cache,
+                             const struct vec3 *position,
+                             const struct vec3 *normal,
+                             struct vec3 *irradiance);
+
+/*
+** Compute a new record by sampling the hemisphere above the point, and add
+** it to the cache.
+*/
+void irradiance_cache_compute(struct irradiance_cache *cache,
+                              struct irradiance_record *record,
+                              const struct scene *scene,
+                              irradiance_radiance_f radiance);
+
+/*
+** Get the irradiance at some point, from the cache if possible, or by
+** computing a new record otherwise.
+*/
+struct vec3 irradiance_cache_get(struct irradiance_cache *cache,
+                                 const struct scene *scene,
+                                 const struct vec3 *position,
+                                 const struct vec3 *normal,
+                                 irradiance_radiance_f radiance);
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "sphere.h"
+#include "utils/alloc.h"
+#include "vec3.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum light_type
+{
+    // a light infinitely far away, such as the sun
+    LIGHT_DIRECTIONAL = 0,
+    // a light emitting in all directions from a single point
+    LIGHT_POINT,
+    // a parallelogram emitting light on the side of edge_u x edge_v
+    LIGHT_QUAD,
+    // a sphere emitting light in all directions
+    LIGHT_SPHERE,
+};
+
+struct light
+{
+    enum light_type type;
+
+    struct vec3 color;
+    // the intensity of point and directional lights, or the emitted
+    // radiance of area lights
+    double intensity;
+
+    // where the light travels to, for directional lights
+    struct vec3 direction;
+    // where the light is, for point lights, or a corner of quad lights
+    struct vec3 position;
+    // the sides of quad lights, starting from position
+    struct vec3 edge_u;
+    struct vec3 edge_v;
+    // the shape of sphere lights. it isn't part of the scene objects
+    struct sphere sphere;
+};
+
+/*
+** What a point of the scene receives from a given light.
+*/
+struct light_sample
+{
+    // the normalized direction from the point to the light
+    struct vec3 direction;
+    // the distance from the point to the light, INFINITY if unbounded
+    double distance;
+    // the color of the light reaching the point, including attenuation
+    struct vec3 color;
+    double intensity;
+};
+
+static inline struct light *light_create_directional(struct vec3 direction,
+                                                     struct vec3 color,
+                                                     double intensity)
+{
+    struct light *light = zalloc(sizeof(*light));
+    light->type = LIGHT_DIRECTIONAL;
+    light->color = color;
+    light->intensity = intensity;
+    light->direction = direction;
+    vec3_normalize(&light->direction);
+    return light;
+}
+
+static inline struct light *light_create_point(struct vec3 position,
+                                               struct vec3 color,
+                                               double intensity)
+{
+    struct light *light = zalloc(sizeof(*light));
+    light->type = LIGHT_POINT;
+    light->color = color;
+    light->intensity = intensity;
+    light->position = position;
+    return light;
+}
+
+static inline struct light *light_create_quad(struct vec3 corner,
+                                              struct vec3 edge_u,
+                                              struct vec3 edge_v,
+                                              struct vec3 color,
+                                              double radiance)
+{
+    struct light *light = zalloc(sizeof(*light));
+    light->type = LIGHT_QUAD;
+    light->color = color;
+    light->intensity = radiance;
+    light->position = corner;
+    light->edge_u = edge_u;
+    light->edge_v = edge_v;
+    return light;
+}
+
+static inline struct light *light_create_sphere(struct vec3 center,
+                                                double radius,
+                                                struct vec3 color,
+                                                double radiance)
+{
+    struct light *light = zalloc(sizeof(*light));
+    light->type = LIGHT_SPHERE;
+    light->color = color;
+    light->intensity = radiance;
+    light->position = center;
+    light->sphere.center = center;
+    light->sphere.radius = radius;
+    return light;
+}
+
+/*
+** Lights which aren't at a finite position can't be part of the light
+** hierarchy, and have to be handled separately.
+*/
+static inline bool light_is_infinite(const struct light *light)
+{
+    return light->type == LIGHT_DIRECTIONAL;
+}
+
+/*
+** Area lights cast soft shadows, and need more than a single shadow ray.
+*/
+static inline bool light_is_area(const struct light *light)
+{
+    return light->type == LIGHT_QUAD || light->type == LIGHT_SPHERE;
+}
+
+/*
+** The total power of the light, used to sample bright lights more often.
+** Area lights are compared to point lights as seen from afar.
+*/
+double light_power(const struct light *light);
+
+/*
+** The bounding box of finite lights.
+*/
+void light_bounds(const struct light *light, struct vec3 *min,
+                  struct vec3 *max);
+
+/*
+** Compute how the light reaches the given point. For area lights,
+** u and v in [0, 1) select the sampled point on the light.
+** Returns false when the light can't reach the point at all.
+*/
+bool light_sample(struct light_sample *sample, const struct light *light,
+                  const struct vec3 *point, double u, double v);
+
+#include "utils/pvect.h"
+
+#define GVECT_NAME light_vect
+#define GVECT_TYPE struct light *
+#include "utils/pvect_wrap.h"
+#undef GVECT_NAME
+#undef GVECT_TYPE
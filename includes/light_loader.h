@@ -0,0 +1,18 @@
+#pragma once
+
+#include "scene.h"
+
+/*
+** Load lights from a text file, one light per line:
+**
+**   directional DX DY DZ R G B INTENSITY
+**   point X Y Z R G B INTENSITY
+**   quad X Y Z UX UY UZ VX VY VZ R G B RADIANCE
+**   sphere X Y Z RADIUS R G B RADIANCE
+**
+** Quads are parallelograms with a corner at X Y Z, and sides U and V. They
+** only emit light on the side of U x V.
+**
+** Empty lines and lines starting with '#' are ignored.
+*/
+int load_lights(struct scene *scene, const char *filename);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "light.h"
+#include "vec3.h"
+
+#include <stddef.h>
+
+// the maximum number of lights sampled per shading point
+#define LIGHT_SAMPLES_MAX 64
+
+/*
+** A node of the light hierarchy. It bounds a set of lights, and knows
+** how much power these lights emit in total.
+*/
+struct light_tree_node
+{
+    struct vec3 bounds_min;
+    struct vec3 bounds_max;
+    double power;
+
+    // the left child of interior nodes directly follows its parent.
+    // this is the index of the right child, or 0 for leaves
+    size_t right;
+    // the light held by leaves
+    const struct light *light;
+};
+
+/*
+** A bounding volume hierarchy of lights, used to pick the lights which
+** matter the most for some point without looking at all of them.
+*/
+struct light_tree
+{
+    // the hierarchy of lights at a finite position
+    struct light_tree_node *nodes;
+    size_t finite_count;
+
+    // lights which can't be bounded, such as directional lights
+    const struct light **infinite;
+    size_t infinite_count;
+};
+
+/*
+** A light selected for a shading point. Its contribution must be scaled
+** by weight to account for the probability of picking it.
+*/
+struct light_choice
+{
+    const struct light *light;
+    double weight;
+};
+
+static inline void light_tree_init(struct light_tree *tree)
+{
+    *tree = (struct light_tree){0};
+}
+
+/*
+** (Re)build the hierarchy from the list of lights.
+*/
+void light_tree_build(struct light_tree *tree, struct light_vect *lights);
+
+void light_tree_destroy(struct light_tree *tree);
+
+/*
+** Pick at most budget lights for some point, by importance.
+** When there are no more lights than the budget, all of them are returned
+** with a weight of 1. Otherwise, the cost only depends on the budget and
+** the depth of the hierarchy. Returns the number of choices written.
+*/
+size_t light_tree_select(const struct light_tree *tree,
+                         const struct vec3 *point, size_t budget,
+                         struct light_choice *choices);
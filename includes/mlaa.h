@@ -0,0 +1,17 @@
+#ifndef MLAA_H
+#define MLAA_H
+
+#include "gbuffer.h"
+#include "image.h"
+
+/*
+** Smooth the edges of the image using morphological anti-aliasing: edges
+** between pixels are matched against L, Z and U shapes, and pixels along
+** them are blended with their neighbors by the area the reconstructed
+** silhouette covers. When a geometry buffer is given, edges are found
+** between different objects instead of different colors.
+*/
+void postprocess_mlaa(struct rgb_image *image, const struct gbuffer *gbuffer,
+                      size_t threads);
+
+#endif
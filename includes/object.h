@@ -8,11 +8,16 @@
 
 /*
 ** The location and normal of an intersection.
+** Textured objects also give the texture coordinates of the point, and how
+** many texture units a unit of distance covers around it.
 */
 struct intersection
 {
     struct vec3 point;
     struct vec3 normal;
+    double u;
+    double v;
+    double uv_scale;
 };
 
 /* The scene type needs to be forward declared, as the scene
@@ -78,6 +83,8 @@ struct object_intersection
 {
     struct intersection location;
     struct material *material;
+    // the object hit, set by scene_intersect_ray
+    const struct object *object;
 };
 
 struct object;
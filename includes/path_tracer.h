@@ -0,0 +1,21 @@
+#pragma once
+
+#include "image.h"
+#include "rendering.h"
+#include "scene.h"
+
+#include <stddef.h>
+
+// how deep paths may go
+#define PATH_MAX_DEPTH 8
+// the depth after which paths may be randomly terminated
+#define PATH_ROULETTE_DEPTH 3
+
+/*
+** Render pixels using unidirectional path tracing, with next event
+** estimation. Samples are added to the accumulation buffer of the scene
+** until the confidence interval of the pixel is narrow enough, or the
+** maximum number of samples is reached. Rendering a pixel again resumes
+** from the accumulated samples.
+*/
+extern const struct render_mode path_render_mode;
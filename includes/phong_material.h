@@ -1,6 +1,7 @@
 #pragma once
 
 #include "object.h"
+#include "texture.h"
 #include "vec3.h"
 
 #include <stddef.h>
@@ -11,6 +12,8 @@ struct phong_material
     struct material base;
 
     struct vec3 surface_color;
+    // multiplies the surface color if not NULL
+    const struct texture *diffuse_texture;
     // the diffuse light intensity coefficient
     double diffuse_Kn;
 
@@ -23,6 +26,14 @@ struct phong_material
     double ambient_intensity;
 };
 
+/*
+** The surface color at an intersection, which depends on the texture of the
+** material. The texture is filtered over the footprint of the ray.
+*/
+struct vec3 phong_material_color(const struct phong_material *mat,
+                                 const struct intersection *inter,
+                                 const struct ray *ray);
+
 struct vec3 phong_metarial_shade(const struct material *material,
                                  const struct intersection *inter,
                                  const struct scene *scene,
@@ -31,4 +42,5 @@ struct vec3 phong_metarial_shade(const struct material *material,
 static inline void phong_material_init(struct phong_material *mat)
 {
     material_init(&mat->base, NULL, phong_metarial_shade);
+    mat->diffuse_texture = NULL;
 }
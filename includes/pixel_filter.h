@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+** How samples spread around a pixel are weighted, when several samples are
+** taken per pixel.
+*/
+enum pixel_filter
+{
+    // all the samples inside the pixel weigh the same
+    PIXEL_FILTER_BOX,
+    // samples weigh less as they get further from the center, up to one
+    // pixel away
+    PIXEL_FILTER_TENT,
+    // a truncated gaussian, up to one and a half pixel away
+    PIXEL_FILTER_GAUSSIAN,
+};
+
+/*
+** How far from the center of the pixel samples have some weight, in pixels.
+*/
+double pixel_filter_radius(enum pixel_filter filter);
+
+/*
+** The weight of a sample at some offset from the center of the pixel.
+*/
+double pixel_filter_weight(enum pixel_filter filter, double dx, double dy);
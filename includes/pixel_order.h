@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** The order runners walk pixels in, inside tiles and across the image.
+** Along space filling curves, consecutive rays stay in the same area of
+** the screen, and hit the same objects.
+*/
+enum pixel_order
+{
+    // rows from left to right, top row first
+    ORDER_SCANLINE,
+    // Z-order, interleaving the bits of the coordinates
+    ORDER_MORTON,
+    // Hilbert curve, where consecutive positions are always neighbors
+    ORDER_HILBERT,
+    ORDER_UNKNOWN,
+};
+
+struct pixel_pos
+{
+    uint32_t x;
+    uint32_t y;
+};
+
+/*
+** Order selected in the argument parser, after the '='
+*/
+enum pixel_order select_order_opt(const char *option);
+
+/*
+** Select the order used by all runners. The default is scanline.
+*/
+void pixel_order_init(enum pixel_order order);
+
+/*
+** The positions of a width x height grid, in the selected order. Returns
+** NULL for scanline order, which callers walk with plain loops.
+*/
+struct pixel_pos *pixel_order_build(size_t width, size_t height);
@@ -6,4 +6,18 @@ struct ray
 {
     struct vec3 source;
     struct vec3 direction;
+    // rays stand for a cone of directions, used to filter textures: how wide
+    // it is at the source, and how fast it widens with distance
+    double cone_width;
+    double cone_spread;
 };
+
+/*
+** The width of the cone of the ray once it reaches some point.
+*/
+static inline double ray_cone_width(const struct ray *ray,
+                                    const struct vec3 *point)
+{
+    struct vec3 offset = vec3_sub(point, &ray->source);
+    return ray->cone_width + vec3_length(&offset) * ray->cone_spread;
+}
@@ -1,16 +1,126 @@
 #ifndef RENDERING_H
 #define RENDERING_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 #include "image.h"
+#include "pixel_order.h"
+#include "ray.h"
 #include "scene.h"
 
+struct render_ctx;
+
+/*
+** Render a pixel of the image
+*/
+typedef void (*render_pixel_f)(struct rgb_image *image,
+                               const struct render_ctx *ctx, size_t x,
+                               size_t y);
+
+/*
+** Render the pixels of the mask of the context in a rectangle of the image,
+** from (x_from, y_from) to (x_to, y_to) excluded, already clipped to it.
+*/
+typedef void (*render_tile_f)(struct rgb_image *image,
+                              const struct render_ctx *ctx, size_t x_from,
+                              size_t y_from, size_t x_to, size_t y_to);
+
+/*
+** Used to define the type of renderer we want. Modes rendering tiles at
+** once, such as to generate their camera rays together, have a tile entry
+** point, and the others are rendered pixel by pixel in the selected order.
+*/
+struct render_mode
+{
+    render_pixel_f pixel;
+    // NULL renders tiles with the pixel entry point
+    render_tile_f tile;
+};
+
+/*
+** What a camera ray brings back: its color, and the first object it hit
+** (NULL for the background), how far it was and its normal there.
+*/
+struct render_sample
+{
+    struct vec3 color;
+    const struct object *object;
+    double depth;
+    struct vec3 normal;
+};
+
+/*
+** Compute a sample of the image, at some point in pixels. Render modes
+** are built from those, as they can be used to sample anywhere in pixels.
+*/
+typedef void (*render_sample_f)(struct render_sample *res,
+                                const struct rgb_image *image,
+                                const struct render_ctx *ctx, double x,
+                                double y);
+
+/*
+** Render a pixel with the number of samples and filter of the scene, and
+** store what it sees in the geometry buffer of the scene, if any.
+** Samples are accumulated in floating point, and the pixel is written once.
+*/
+void render_pixel(struct rgb_image *image, const struct render_ctx *ctx,
+                  render_sample_f sample, size_t x, size_t y);
+
+/*
+** Cast a camera ray through a point of the image, in pixels.
+** The ray of pixel (x, y) goes through (x, y), the center of the pixel,
+** which covers [x - 0.5, x + 0.5). All the features sampling inside pixels
+** spread their samples around it.
+*/
+struct ray image_cast_ray(const struct rgb_image *image,
+                          const struct render_ctx *ctx, double x, double y);
+
 /*
-** Used to define the type of renderer we want
+** Cast the camera rays of count pixels of a row at once, from (x, y). The
+** rays are the ones image_cast_ray casts, stepping along the image plane
+** rather than starting over for each pixel.
 */
-typedef void (*render_mode_f)(struct rgb_image *, struct scene *, size_t x,
-                              size_t y);
+void image_cast_rays(const struct rgb_image *image,
+                     const struct render_ctx *ctx, size_t x, size_t y,
+                     size_t count, struct ray *rays);
+
+/*
+** What the pixels of a frame have in common, set up once before its tiles
+** are rendered. This is the contract between runners and render modes:
+** runners split frames in tiles, and render them with render_tile.
+*/
+struct render_ctx
+{
+    struct scene *scene;
+    // what the camera rays of the frame have in common
+    struct camera_view view;
+    const struct render_mode *renderer;
+    // The pixels to render, one byte per pixel, NULL renders them all
+    const uint8_t *mask;
+    // The positions of the pixels of a tile in the selected order, NULL for
+    // scanline order, and the side of the tiles they cover
+    struct pixel_pos *order;
+    size_t order_side;
+};
+
+/*
+** Set up the rendering of a frame in tiles of the given side, with the
+** camera of the scene as it is now. The mask must outlive the context.
+*/
+void render_ctx_init(struct render_ctx *ctx, struct scene *scene,
+                     const struct render_mode *renderer, const uint8_t *mask,
+                     size_t tile_size);
+void render_ctx_destroy(struct render_ctx *ctx);
+
+/*
+** Render the pixels of a rectangle of the image, clipped to it, with the
+** tile entry point of the mode if it has one. Otherwise, pixels are
+** rendered in the selected order for rectangles up to the tile size of the
+** context.
+*/
+void render_tile(const struct render_ctx *ctx, size_t x0, size_t y0, size_t w,
+                 size_t h, struct rgb_image *out);
 
 /*
 ** This define the type of runner used for rendering the image (Multithreaded or
@@ -21,15 +131,58 @@ enum runner_type
     RUNNER_SINGLETHREADED = 0,
     RUNNER_MULTITHREADED,
     RUNNER_REALTIME,
+    RUNNER_PROGRESSIVE,
     RUNNER_UNKNOWN
 };
 
 /*
-** Run if it's single threaded, multi-threaded or realtime
+** The settings of the runners
+*/
+struct runner_options
+{
+    // The number of threads of the multi-threaded, realtime and progressive
+    // runners
+    size_t threads;
+    // The side of the tiles rendered by threads
+    size_t tile_size;
+    // The number of realtime frames, 0 renders until asked to quit
+    size_t frames;
+    // The time given to each realtime frame, in seconds
+    double frame_budget;
+    // The smallest scale of the resolution of realtime frames, 0 always
+    // renders them at the size of the image
+    double min_scale;
+    // How often realtime pixels reused from the last frame are rendered
+    // again, in frames, 0 renders every pixel of every frame
+    size_t temporal_refresh;
+    // Where realtime frames are sent: "-" for stdout, "shm:NAME", or NULL
+    const char *sink;
+    // The path of a pipe of camera commands, or NULL
+    const char *control;
+    // Where the progressive runner writes previews, NULL disables them
+    const char *preview_path;
+    // The time between previews, in seconds
+    double preview_interval;
+    // The time the progressive runner may render for, in seconds, before
+    // stopping with the best image so far, 0 renders the whole image
+    double time_budget;
+    // Where the multi-threaded runner saves completed tiles, NULL disables
+    // checkpoints
+    const char *checkpoint_path;
+    // The time between checkpoints, in seconds
+    double checkpoint_interval;
+    // Whether to load the tiles of the checkpoint before rendering
+    bool resume;
+    // Identifies the render in checkpoints, from checkpoint_render_key
+    uint64_t render_key;
+};
+
+/*
+** Run if it's single threaded, multi-threaded, realtime or progressive
 */
 int run_renderer(struct rgb_image *image, struct scene *scene,
-                 enum runner_type runner, render_mode_f renderer,
-                 size_t threads);
+                 enum runner_type runner, const struct render_mode *renderer,
+                 const struct runner_options *options);
 
 /*
 ** Get runner type from options parser
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "image.h"
+
+#include <stddef.h>
+
+/*
+** How source pixels are weighted when resizing an image.
+*/
+enum resample_filter
+{
+    // the average of all the source pixels covered by the output pixel
+    RESAMPLE_BOX,
+    // a windowed sinc over 3 output pixels on each side, sharper but
+    // with some ringing
+    RESAMPLE_LANCZOS,
+    RESAMPLE_UNKNOWN,
+};
+
+/*
+** Get the filter from the argument parser, after the '='
+*/
+enum resample_filter select_resample_opt(const char *option);
+
+/*
+** Resize the source image to the size of the destination image.
+** The filter is separable: each output row first gathers the source rows
+** under it, then filters along the row. Rows are split between threads.
+*/
+void image_resample(const struct rgb_image *src, struct rgb_image *dst,
+                    enum resample_filter filter, size_t threads);
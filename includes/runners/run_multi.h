@@ -3,28 +3,111 @@
 
 #include "bmp.h"
 #include "camera.h"
+#include "checkpoint.h"
 #include "image.h"
 #include "normal_material.h"
 #include "obj_loader.h"
+#include "pixel_order.h"
 #include "rendering.h"
 #include "scene.h"
 #include "triangle.h"
 #include "vec3.h"
 
-struct mt_worker_args
+#include <pthread.h>
+#include <stdint.h>
+
+// The default side of the square tiles threads render, in pixels
+#define MT_DEFAULT_TILE_SIZE 32
+// The size of a cache line, in bytes
+#define MT_CACHE_LINE 64
+
+/*
+** The tiles left to a thread, as a range of tile indices. The thread takes
+** tiles from the front, and other threads steal from the back.
+*/
+struct mt_tile_queue
+{
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+    // keeps the queues of different threads on different cache lines
+    char padding[MT_CACHE_LINE];
+};
+
+/*
+** What all the threads share: the image is cut in tiles, numbered row by
+** row, and each thread starts with a contiguous range of them along the
+** selected pixel order.
+*/
+struct mt_scheduler
 {
     // Image to write to
     struct rgb_image *image;
-    // The scene
-    struct scene *scene;
-    // Renderer used
-    render_mode_f renderer;
-    // Compute image pixels between y_from to y_to
-    size_t y_from;
-    size_t y_to;
+    // The scene, renderer and pixels to render
+    struct render_ctx ctx;
+    size_t tile_size;
+    // The number of tiles in a row of tiles, and the first row of tiles
+    // scheduled
+    size_t tiles_x;
+    size_t tiles_y_from;
+    size_t threads;
+    struct mt_tile_queue *queues;
+    // Tiles are skipped once this time from clock_seconds is reached, 0
+    // renders them all
+    double deadline;
+    // One byte per tile, set for the tiles skipped at the deadline
+    uint8_t *skipped;
+    // Where completed tiles are saved, NULL if they aren't
+    struct checkpoint *checkpoint;
+    // The positions of tiles in the image in the selected order, NULL for
+    // scanline order
+    struct pixel_pos *tiles;
 };
 
+struct mt_worker_args
+{
+    struct mt_scheduler *scheduler;
+    // The index of the thread, and of its queue
+    size_t id;
+    // How many tiles the thread rendered, and how many it stole
+    size_t tiles_rendered;
+    size_t tiles_stolen;
+    // How many tiles the thread skipped at the deadline
+    size_t tiles_skipped;
+    // The time spent rendering, in seconds
+    double busy_time;
+};
+
+/*
+** Render the image in tiles on the thread pool, saving completed tiles to a
+** checkpoint if there is a checkpoint path
+*/
 int runner_multithread(struct rgb_image *image, struct scene *scene,
-                       render_mode_f renderer, size_t threads);
+                       const struct render_mode *renderer,
+                       const struct runner_options *options);
+
+/*
+** Render the image like runner_multithread, without logging anything, for
+** runners rendering many frames. Only the pixels set in the mask are
+** rendered, if there is one.
+*/
+int runner_multithread_frame(struct rgb_image *image, struct scene *scene,
+                             const struct render_mode *renderer,
+                             size_t threads, size_t tile_size,
+                             const uint8_t *mask);
+
+/*
+** Render the masked pixels between rows y_from and y_to like
+** runner_multithread_frame, until the deadline from clock_seconds. Only the
+** tiles over these rows are scheduled, and the mask must be clear outside
+** of them. Threads stop taking tiles once the deadline is reached, and
+** finish the ones they are rendering. The pixels of the tiles skipped are
+** cleared in the mask, and their number is returned.
+*/
+size_t runner_multithread_until(struct rgb_image *image, struct scene *scene,
+                                const struct render_mode *renderer,
+                                size_t threads, size_t tile_size,
+                                uint8_t *mask, size_t y_from, size_t y_to,
+                                double deadline);
 
 #endif
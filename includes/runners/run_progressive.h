@@ -0,0 +1,24 @@
+#ifndef RUN_PROGRESSIVE_H
+#define RUN_PROGRESSIVE_H
+
+#include "image.h"
+#include "rendering.h"
+#include "scene.h"
+
+// The default time between previews, in seconds
+#define PROGRESSIVE_DEFAULT_INTERVAL 1.
+
+/*
+** Progressive runner: render one pixel out of 4 in each direction first,
+** then one out of 2, then the others, so that a coarse image is available
+** early. Each pixel is rendered once, by the tiles of the multi-threaded
+** runner, and the final image is the same as with the other runners.
+** Previews filling the missing pixels with the closest rendered ones are
+** written to the preview path after the first pass, and then every
+** preview interval, atomically.
+*/
+int runner_progressive(struct rgb_image *image, struct scene *scene,
+                       const struct render_mode *renderer,
+                       const struct runner_options *options);
+
+#endif
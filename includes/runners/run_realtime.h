@@ -0,0 +1,30 @@
+#ifndef RUN_REALTIME_H
+#define RUN_REALTIME_H
+
+#include "image.h"
+#include "rendering.h"
+#include "scene.h"
+
+// The default time given to each frame, in milliseconds
+#define REALTIME_DEFAULT_BUDGET_MS 33.3
+
+/*
+** Realtime runner: render frames in a loop, reusing the frame buffer and
+** the thread pool, and send them to the sink of the options. Frames
+** finishing within the budget wait for the rest of it. The camera is moved
+** by commands read from the control pipe, one per line:
+**  - 'pos X Y Z' moves the camera to a point
+**  - 'move X Y Z' moves the camera by an offset
+**  - 'look X Y Z' turns the camera towards a point
+**  - 'turn YAW PITCH' turns the camera, in degrees
+**  - 'quit' stops rendering
+** The loop stops after the requested number of frames, on 'quit', or on
+** SIGINT. The image holds the last frame.
+** With a minimum scale, frames are rendered at the resolution fitting in the
+** budget and upscaled to the size of the image.
+*/
+int runner_realtime(struct rgb_image *image, struct scene *scene,
+                    const struct render_mode *renderer,
+                    const struct runner_options *options);
+
+#endif
@@ -11,7 +11,11 @@
 #include "triangle.h"
 #include "vec3.h"
 
+/*
+** Render the tiles of the image one after the other, on the calling thread
+*/
 int runner_singlethread(struct rgb_image *image, struct scene *scene,
-                        render_mode_f renderer);
+                        const struct render_mode *renderer,
+                        const struct runner_options *options);
 
 #endif
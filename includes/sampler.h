@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** Sample sequences shared by all the stochastic features.
+** Samples are fully determined by the pixel, the sample index and the
+** dimension, so any thread can generate them without sharing state, and
+** pixels render the same whichever thread renders them.
+*/
+
+// the side of the blue noise tile, in pixels
+#define SAMPLER_BLUE_NOISE_SIZE 64
+
+/*
+** The dimensions used by render modes. Dimensions from SAMPLER_DIM_STREAM
+** on are handed out in order by the sample stream.
+*/
+#define SAMPLER_DIM_PIXEL 0
+#define SAMPLER_DIM_STREAM 2
+
+enum sampler_type
+{
+    // Sobol points with Owen scrambling, unique to each pixel
+    SAMPLER_SOBOL,
+    // a blue noise tile over pixels, rotated from a sample to the next
+    SAMPLER_BLUE_NOISE,
+    // jittered strata, shuffled independently in each dimension
+    SAMPLER_STRATIFIED,
+    SAMPLER_UNKNOWN,
+};
+
+/*
+** Sampler selected in the argument parser
+*/
+enum sampler_type select_sampler_opt(const char *option);
+
+/*
+** Select the sequence used by all samples, and build its tables. Must be
+** called before rendering.
+*/
+void sampler_init(enum sampler_type type);
+
+/*
+** The index-th sample of a pixel, out of count, in a given dimension.
+** The result is in [0, 1).
+*/
+double sampler_get(size_t x, size_t y, uint32_t index, uint32_t count,
+                   uint32_t dimension);
+
+/*
+** A 2D sample, using dimension and the next one. Points of the same
+** dimensions are well distributed over the square.
+*/
+void sampler_get_2d(size_t x, size_t y, uint32_t index, uint32_t count,
+                    uint32_t dimension, double *u, double *v);
+
+/*
+** Start the sample stream of the calling thread, for the index-th sample
+** of a pixel, out of count.
+*/
+void sampler_start(size_t x, size_t y, uint32_t index, uint32_t count);
+
+/*
+** The next dimension of the sample stream of the calling thread.
+*/
+double sampler_next(void);
+
+/*
+** The next two dimensions of the sample stream of the calling thread.
+*/
+void sampler_next_2d(double *u, double *v);
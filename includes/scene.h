@@ -1,10 +1,19 @@
 #pragma once
 
+#include "accum_buffer.h"
 #include "camera.h"
+#include "gbuffer.h"
+#include "irradiance_cache.h"
+#include "light.h"
+#include "light_tree.h"
 #include "object.h"
+#include "pixel_filter.h"
+#include "texture_cache.h"
 
 #include "utils/pvect.h"
 
+#include <stdbool.h>
+
 // this code creates a new type of vector using C's
 // poor man template metaprogramming™
 #define GVECT_NAME object_vect
@@ -13,20 +22,64 @@
 #undef GVECT_NAME
 #undef GVECT_TYPE
 
+// the default number of lights sampled per shading point
+#define SCENE_DEFAULT_LIGHT_SAMPLES 8
+// the default number of shadow rays for area lights, outside and inside
+// penumbras
+#define SCENE_DEFAULT_AREA_SAMPLES_MIN 4
+#define SCENE_DEFAULT_AREA_SAMPLES_PENUMBRA 16
+// the default settings of the ambient occlusion renderer
+#define SCENE_DEFAULT_AO_SAMPLES 16
+#define SCENE_DEFAULT_AO_DISTANCE 0.5
+// the default settings of the path tracer
+#define SCENE_DEFAULT_PATH_SAMPLES_MIN 8
+#define SCENE_DEFAULT_PATH_SAMPLES_MAX 256
+#define SCENE_DEFAULT_PATH_ERROR 0.05
+
 /* The scene contains all the objects, lights, and cameras.
-** for simplicity scene, this scene type only handles a single light and
-** a single camera.
+** for simplicity scene, this scene type only handles a single camera.
 */
 struct scene
 {
     // the list of objects in the scene
     struct object_vect objects;
 
-    // a very hacky single light
-    // TODO: handle multiple lights
-    struct vec3 light_color;
-    struct vec3 light_direction;
-    double light_intensity;
+    // the list of lights in the scene
+    struct light_vect lights;
+    // a hierarchy of the above lights, built by scene_build_lights
+    struct light_tree light_tree;
+    // how many lights can be sampled per shading point
+    size_t light_samples;
+    // how many shadow rays are first cast towards area lights, and how many
+    // more are cast in penumbras, when those rays disagree
+    size_t area_samples_min;
+    size_t area_samples_penumbra;
+
+    // how many occlusion rays are cast per pixel in ambient occlusion mode,
+    // and how far objects occlude
+    size_t ao_samples;
+    double ao_distance;
+
+    // the path tracer takes at least path_samples_min samples per pixel, and
+    // stops once the 95% confidence interval of the pixel is within
+    // path_error of its value, or after path_samples_max samples
+    size_t path_samples_min;
+    size_t path_samples_max;
+    double path_error;
+    // where the path tracer accumulates samples, NULL for other renderers
+    struct accum_buffer *accum;
+    // where the path tracer gets the diffuse indirect lighting of primary
+    // hits from, NULL to trace it
+    struct irradiance_cache *irradiance_cache;
+    // the number of samples render modes take per pixel, and how they're
+    // weighted
+    size_t pixel_samples;
+    enum pixel_filter pixel_filter;
+    // where render modes store what each pixel sees, NULL if not needed
+    struct gbuffer *gbuffer;
+
+    // the tiles of the textures of the materials
+    struct texture_cache textures;
 
     struct camera camera;
 };
@@ -34,6 +87,46 @@ struct scene
 static inline void scene_init(struct scene *scene)
 {
     object_vect_init(&scene->objects, 42);
+    light_vect_init(&scene->lights, 8);
+    light_tree_init(&scene->light_tree);
+    scene->light_samples = SCENE_DEFAULT_LIGHT_SAMPLES;
+    scene->area_samples_min = SCENE_DEFAULT_AREA_SAMPLES_MIN;
+    scene->area_samples_penumbra = SCENE_DEFAULT_AREA_SAMPLES_PENUMBRA;
+    scene->ao_samples = SCENE_DEFAULT_AO_SAMPLES;
+    scene->ao_distance = SCENE_DEFAULT_AO_DISTANCE;
+    scene->path_samples_min = SCENE_DEFAULT_PATH_SAMPLES_MIN;
+    scene->path_samples_max = SCENE_DEFAULT_PATH_SAMPLES_MAX;
+    scene->path_error = SCENE_DEFAULT_PATH_ERROR;
+    scene->accum = NULL;
+    scene->irradiance_cache = NULL;
+    scene->pixel_samples = 1;
+    scene->pixel_filter = PIXEL_FILTER_BOX;
+    scene->gbuffer = NULL;
+    texture_cache_init(&scene->textures, TEXTURE_CACHE_DEFAULT_SIZE);
+}
+
+/*
+** Build the light hierarchy. Must be called once all lights are added.
+*/
+static inline void scene_build_lights(struct scene *scene)
+{
+    light_tree_build(&scene->light_tree, &scene->lights);
 }
 
 void scene_destroy(struct scene *scene);
+
+/*
+** Find the closest object intersecting the ray.
+** Returns the distance to the intersection, or INFINITY if nothing was hit.
+*/
+double scene_intersect_ray(struct object_intersection *closest_intersection,
+                           const struct scene *scene, const struct ray *ray);
+
+/*
+** Occlusion-only query: tells whether any object intersects the ray closer
+** than max_dist. Unlike scene_intersect_ray, it stops at the first hit.
+** The last occluder found by the calling thread is tested first, as
+** neighboring shadow rays are usually blocked by the same object.
+*/
+bool scene_occluded(const struct scene *scene, const struct ray *ray,
+                    double max_dist);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** Counters gathered while rendering, printed with --stats.
+** Each thread counts in its own copy to avoid contention, and adds it to the
+** totals using stats_flush once it's done.
+*/
+struct render_stats
+{
+    // the number of rays traced towards lights
+    uint64_t shadow_rays;
+    // the number of ambient occlusion rays traced
+    uint64_t occlusion_rays;
+    // the number of paths traced by the path tracer
+    uint64_t path_samples;
+    // the number of irradiance cache lookups, and how many found records
+    uint64_t irradiance_lookups;
+    uint64_t irradiance_hits;
+    // the number of irradiance records computed
+    uint64_t irradiance_records;
+    // the number of texels read from the texture cache, and how many of
+    // those had to page in a tile
+    uint64_t texture_lookups;
+    uint64_t texture_misses;
+};
+
+extern __thread struct render_stats stats_local;
+
+static inline void stats_count_shadow_ray(void)
+{
+    stats_local.shadow_rays++;
+}
+
+static inline void stats_count_occlusion_ray(void)
+{
+    stats_local.occlusion_rays++;
+}
+
+static inline void stats_count_path_sample(void)
+{
+    stats_local.path_samples++;
+}
+
+static inline void stats_count_irradiance_lookup(void)
+{
+    stats_local.irradiance_lookups++;
+}
+
+static inline void stats_count_irradiance_hit(void)
+{
+    stats_local.irradiance_hits++;
+}
+
+static inline void stats_count_irradiance_record(void)
+{
+    stats_local.irradiance_records++;
+}
+
+static inline void stats_count_texture_lookup(void)
+{
+    stats_local.texture_lookups++;
+}
+
+static inline void stats_count_texture_miss(void)
+{
+    stats_local.texture_misses++;
+}
+
+/*
+** Add the counters of the calling thread to the totals, and reset them.
+*/
+void stats_flush(void);
+
+/*
+** Print the totals, averaged over the given number of pixels.
+*/
+void stats_print(size_t pixels);
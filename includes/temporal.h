@@ -0,0 +1,83 @@
+#pragma once
+
+#include "camera.h"
+#include "gbuffer.h"
+#include "image.h"
+#include "scene.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Every pixel is rendered again at least once in this many frames
+#define TEMPORAL_DEFAULT_REFRESH 8
+// The distance between the pixels whose depth is traced to find the
+// reprojected pixels hidden behind objects which came in view
+#define TEMPORAL_DEPTH_STEP 4
+// How much farther than the traced depth a reprojected pixel may be
+#define TEMPORAL_DEPTH_TOLERANCE 0.01
+
+/*
+** The last realtime frame, and where its pixels were in space, so that the
+** next frame can reuse the pixels still in view.
+*/
+struct temporal_history
+{
+    // the size of the stored frame, and of the largest frame
+    size_t width;
+    size_t height;
+    size_t capacity;
+    // whether a frame was stored
+    bool valid;
+    struct camera camera;
+    struct camera_view view;
+    struct rgb_pixel *colors;
+    // the distance from the image plane, INFINITY for the background
+    float *depths;
+
+    // the depth of the pixels reprojected in the current frame
+    float *reprojected;
+    // for each pixel of the current frame, the depth and index of the
+    // closest stored pixel landing on it, packed so that the smallest wins
+    uint64_t *landed;
+    // the depth of the current frame, every TEMPORAL_DEPTH_STEP pixels
+    float *coarse_depths;
+    // the pixels the current frame has to render, one byte per pixel
+    uint8_t *retrace;
+
+    // a subset of the pixels is rendered again every frame, so that
+    // view dependent shading doesn't stay stale forever
+    size_t refresh;
+    size_t frame;
+
+    // how many pixels were rendered and reused over all frames
+    size_t retraced;
+    size_t reused;
+};
+
+void temporal_init(struct temporal_history *history, size_t width,
+                   size_t height, size_t refresh);
+void temporal_destroy(struct temporal_history *history);
+
+/*
+** Fill the image with the pixels of the last frame, seen from the camera of
+** the scene. Pixels no stored pixel lands on, pixels hidden by objects
+** closer to the camera, and the pixels due for a refresh, are cleared and
+** marked in the retrace mask. Returns the number of pixels to render.
+*/
+size_t temporal_reproject(struct temporal_history *history,
+                          struct rgb_image *image, const struct scene *scene,
+                          size_t threads);
+
+/*
+** Keep the rendered frame for the next one. Rendered pixels take their
+** depth from the geometry buffer, reused ones keep their reprojected depth.
+*/
+void temporal_store(struct temporal_history *history,
+                    const struct rgb_image *image, struct gbuffer *gbuffer,
+                    const struct camera *camera, size_t threads);
+
+/*
+** Log the proportion of rendered and reused pixels.
+*/
+void temporal_report(const struct temporal_history *history);
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "texture_cache.h"
+#include "vec3.h"
+
+#include <stddef.h>
+
+// enough levels for textures up to 65536 texels wide
+#define TEXTURE_MAX_LEVELS 17
+
+/*
+** A level of the mip pyramid, stored as tiles in the texture cache, row
+** after row.
+*/
+struct texture_level
+{
+    size_t width;
+    size_t height;
+    size_t tiles_x;
+    size_t first_tile;
+};
+
+/*
+** A texture, and its pre-filtered mip levels down to a single texel.
+** Textures are owned by the texture cache they're loaded in.
+*/
+struct texture
+{
+    char *path;
+    size_t levels_count;
+    struct texture_level levels[TEXTURE_MAX_LEVELS];
+    // where the tiles of the levels are
+    struct texture_cache *cache;
+    // the next texture of the cache
+    struct texture *next;
+};
+
+/*
+** Load a BMP texture, or return the already loaded one with the same path.
+** Returns NULL on failure.
+*/
+struct texture *texture_load(struct texture_cache *cache, const char *path);
+
+void texture_free(struct texture *texture);
+
+/*
+** Get the color of the texture at (u, v), filtered over a footprint width
+** texture units wide. Coordinates wrap around.
+*/
+struct vec3 texture_sample(const struct texture *texture, double u, double v,
+                           double width);
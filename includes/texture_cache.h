@@ -0,0 +1,93 @@
+#pragma once
+
+#include "image.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+// textures are stored in square tiles of this side, in texels
+#define TEXTURE_TILE_SIZE 32
+// the default memory used by tiles, in MiB
+#define TEXTURE_CACHE_DEFAULT_SIZE 16
+// the number of independently locked parts of the cache
+#define TEXTURE_CACHE_SHARDS 16
+// the number of tiles each thread keeps a copy of
+#define TEXTURE_CACHE_THREAD_TILES 8
+
+struct texture_tile
+{
+    struct rgb_pixel texels[TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE];
+};
+
+struct texture_slot;
+struct texture;
+
+/*
+** A part of the tiles in memory, with its own lock, so that threads reading
+** different tiles rarely wait for each other.
+*/
+struct texture_shard
+{
+    pthread_mutex_t lock;
+    // the maximum number of tiles in memory
+    size_t capacity;
+    size_t slots_count;
+    // a hash table of the tiles in memory, by tile index
+    struct texture_slot **buckets;
+    size_t buckets_count;
+    // the most recently used tile, and the least recently used one
+    struct texture_slot *lru_first;
+    struct texture_slot *lru_last;
+};
+
+/*
+** A fixed-size cache of texture tiles. Tiles of all the textures are written
+** to a temporary file when loaded, and paged back in when needed. Once the
+** cache is full, the least recently used tile makes room for the new one,
+** so memory use doesn't depend on the size of the textures.
+** Tiles are split between shards by index, and each thread keeps copies of
+** the last tiles it read, which it reads without locking. Tiles never
+** change once added, so copies never go stale.
+*/
+struct texture_cache
+{
+    // serializes adding tiles
+    pthread_mutex_t lock;
+    // where all the tiles are stored, created with the first texture
+    FILE *backing;
+    size_t tiles_count;
+    // tells the caches apart in the copies of threads, never reused
+    size_t id;
+
+    struct texture_shard shards[TEXTURE_CACHE_SHARDS];
+
+    // the textures loaded so far
+    struct texture *textures;
+};
+
+/*
+** Initialize the cache, holding at most size MiB of tiles.
+*/
+void texture_cache_init(struct texture_cache *cache, size_t size);
+
+/*
+** Change the size of the cache, in MiB. Only valid before adding tiles.
+*/
+void texture_cache_resize(struct texture_cache *cache, size_t size);
+
+/*
+** Free the cache, and all the textures it holds.
+*/
+void texture_cache_destroy(struct texture_cache *cache);
+
+/*
+** Store a new tile, and return its index. Returns (size_t)-1 on failure.
+*/
+size_t texture_cache_add_tile(struct texture_cache *cache,
+                              const struct texture_tile *tile);
+
+/*
+** Get a texel of a tile, paging it in if needed.
+*/
+struct rgb_pixel texture_cache_texel(struct texture_cache *cache,
+                                     size_t tile_index, size_t x, size_t y);
@@ -4,8 +4,15 @@
 #include "utils/alloc.h"
 #include "vec3.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 
+struct texcoord
+{
+    double u;
+    double v;
+};
+
 /*
 ** The facing side of the triangle is the one where the points appear
 ** in counter clockwise order.
@@ -15,6 +22,12 @@ struct triangle
     struct object base;
     struct vec3 points[3];
     struct material *material;
+
+    // the texture coordinates of each point, if any
+    bool textured;
+    struct texcoord texcoords[3];
+    // how many texture units a unit of distance covers on the triangle
+    double uv_scale;
 };
 
 double object_triangle_ray_intersect(struct object_intersection *inter,
@@ -34,3 +47,9 @@ static inline struct triangle *triangle_create(struct vec3 points[3],
     trian->material = material_get(mat);
     return trian;
 }
+
+/*
+** Set the texture coordinates of the points of the triangle.
+*/
+void triangle_set_texcoords(struct triangle *trian,
+                            const struct texcoord texcoords[3]);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+** How threads are placed on the CPUs of the machine
+*/
+enum pin_policy
+{
+    // threads are left to the scheduler
+    PIN_NONE,
+    // threads fill the CPUs of a NUMA node before using the next one
+    PIN_COMPACT,
+    // consecutive threads go to different NUMA nodes
+    PIN_SCATTER,
+    PIN_UNKNOWN,
+};
+
+/*
+** Pinning policy selected in the argument parser, after the '='
+*/
+enum pin_policy select_pin_opt(const char *option);
+
+/*
+** Read the NUMA topology from /sys, and choose the CPU of each thread of
+** the given number using the policy. Only the CPUs the process may run on
+** are used.
+*/
+void affinity_init(enum pin_policy policy, size_t threads);
+void affinity_destroy(void);
+
+/*
+** Pin the calling thread to the CPU chosen for the given thread index.
+** Does nothing without a policy.
+*/
+void affinity_pin(size_t thread);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <errno.h>
+#include <time.h>
+
+/*
+** A monotonic clock, in seconds. Only differences between two calls are
+** meaningful.
+*/
+static inline double clock_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/*
+** Sleep for the given time, in seconds.
+*/
+static inline void clock_sleep(double seconds)
+{
+    struct timespec duration = {
+        .tv_sec = seconds,
+        .tv_nsec = (seconds - (time_t)seconds) * 1e9,
+    };
+    while (nanosleep(&duration, &duration) != 0 && errno == EINTR)
+        continue;
+}
@@ -56,7 +56,7 @@ void GVECT_FNAME(push)(struct GVECT_NAME *vect, GVECT_TYPE c);
 */
 GVECT_TYPE GVECT_FNAME(pop)(struct GVECT_NAME *vect);
 
-static inline size_t GVECT_FNAME(size)(struct GVECT_NAME *vect)
+static inline size_t GVECT_FNAME(size)(const struct GVECT_NAME *vect)
 {
     return vect->size;
 }
@@ -75,7 +75,8 @@ static inline GVECT_TYPE *GVECT_FNAME(data)(struct GVECT_NAME *vect)
     return vect->data;
 }
 
-static inline GVECT_TYPE GVECT_FNAME(get)(struct GVECT_NAME *vect, size_t i)
+static inline GVECT_TYPE GVECT_FNAME(get)(const struct GVECT_NAME *vect,
+                                            size_t i)
 {
     return vect->data[i];
 }
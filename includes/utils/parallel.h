@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+** A function processing the rows between y_from and y_to of some image.
+*/
+typedef void (*parallel_rows_f)(void *data, size_t y_from, size_t y_to);
+
+/*
+** Split the rows of an image in bands, one per thread, and wait for all of
+** them to be processed by the thread pool. When threads is 1 or less, rows
+** are processed by the calling thread.
+*/
+void parallel_rows(size_t height, size_t threads, parallel_rows_f func,
+                   void *data);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** Hardware cache counters of the threads of the pool, read with
+** perf_event_open where the kernel allows it.
+*/
+struct perf_counters
+{
+    size_t threads;
+    // for each thread, the file descriptors of the references to the last
+    // level cache and of the misses, -1 if unavailable
+    int *fds;
+    bool available;
+    uint64_t references;
+    uint64_t misses;
+};
+
+/*
+** Open and start the counters on each thread of the pool, bound to it.
+** Warns once if the counters are unavailable.
+*/
+void perf_counters_start(struct perf_counters *counters);
+
+/*
+** Stop the counters, and add up the counts of all the threads
+*/
+void perf_counters_stop(struct perf_counters *counters);
+
+/*
+** Print the counts, averaged over the given number of pixels
+*/
+void perf_counters_print(const struct perf_counters *counters, size_t pixels);
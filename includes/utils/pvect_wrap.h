@@ -18,7 +18,7 @@ struct GVECT_NAME
     struct pvect base;
 };
 
-static inline size_t GVECT_FNAME(size)(struct GVECT_NAME *vect)
+static inline size_t GVECT_FNAME(size)(const struct GVECT_NAME *vect)
 {
     return pvect_size(&vect->base);
 }
@@ -28,7 +28,8 @@ static inline GVECT_TYPE *GVECT_FNAME(data)(struct GVECT_NAME *vect)
     return (GVECT_TYPE *)pvect_data(&vect->base);
 }
 
-static inline GVECT_TYPE GVECT_FNAME(get)(struct GVECT_NAME *vect, size_t i)
+static inline GVECT_TYPE GVECT_FNAME(get)(const struct GVECT_NAME *vect,
+                                            size_t i)
 {
     return pvect_get(&vect->base, i);
 }
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+** A task of a batch, identified by its index in the batch.
+*/
+typedef void (*thread_pool_task_f)(void *data, size_t index);
+
+/*
+** Start the worker threads shared by all the parallel stages. Batches are
+** run by the given number of threads, including the one submitting them.
+** Without a pool, batches run on the calling thread. Threads are pinned
+** to CPUs by the affinity policy, if any.
+*/
+void thread_pool_start(size_t threads);
+
+/*
+** Stop and join the worker threads.
+*/
+void thread_pool_stop(void);
+
+/*
+** The number of threads running batches, including the calling thread.
+*/
+size_t thread_pool_size(void);
+
+/*
+** Run func on indices 0 to count - 1, spread over the pool, and wait for
+** all of them. The calling thread takes part in the batch. Tasks must not
+** submit batches themselves.
+** When there are as many tasks as threads, task i always runs on the same
+** thread, so that the memory a task first touched stays local to it.
+*/
+void thread_pool_run(size_t count, thread_pool_task_f func, void *data);
@@ -113,3 +113,17 @@ static inline void vec3_update_max_components(struct vec3 *self,
     if (o->z > self->z)
         self->z = o->z;
 }
+
+/*
+** Build two vectors which form an orthonormal basis with the normalized
+** vector n (Duff et al., "Building an Orthonormal Basis, Revisited").
+*/
+static inline void vec3_make_basis(const struct vec3 *n, struct vec3 *t,
+                                   struct vec3 *b)
+{
+    double sign = copysign(1., n->z);
+    double a = -1. / (sign + n->z);
+    double c = n->x * n->y * a;
+    *t = (struct vec3){1. + sign * n->x * n->x * a, sign * c, -sign * n->x};
+    *b = (struct vec3){c, sign + n->y * n->y * a, -n->y};
+}
@@ -8,44 +8,34 @@
 #include "antialias.h"
 #include "bmp.h"
 #include "camera.h"
+#include "checkpoint.h"
+#include "denoise.h"
+#include "dynamic_resolution.h"
+#include "guided_upsample.h"
 #include "image.h"
+#include "light_loader.h"
 #include "normal_material.h"
 #include "obj_loader.h"
+#include "path_tracer.h"
 #include "phong_material.h"
+#include "pixel_order.h"
 #include "rendering.h"
+#include "runners/run_multi.h"
+#include "runners/run_progressive.h"
+#include "runners/run_realtime.h"
+#include "sampler.h"
 #include "scene.h"
 #include "sphere.h"
+#include "stats.h"
+#include "temporal.h"
 #include "triangle.h"
+#include "utils/affinity.h"
+#include "utils/perf_counters.h"
+#include "utils/thread_pool.h"
 #include "vec3.h"
 
-/*
-** The color of a light is encoded inside a float, from 0 to +inf,
-** where 0 is no light, and +inf a lot more light. Unfortunately,
-** regular images can't hold such a huge range, and each color channel
-** is usualy limited to [0,255]. This function does the (lossy) translation
-** by mapping the float [0,1] range to [0,255]
-*/
-static inline uint8_t translate_light_component(double light_comp)
-{
-    if (light_comp < 0.)
-        light_comp = 0.;
-    if (light_comp > 1.)
-        light_comp = 1.;
-
-    return light_comp * 255;
-}
-
-/*
-** Converts an rgb floating point light color to 24 bit rgb.
-*/
-struct rgb_pixel rgb_color_from_light(const struct vec3 *light)
-{
-    struct rgb_pixel res;
-    res.r = translate_light_component(light->x);
-    res.g = translate_light_component(light->y);
-    res.b = translate_light_component(light->z);
-    return res;
-}
+// The number of camera rays the visibility pass casts at once
+#define VISIBILITY_RAYS 32
 
 #if 0
 static void build_test_scene(struct scene *scene, double aspect_ratio)
@@ -81,10 +71,9 @@ static void build_test_scene(struct scene *scene, double aspect_ratio)
     object_vect_push(&scene->objects, &sample_triangle->base);
 
     // setup the scene lighting
-    scene->light_intensity = 5;
-    scene->light_color = (struct vec3){1, 1, 0}; // yellow
-    scene->light_direction = (struct vec3){-1, 1, -1};
-    vec3_normalize(&scene->light_direction);
+    struct light *light = light_create_directional(
+        (struct vec3){-1, 1, -1}, (struct vec3){1, 1, 0} /* yellow */, 5);
+    light_vect_push(&scene->lights, light);
 
     // setup the camera
     double cam_width = 10;
@@ -107,11 +96,13 @@ static void build_test_scene(struct scene *scene, double aspect_ratio)
 static void build_obj_scene(struct scene *scene, double aspect_ratio,
                             double fov)
 {
-    // setup the scene lighting
-    scene->light_intensity = 5;
-    scene->light_color = (struct vec3){1, 1, 1};
-    scene->light_direction = (struct vec3){-1, -1, -1};
-    vec3_normalize(&scene->light_direction);
+    // setup the default scene lighting, unless lights were loaded
+    if (light_vect_size(&scene->lights) == 0)
+    {
+        struct light *light = light_create_directional(
+            (struct vec3){-1, -1, -1}, (struct vec3){1, 1, 1}, 5);
+        light_vect_push(&scene->lights, light);
+    }
 
     // setup the camera
     double cam_width = 2;
@@ -132,116 +123,226 @@ static void build_obj_scene(struct scene *scene, double aspect_ratio,
     vec3_normalize(&scene->camera.up);
 }
 
-static struct ray image_cast_ray(const struct rgb_image *image,
-                                 const struct scene *scene, size_t x, size_t y)
+/*
+** Find the closest object intersecting the camera ray going through a point
+** of the image. Returns false when the ray hits nothing, and the sample is
+** left to the background.
+*/
+static bool sample_primary(struct render_sample *res,
+                           struct object_intersection *inter,
+                           struct ray *ray, const struct rgb_image *image,
+                           const struct render_ctx *ctx, double x, double y)
 {
-    // find the position of the current pixel in the image plane
-    // camera_cast_ray takes camera relative positions, from -0.5 to 0.5 for
-    // both axis
-    double cam_x = ((double)x / image->width) - 0.5;
-    double cam_y = ((double)y / image->height) - 0.5;
-
-    // find the starting point and direction of this ray
-    struct ray ray;
-    camera_cast_ray(&ray, &scene->camera, cam_x, cam_y);
-    return ray;
+    *ray = image_cast_ray(image, ctx, x, y);
+    res->color = (struct vec3){0};
+    res->depth = scene_intersect_ray(inter, ctx->scene, ray);
+    res->object = NULL;
+    res->normal = (struct vec3){0};
+
+    // if the intersection distance is infinite, do not shade the sample
+    if (isinf(res->depth))
+        return false;
+
+    res->object = inter->object;
+    res->normal = inter->location.normal;
+    return true;
 }
 
-double scene_intersect_ray(struct object_intersection *closest_intersection,
-                           struct scene *scene, struct ray *ray)
+/* Try to find the closest object intersecting the camera ray. If an object
+** is found, shade the sample to find its color.
+*/
+static void sample_shaded(struct render_sample *res,
+                          const struct rgb_image *image,
+                          const struct render_ctx *ctx, double x, double y)
 {
-    // we will now try to find the closest object in the scene
-    // intersecting this ray
-    double closest_intersection_dist = INFINITY;
-
-    for (size_t i = 0; i < object_vect_size(&scene->objects); i++)
-    {
-        struct object *obj = object_vect_get(&scene->objects, i);
-        struct object_intersection intersection;
-        // if there's no intersection between the ray and this object, skip it
-        double intersection_dist = obj->intersect(&intersection, obj, ray);
-        if (intersection_dist >= closest_intersection_dist)
-            continue;
-
-        closest_intersection_dist = intersection_dist;
-        *closest_intersection = intersection;
-    }
+    struct ray ray;
+    struct object_intersection closest_intersection;
+    if (!sample_primary(res, &closest_intersection, &ray, image, ctx, x, y))
+        return;
 
-    return closest_intersection_dist;
+    struct material *mat = closest_intersection.material;
+    res->color
+        = mat->shade(mat, &closest_intersection.location, ctx->scene, &ray, 0);
 }
 
-/* For all the pixels of the image, try to find the closest object
-** intersecting the camera ray. If an object is found, shade the pixel to
-** find its color.
+/* Try to find the closest object intersecting the camera ray. If an object
+** is found, shade the sample using its normal.
 */
-static void render_shaded(struct rgb_image *image, struct scene *scene,
-                          size_t x, size_t y)
+static void sample_normals(struct render_sample *res,
+                           const struct rgb_image *image,
+                           const struct render_ctx *ctx, double x, double y)
 {
-    struct ray ray = image_cast_ray(image, scene, x, y);
-
+    struct ray ray;
     struct object_intersection closest_intersection;
-    double closest_intersection_dist
-        = scene_intersect_ray(&closest_intersection, scene, &ray);
-
-    // if the intersection distance is infinite, do not shade the pixel
-    if (isinf(closest_intersection_dist))
+    if (!sample_primary(res, &closest_intersection, &ray, image, ctx, x, y))
         return;
 
     struct material *mat = closest_intersection.material;
-    struct vec3 pix_color
-        = mat->shade(mat, &closest_intersection.location, scene, &ray, 0);
-    rgb_image_set(image, x, y, rgb_color_from_light(&pix_color));
+    res->color = normal_material.shade(mat, &closest_intersection.location,
+                                       ctx->scene, &ray, 0);
 }
 
-/* For all the pixels of the image, try to find the closest object
-** intersecting the camera ray. If an object is found, shade the pixel to
-** find its color.
+/* Try to find the closest object intersecting the camera ray. If an object
+** is found, shade the sample by how far it is.
 */
-static void render_normals(struct rgb_image *image, struct scene *scene,
-                           size_t x, size_t y)
+static void sample_distances(struct render_sample *res,
+                             const struct rgb_image *image,
+                             const struct render_ctx *ctx, double x, double y)
 {
-    struct ray ray = image_cast_ray(image, scene, x, y);
-
+    struct ray ray;
     struct object_intersection closest_intersection;
-    double closest_intersection_dist
-        = scene_intersect_ray(&closest_intersection, scene, &ray);
-
-    // if the intersection distance is infinite, do not shade the pixel
-    if (isinf(closest_intersection_dist))
+    if (!sample_primary(res, &closest_intersection, &ray, image, ctx, x, y))
         return;
 
-    struct material *mat = closest_intersection.material;
-    struct vec3 pix_color = normal_material.shade(
-        mat, &closest_intersection.location, scene, &ray, 0);
-    rgb_image_set(image, x, y, rgb_color_from_light(&pix_color));
+    assert(res->depth > 0);
+
+    double depth_repr = 1 / (res->depth + 1);
+    res->color = (struct vec3){depth_repr, depth_repr, depth_repr};
 }
 
-/* For all the pixels of the image, try to find the closest object
-** intersecting the camera ray. If an object is found, shade the pixel to
-** find its color.
+/*
+** Cast a cosine-weighted occlusion ray above the point, and tell whether it
+** hits an object closer than the occlusion distance.
 */
-static void render_distances(struct rgb_image *image, struct scene *scene,
-                             size_t x, size_t y)
+static bool ao_occluded(const struct scene *scene,
+                        const struct intersection *inter,
+                        const struct vec3 *tangent,
+                        const struct vec3 *bitangent, double u, double v)
 {
-    struct ray ray = image_cast_ray(image, scene, x, y);
+    // project a uniform point of the unit disk onto the hemisphere
+    double radius = sqrt(u);
+    double phi = 2 * M_PI * v;
+    struct vec3 dir_t = vec3_mul(tangent, radius * cos(phi));
+    struct vec3 dir_b = vec3_mul(bitangent, radius * sin(phi));
+    struct vec3 dir_n = vec3_mul(&inter->normal, sqrt(1 - u));
+
+    struct vec3 offset = vec3_mul(&inter->normal, 1e-6);
+    struct ray ray = {
+        .source = vec3_add(&inter->point, &offset),
+        .direction = vec3_add(&dir_t, &dir_b),
+    };
+    ray.direction = vec3_add(&ray.direction, &dir_n);
+
+    stats_count_occlusion_ray();
+    return scene_occluded(scene, &ray, scene->ao_distance);
+}
 
+/* Try to find the closest object intersecting the camera ray. If an object
+** is found, shade the sample by how much of the hemisphere above it is free
+** of nearby objects.
+*/
+static void sample_ao(struct render_sample *res, const struct rgb_image *image,
+                      const struct render_ctx *ctx, double x, double y)
+{
+    const struct scene *scene = ctx->scene;
+    struct ray ray;
     struct object_intersection closest_intersection;
-    double closest_intersection_dist
-        = scene_intersect_ray(&closest_intersection, scene, &ray);
+    if (!sample_primary(res, &closest_intersection, &ray, image, ctx, x, y))
+        return;
+
+    const struct intersection *inter = &closest_intersection.location;
+    struct vec3 tangent, bitangent;
+    vec3_make_basis(&inter->normal, &tangent, &bitangent);
+
+    size_t unoccluded = 0;
+    for (size_t i = 0; i < scene->ao_samples; i++)
+    {
+        double u, v;
+        // each sample of the pixel casts its own directions
+        sampler_next_2d(&u, &v);
+        unoccluded += !ao_occluded(scene, inter, &tangent, &bitangent, u, v);
+    }
+
+    double visibility = 1;
+    if (scene->ao_samples != 0)
+        visibility = (double)unoccluded / scene->ao_samples;
+
+    res->color = (struct vec3){visibility, visibility, visibility};
+}
+
+static void render_shaded(struct rgb_image *image,
+                          const struct render_ctx *ctx, size_t x, size_t y)
+{
+    render_pixel(image, ctx, sample_shaded, x, y);
+}
+
+static void render_normals(struct rgb_image *image,
+                           const struct render_ctx *ctx, size_t x, size_t y)
+{
+    render_pixel(image, ctx, sample_normals, x, y);
+}
 
-    // if the intersection distance is infinite, do not shade the pixel
-    if (isinf(closest_intersection_dist))
+static void render_distances(struct rgb_image *image,
+                             const struct render_ctx *ctx, size_t x, size_t y)
+{
+    render_pixel(image, ctx, sample_distances, x, y);
+}
+
+static void render_ao(struct rgb_image *image, const struct render_ctx *ctx,
+                      size_t x, size_t y)
+{
+    render_pixel(image, ctx, sample_ao, x, y);
+}
+
+/*
+** Store what a camera ray hits in the geometry buffer
+*/
+static void store_visibility(const struct render_ctx *ctx,
+                             const struct ray *ray, size_t x, size_t y)
+{
+    struct object_intersection inter;
+    struct gbuffer_pixel *pixel = gbuffer_get(ctx->scene->gbuffer, x, y);
+    pixel->depth = scene_intersect_ray(&inter, ctx->scene, ray);
+    pixel->object = NULL;
+    pixel->normal = (struct vec3){0};
+    if (isinf(pixel->depth))
         return;
 
-    assert(closest_intersection_dist > 0);
+    pixel->object = inter.object;
+    pixel->normal = inter.location.normal;
+}
+
+/*
+** Only find what the camera ray of the pixel hits, for the geometry buffer
+*/
+static void render_visibility(struct rgb_image *image,
+                              const struct render_ctx *ctx, size_t x, size_t y)
+{
+    struct ray ray = image_cast_ray(image, ctx, x, y);
+    store_visibility(ctx, &ray, x, y);
+}
 
-    double depth_repr = 1 / (closest_intersection_dist + 1);
-    uint8_t depth_intensity = translate_light_component(depth_repr);
-    struct rgb_pixel pix_color
-        = {depth_intensity, depth_intensity, depth_intensity};
-    rgb_image_set(image, x, y, pix_color);
+/*
+** Like render_visibility, casting the camera rays of rows of the tile at
+** once
+*/
+static void render_visibility_tile(struct rgb_image *image,
+                                   const struct render_ctx *ctx,
+                                   size_t x_from, size_t y_from, size_t x_to,
+                                   size_t y_to)
+{
+    struct ray rays[VISIBILITY_RAYS];
+    for (size_t y = y_from; y < y_to; y++)
+        for (size_t x = x_from; x < x_to; x += VISIBILITY_RAYS)
+        {
+            size_t count = x_to - x;
+            if (count > VISIBILITY_RAYS)
+                count = VISIBILITY_RAYS;
+            image_cast_rays(image, ctx, x, y, count, rays);
+
+            for (size_t i = 0; i < count; i++)
+                if (ctx->mask == NULL || ctx->mask[y * image->width + x + i])
+                    store_visibility(ctx, &rays[i], x + i, y);
+        }
 }
 
+static const struct render_mode shaded_mode = {render_shaded, NULL};
+static const struct render_mode normals_mode = {render_normals, NULL};
+static const struct render_mode distances_mode = {render_distances, NULL};
+static const struct render_mode ao_mode = {render_ao, NULL};
+static const struct render_mode visibility_mode
+    = {render_visibility, render_visibility_tile};
+
 int main(int argc, char *argv[])
 {
     // Return code of the application
@@ -250,32 +351,93 @@ int main(int argc, char *argv[])
     struct scene scene;
     // The final image
     struct rgb_image *image;
-    render_mode_f renderer;
+    const struct render_mode *renderer;
+    // The samples the renderer is made of, NULL if it can't be used to
+    // sample anywhere in pixels
+    render_sample_f sampler;
     // Type of runner for rendering
     enum runner_type runner;
     // Type of anti-aliasing used
     enum aa_type aalias_type = ANTIALIAS_NONE;
+    // Number of samples of the pixels refined by adaptive anti-aliasing
+    size_t aa_samples = AA_DEFAULT_SAMPLES;
+    // Filter used to downscale SSAA images
+    enum resample_filter aa_resample = RESAMPLE_BOX;
+    // Whether FXAA and MLAA only filter the edges of objects
+    bool aa_guide = false;
     // Aspect ratio for the camera
     double aspect_ratio;
     // Size of the image - Default is 100x100
     size_t width = 100;
     size_t height = 100;
-    // Number of threads used
-    size_t threads = 4;
+    // Threads, tiles and realtime frames of the runner
+    struct runner_options runner_options = {
+        .threads = 4,
+        .tile_size = MT_DEFAULT_TILE_SIZE,
+        .frames = 0,
+        .frame_budget = REALTIME_DEFAULT_BUDGET_MS / 1e3,
+        .min_scale = 0,
+        .temporal_refresh = 0,
+        .preview_interval = PROGRESSIVE_DEFAULT_INTERVAL,
+        .time_budget = 0,
+        .checkpoint_path = NULL,
+        .checkpoint_interval = CHECKPOINT_DEFAULT_INTERVAL,
+        .resume = false,
+        .render_key = checkpoint_render_key(argc, argv),
+        .sink = NULL,
+        .control = NULL,
+    };
+    // Optional file describing the lights of the scene
+    const char *lights_path = NULL;
+    // Whether to print rendering statistics
+    bool show_stats = false;
+    // Sequence used by all the stochastic sampling
+    enum sampler_type sample_sequence = SAMPLER_SOBOL;
+    // The order pixels and tiles are rendered in
+    enum pixel_order order = ORDER_SCANLINE;
+    // How threads are placed on CPUs
+    enum pin_policy pin = PIN_NONE;
+    // Ratio between the output and shading resolutions, 0 shades every pixel
+    size_t guided_factor = 0;
+    // Number of denoising iterations, 0 disables the denoiser
+    size_t denoise_iterations = 0;
+    // Accuracy of the irradiance cache, 0 disables the cache
+    double irradiance_accuracy = 0;
+    struct irradiance_cache irradiance_cache;
 
     // Check if we have the minimum of arguments
     if (argc < 3)
     {
-        errx(1, "Usage: SCENE.obj OUTPUT.bmp [--normals] [--distances] "
-                "[--runner=mt/single] [--width=100] [--height=100] "
-                "[--threads=4] [--aa=none/ssaa2x/ssaa4x]");
+        errx(1, "Usage: SCENE.obj OUTPUT.bmp [--normals] [--distances] [--ao] "
+                "[--path] "
+                "[--runner=mt/single/realtime/progressive] [--width=100] "
+                "[--height=100] [--preview-interval=1] [--time-budget=0] "
+                "[--checkpoint=FILE] [--checkpoint-interval=60] [--resume] "
+                "[--threads=4] [--tile-size=32] [--pin=none/compact/scatter] "
+                "[--frames=0] [--frame-budget=33.3] [--sink=-/shm:NAME] "
+                "[--control=PIPE] [--dynamic-resolution[=0.5]] "
+                "[--temporal[=8]] [--guided[=2]] "
+                "[--aa=none/ssaa2x/ssaa4x/adaptive/box/tent/gaussian/fxaa/mlaa] "
+                "[--aa-samples=16] [--aa-resample=box/lanczos] [--aa-guide] "
+                "[--lights=FILE] "
+                "[--light-samples=8] [--area-samples=4] "
+                "[--area-samples-penumbra=16] "
+                "[--ao-samples=16] [--ao-distance=0.5] "
+                "[--path-samples-min=8] [--path-samples-max=256] "
+                "[--path-error=0.05] [--irradiance-cache[=0.2]] "
+                "[--denoise[=5]] [--texture-cache=16] "
+                "[--sampler=sobol/bluenoise/stratified] "
+                "[--order=scanline/morton/hilbert] [--stats]");
     }
+    // The progressive runner writes its previews over the output
+    runner_options.preview_path = argv[2];
 
     // Create the scene
     scene_init(&scene);
 
     // Options variables
-    renderer = render_shaded;
+    renderer = &shaded_mode;
+    sampler = sample_shaded;
     // By default, the runner is single threaded
     runner = RUNNER_SINGLETHREADED;
 
@@ -283,11 +445,53 @@ int main(int argc, char *argv[])
     for (int i = 3; i < argc; i++)
     {
         if (strcmp(argv[i], "--normals") == 0)
-            renderer = render_normals;
+        {
+            renderer = &normals_mode;
+            sampler = sample_normals;
+        }
         else if (strcmp(argv[i], "--distances") == 0)
-            renderer = render_distances;
+        {
+            renderer = &distances_mode;
+            sampler = sample_distances;
+        }
+        else if (strcmp(argv[i], "--ao") == 0)
+        {
+            renderer = &ao_mode;
+            sampler = sample_ao;
+        }
+        else if (strcmp(argv[i], "--path") == 0)
+        {
+            renderer = &path_render_mode;
+            sampler = NULL;
+        }
+        else if (strncmp(argv[i], "--path-samples-min", 18) == 0)
+            scene.path_samples_min = atoi(argv[i] + 19);
+        else if (strncmp(argv[i], "--path-samples-max", 18) == 0)
+            scene.path_samples_max = atoi(argv[i] + 19);
+        else if (strncmp(argv[i], "--path-error", 12) == 0)
+            scene.path_error = atof(argv[i] + 13);
+        else if (strcmp(argv[i], "--irradiance-cache") == 0)
+            irradiance_accuracy = IRRADIANCE_CACHE_DEFAULT_ACCURACY;
+        else if (strncmp(argv[i], "--irradiance-cache=", 19) == 0)
+            irradiance_accuracy = atof(argv[i] + 19);
+        else if (strncmp(argv[i], "--sampler", 9) == 0)
+            sample_sequence = select_sampler_opt(argv[i] + 9);
+        else if (strcmp(argv[i], "--denoise") == 0)
+            denoise_iterations = DENOISE_DEFAULT_ITERATIONS;
+        else if (strncmp(argv[i], "--denoise=", 10) == 0)
+            denoise_iterations = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--ao-samples", 12) == 0)
+            scene.ao_samples = atoi(argv[i] + 13);
+        else if (strncmp(argv[i], "--ao-distance", 13) == 0)
+            scene.ao_distance = atof(argv[i] + 14);
         else if (strncmp(argv[i], "--runner", 8) == 0)
             runner = get_runner_opt(argv[i] + 8);
+        else if (strncmp(argv[i], "--aa-resample", 13) == 0)
+            aa_resample = select_resample_opt(argv[i] + 13);
+        else if (strcmp(argv[i], "--aa-guide") == 0)
+            aa_guide = true;
+        else if (strncmp(argv[i], "--aa-samples", 12) == 0)
+            aa_samples = atoi(argv[i] + 13);
         else if (strncmp(argv[i], "--aa", 4) == 0)
             aalias_type = select_alias_opt(argv[i] + 4);
         else if (strncmp(argv[i], "--width", 7) == 0)
@@ -295,13 +499,93 @@ int main(int argc, char *argv[])
         else if (strncmp(argv[i], "--height", 8) == 0)
             height = atoi(argv[i] + 9);
         else if (strncmp(argv[i], "--threads", 9) == 0)
-            threads = atoi(argv[i] + 10);
+            runner_options.threads = atoi(argv[i] + 10);
+        else if (strncmp(argv[i], "--checkpoint-interval", 21) == 0)
+            runner_options.checkpoint_interval = atof(argv[i] + 22);
+        else if (strncmp(argv[i], "--checkpoint=", 13) == 0)
+            runner_options.checkpoint_path = argv[i] + 13;
+        else if (strcmp(argv[i], "--resume") == 0)
+            runner_options.resume = true;
+        else if (strncmp(argv[i], "--time-budget", 13) == 0)
+            runner_options.time_budget = atof(argv[i] + 14);
+        else if (strncmp(argv[i], "--preview-interval", 18) == 0)
+            runner_options.preview_interval = atof(argv[i] + 19);
+        else if (strncmp(argv[i], "--order", 7) == 0)
+            order = select_order_opt(argv[i] + 7);
+        else if (strncmp(argv[i], "--pin", 5) == 0)
+            pin = select_pin_opt(argv[i] + 5);
+        else if (strncmp(argv[i], "--tile-size", 11) == 0)
+            runner_options.tile_size = atoi(argv[i] + 12);
+        else if (strncmp(argv[i], "--frames", 8) == 0)
+            runner_options.frames = atoi(argv[i] + 9);
+        else if (strncmp(argv[i], "--frame-budget", 14) == 0)
+            runner_options.frame_budget = atof(argv[i] + 15) / 1e3;
+        else if (strncmp(argv[i], "--sink", 6) == 0)
+            runner_options.sink = argv[i] + 7;
+        else if (strncmp(argv[i], "--control", 9) == 0)
+            runner_options.control = argv[i] + 10;
+        else if (strcmp(argv[i], "--dynamic-resolution") == 0)
+            runner_options.min_scale = DYNRES_DEFAULT_MIN_SCALE;
+        else if (strncmp(argv[i], "--dynamic-resolution=", 21) == 0)
+            runner_options.min_scale = atof(argv[i] + 21);
+        else if (strcmp(argv[i], "--guided") == 0)
+            guided_factor = GUIDED_DEFAULT_FACTOR;
+        else if (strncmp(argv[i], "--guided=", 9) == 0)
+            guided_factor = atoi(argv[i] + 9);
+        else if (strcmp(argv[i], "--temporal") == 0)
+            runner_options.temporal_refresh = TEMPORAL_DEFAULT_REFRESH;
+        else if (strncmp(argv[i], "--temporal=", 11) == 0)
+            runner_options.temporal_refresh = atoi(argv[i] + 11);
+        else if (strncmp(argv[i], "--lights", 8) == 0)
+            lights_path = argv[i] + 9;
+        else if (strncmp(argv[i], "--light-samples", 15) == 0)
+            scene.light_samples = atoi(argv[i] + 16);
+        else if (strncmp(argv[i], "--area-samples-penumbra", 23) == 0)
+            scene.area_samples_penumbra = atoi(argv[i] + 24);
+        else if (strncmp(argv[i], "--area-samples", 14) == 0)
+            scene.area_samples_min = atoi(argv[i] + 15);
+        else if (strncmp(argv[i], "--texture-cache", 15) == 0)
+            texture_cache_resize(&scene.textures, atoi(argv[i] + 16));
+        else if (strcmp(argv[i], "--stats") == 0)
+            show_stats = true;
         else
             warnx("Unknown option '%s'", argv[i]);
     }
     // Check the image size
     if (width == 0 || height == 0)
         errx(3, "Invalid size - width: %li height: %li", width, height);
+    if (aa_resample == RESAMPLE_UNKNOWN)
+        errx(4, "Invalid anti-aliasing resampling filter requested");
+
+    if (sample_sequence == SAMPLER_UNKNOWN)
+        errx(4, "Invalid sampler requested");
+    sampler_init(sample_sequence);
+
+    if (order == ORDER_UNKNOWN)
+        errx(4, "Invalid pixel order requested");
+    pixel_order_init(order);
+
+    // Only the progressive runner renders the most important pixels first
+    if (runner_options.time_budget > 0 && runner == RUNNER_MULTITHREADED)
+    {
+        warnx("--time-budget renders with the progressive runner");
+        runner = RUNNER_PROGRESSIVE;
+    }
+    else if (runner_options.time_budget > 0 && runner != RUNNER_PROGRESSIVE)
+    {
+        warnx("--time-budget needs the mt or progressive runner, skipping");
+        runner_options.time_budget = 0;
+    }
+
+    // The same threads run the renderer and all the parallel passes
+    if (pin == PIN_UNKNOWN)
+        errx(4, "Invalid pinning policy requested");
+    if (runner == RUNNER_MULTITHREADED || runner == RUNNER_REALTIME
+        || runner == RUNNER_PROGRESSIVE)
+    {
+        affinity_init(pin, runner_options.threads);
+        thread_pool_start(runner_options.threads);
+    }
 
     // initialize the frame buffer (the buffer that will store the result of the
     // rendering)
@@ -314,35 +598,150 @@ int main(int argc, char *argv[])
 
     // set all the pixels of the image to black
     struct rgb_pixel bg_color = {0};
-    rgb_image_clear(image, &bg_color);
+    rgb_image_clear_parallel(image, &bg_color, thread_pool_size());
 
     // Get the aspect ratio
     aspect_ratio = (double)image->width / image->height;
 
+    // Load the lights before building the scene, which adds a default light
+    if (lights_path != NULL && load_lights(&scene, lights_path))
+        return 42;
+
     // build the scene
     build_obj_scene(&scene, aspect_ratio, 90);
+    scene_build_lights(&scene);
 
     // Check if we can't load the model
     if (load_obj(&scene, argv[1]))
         return 41;
 
+    // The path tracer accumulates samples in floating point
+    if (renderer == &path_render_mode)
+        scene.accum = accum_buffer_alloc(image->width, image->height);
+
+    // The irradiance cache is shared by all the threads of the path tracer
+    if (irradiance_accuracy > 0 && renderer != &path_render_mode)
+        warnx("The irradiance cache is only used by --path, skipping");
+    else if (irradiance_accuracy > 0)
+    {
+        irradiance_cache_init(&irradiance_cache, irradiance_accuracy);
+        scene.irradiance_cache = &irradiance_cache;
+    }
+
+    // Filtering anti-aliasing takes several samples per pixel while rendering
+    if (antialias_filter(aalias_type, &scene.pixel_filter) && sampler == NULL)
+        warnx("Filtered anti-aliasing isn't available with --path, skipping");
+    else if (antialias_filter(aalias_type, &scene.pixel_filter))
+        scene.pixel_samples = aa_samples;
+
+    // Adaptive anti-aliasing finds edges using the objects seen by pixels.
+    // The path tracer already spreads its samples over pixels
+    if (aalias_type == ANTIALIAS_ADAPTIVE && sampler == NULL)
+    {
+        warnx("Adaptive anti-aliasing isn't available with --path, skipping");
+        aalias_type = ANTIALIAS_NONE;
+    }
+    else if (aalias_type == ANTIALIAS_ADAPTIVE)
+        scene.gbuffer = gbuffer_alloc(image->width, image->height);
+
+    // Image space anti-aliasing may only filter the edges of objects
+    bool image_aa = aalias_type == ANTIALIAS_FXAA
+                    || aalias_type == ANTIALIAS_MLAA;
+    if (aa_guide && (!image_aa || sampler == NULL))
+        warnx("--aa-guide needs --aa=fxaa/mlaa without --path, skipping");
+    else if (aa_guide)
+        scene.gbuffer = gbuffer_alloc(image->width, image->height);
+
+    // Reused pixels are found with the depths render modes store
+    if (runner_options.temporal_refresh != 0 && sampler == NULL)
+    {
+        warnx("--temporal isn't available with --path, skipping");
+        runner_options.temporal_refresh = 0;
+    }
+
+    // Upsampled pixels are matched with the first hits of render modes, and
+    // the intermediate passes must not be shown as previews
+    if (guided_factor > 1
+        && (sampler == NULL || runner == RUNNER_REALTIME
+            || runner == RUNNER_PROGRESSIVE))
+    {
+        warnx("--guided isn't available with --path and the realtime and "
+              "progressive runners, skipping");
+        guided_factor = 0;
+    }
+
+    // Checkpoints hold the image and accumulated samples of a single render
+    if (runner_options.resume && runner_options.checkpoint_path == NULL)
+        errx(4, "--resume needs a --checkpoint file");
+    if (runner_options.checkpoint_path != NULL
+        && (runner != RUNNER_MULTITHREADED || guided_factor > 1
+            || scene.gbuffer != NULL))
+    {
+        warnx("--checkpoint needs the mt runner, without --guided and the "
+              "geometry buffer of --aa=adaptive and --aa-guide, skipping");
+        runner_options.checkpoint_path = NULL;
+        runner_options.resume = false;
+    }
+
+    // Cache counters only cover the renderer
+    struct perf_counters perf_counters;
+    size_t rendered_pixels = image->width * image->height;
+    if (show_stats)
+        perf_counters_start(&perf_counters);
+
     // Run the renderer and use the runner selected
-    if (run_renderer(image, &scene, runner, renderer, threads))
+    int render_res;
+    if (guided_factor > 1)
+        render_res = render_guided(image, &scene, runner, renderer,
+                                   &visibility_mode, &runner_options,
+                                   guided_factor, thread_pool_size());
+    else
+        render_res
+            = run_renderer(image, &scene, runner, renderer, &runner_options);
+    if (render_res)
         errx(2, "Rendering failed!");
+    if (show_stats)
+        perf_counters_stop(&perf_counters);
+
+    // Post processing passes use as many threads as the renderer
+    size_t post_threads = thread_pool_size();
+
+    // Supersample the edges found in the rendered image
+    if (aalias_type == ANTIALIAS_ADAPTIVE)
+        antialias_refine_edges(image, &scene, sampler, aa_samples,
+                               post_threads);
+
+    // Denoise using the buffers of the path tracer, before downscaling
+    if (denoise_iterations != 0 && scene.accum == NULL)
+        warnx("Denoising is only available with --path, skipping");
+    else if (denoise_iterations != 0 && runner_options.min_scale > 0)
+        warnx("Denoising isn't available with --dynamic-resolution, skipping");
+    else if (denoise_iterations != 0)
+        postprocess_denoise(image, scene.accum, denoise_iterations,
+                            post_threads);
 
     // Apply a post processing anti aliasing
-    postprocess_antialias(aalias_type, &image);
+    postprocess_antialias(aalias_type, &image, aa_resample, scene.gbuffer,
+                          post_threads);
 
-    // write the rendered image to a bmp file
-    FILE *fp = fopen(argv[2], "w");
-    if (fp == NULL)
-        err(1, "failed to open the output file");
+    if (show_stats)
+    {
+        stats_print(image->width * image->height);
+        perf_counters_print(&perf_counters, rendered_pixels);
+    }
 
-    return_code = bmp_write(image, ppm_from_ppi(80), fp);
-    fclose(fp);
+    // write the rendered image to a bmp file, which previews may be
+    // watching
+    return_code = bmp_save(image, argv[2]);
 
     // release resources
+    free(scene.accum);
+    free(scene.gbuffer);
+    if (scene.irradiance_cache != NULL)
+        irradiance_cache_destroy(scene.irradiance_cache);
     scene_destroy(&scene);
     free(image);
+    thread_pool_stop();
+    affinity_destroy();
     return return_code;
 }
@@ -0,0 +1,22 @@
+#include "accum_buffer.h"
+
+#include <string.h>
+
+struct accum_buffer *accum_buffer_alloc(size_t width, size_t height)
+{
+    size_t alloc_size = sizeof(struct accum_buffer);
+    alloc_size += sizeof(struct accum_pixel) * width * height;
+
+    // fresh pages from calloc stay untouched until rendering threads write
+    // them, and are then placed on their NUMA node
+    struct accum_buffer *res = xcalloc(1, alloc_size);
+    res->width = width;
+    res->height = height;
+    return res;
+}
+
+void accum_buffer_clear(struct accum_buffer *buffer)
+{
+    memset(buffer->data, 0,
+           sizeof(struct accum_pixel) * buffer->width * buffer->height);
+}
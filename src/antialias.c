@@ -1,102 +1,151 @@
 #include <err.h>
+#include <math.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "antialias.h"
+#include "fxaa.h"
 #include "image.h"
+#include "mlaa.h"
+#include "resample.h"
+#include "sampler.h"
+#include "utils/alloc.h"
+#include "utils/parallel.h"
+
+// how different neighbor colors can be before being considered an edge,
+// out of 255
+#define EDGE_COLOR_THRESHOLD 16
+// how different neighbor depths can be, relative to the closest one
+#define EDGE_DEPTH_THRESHOLD 0.05
+
+struct refine_pass
+{
+    struct rgb_image *image;
+    struct render_ctx ctx;
+    render_sample_f sample;
+    size_t samples;
+    // the pixels to refine
+    const bool *edges;
+};
+
+static bool colors_differ(struct rgb_pixel a, struct rgb_pixel b)
+{
+    return abs(a.r - b.r) > EDGE_COLOR_THRESHOLD
+           || abs(a.g - b.g) > EDGE_COLOR_THRESHOLD
+           || abs(a.b - b.b) > EDGE_COLOR_THRESHOLD;
+}
 
-#define USE_BILINEAR 1
+static bool geometry_differs(const struct gbuffer_pixel *a,
+                             const struct gbuffer_pixel *b)
+{
+    if (a->object != b->object)
+        return true;
+    // both are the background
+    if (a->object == NULL)
+        return false;
+    return fabsf(a->depth - b->depth)
+           > EDGE_DEPTH_THRESHOLD * fminf(a->depth, b->depth);
+}
 
-#if (!USE_BILINEAR)
 /*
-** Downscale image using a downscale factor, linear interpolation
+** Flag both pixels when they differ.
 */
-static void downscale_image_aa(struct rgb_image *input,
-                               struct rgb_image *output, size_t factor)
+static void compare_pixels(struct rgb_image *image, struct gbuffer *gbuffer,
+                           bool *edges, size_t a_x, size_t a_y, size_t b_x,
+                           size_t b_y)
 {
-    for (size_t y = 0; y < output->height; y++)
+    if (colors_differ(rgb_image_get(image, a_x, a_y),
+                      rgb_image_get(image, b_x, b_y))
+        || geometry_differs(gbuffer_get(gbuffer, a_x, a_y),
+                            gbuffer_get(gbuffer, b_x, b_y)))
     {
-        for (size_t x = 0; x < output->width; x++)
-        {
-            size_t average_r = 0;
-            size_t average_g = 0;
-            size_t average_b = 0;
-
-            // Do the average of a chunk of pixels
-            for (size_t y_c = 0; y_c < factor; y_c++)
-            {
-                for (size_t x_c = 0; x_c < factor; x_c++)
-                {
-                    struct rgb_pixel currentpixel = rgb_image_get(
-                        input, (x * factor) + x_c, (y * factor) + y_c);
-                    average_r += currentpixel.r;
-                    average_g += currentpixel.g;
-                    average_b += currentpixel.b;
-                }
-            }
-
-            //-------------------
-            // Average pixel
-            struct rgb_pixel average_pixel;
-            average_pixel.r = (average_r / factor) & 0xFF;
-            average_pixel.g = (average_g / factor) & 0xFF;
-            average_pixel.b = (average_b / factor) & 0xFF;
+        edges[a_y * image->width + a_x] = true;
+        edges[b_y * image->width + b_x] = true;
+    }
+}
 
-            rgb_image_set(output, x, y, average_pixel);
+static size_t find_edges(struct rgb_image *image, struct gbuffer *gbuffer,
+                         bool *edges)
+{
+    for (size_t y = 0; y < image->height; y++)
+    {
+        for (size_t x = 0; x < image->width; x++)
+        {
+            if (x + 1 < image->width)
+                compare_pixels(image, gbuffer, edges, x, y, x + 1, y);
+            if (y + 1 < image->height)
+                compare_pixels(image, gbuffer, edges, x, y, x, y + 1);
         }
     }
+
+    size_t count = 0;
+    for (size_t i = 0; i < image->width * image->height; i++)
+        count += edges[i];
+    return count;
 }
-#endif
 
-#if USE_BILINEAR
 /*
-** Downscale image using Bilinear downscale
+** Render the edge pixels of some rows again, averaging samples spread
+** over the pixel.
 */
-static void downscale_image_bilinear(struct rgb_image *input,
-                                     struct rgb_image *output)
+static void refine_rows(void *data, size_t y_from, size_t y_to)
 {
-    float X_ratio = (((float)input->width - 1) / output->width);
-    float Y_ratio = (((float)input->height - 1) / output->height);
-    float blue, green, red;
+    struct refine_pass *pass = data;
+    struct rgb_image *image = pass->image;
 
-    for (size_t j = 0; j < output->height; j++)
+    for (size_t y = y_from; y < y_to; y++)
     {
-        for (size_t i = 0; i < output->width; i++)
+        for (size_t x = 0; x < image->width; x++)
         {
-            size_t x = (size_t)(X_ratio * i);
-            size_t y = (size_t)(Y_ratio * j);
-            float x2 = (X_ratio * i) - x;
-            float y2 = (Y_ratio * j) - y;
-
-            // Build the downscale matrix
-            struct rgb_pixel mx = rgb_image_get(input, x, y);
-            struct rgb_pixel mxX = rgb_image_get(input, x + 1, y);
-            struct rgb_pixel mxY = rgb_image_get(input, x, y + 1);
-            struct rgb_pixel mxXY = rgb_image_get(input, x + 1, y + 1);
-
-            // Using the ratio and the dowscale matrix, interpolate.
-            red = (mx.r * (1 - y2) * (1 - x2) + mxX.r * x2 * (1 - y2)
-                   + mxY.r * y2 * (1 - x2) + mxXY.r * y2 * x2);
-
-            green = (mx.g * (1 - y2) * (1 - x2) + mxX.g * x2 * (1 - y2)
-                     + mxY.g * y2 * (1 - x2) + mxXY.g * y2 * x2);
+            if (!pass->edges[y * image->width + x])
+                continue;
 
-            blue = (mx.b * (1 - y2) * (1 - x2) + mxX.b * x2 * (1 - y2)
-                    + mxY.b * y2 * (1 - x2) + mxXY.b * y2 * x2);
-
-            // Set the downscaled pixel
-            struct rgb_pixel tmp;
-
-            tmp.r = red;
-            tmp.g = green;
-            tmp.b = blue;
+            struct vec3 sum = {0};
+            for (size_t i = 0; i < pass->samples; i++)
+            {
+                double u, v;
+                sampler_get_2d(x, y, i, pass->samples, SAMPLER_DIM_PIXEL, &u,
+                               &v);
+                sampler_start(x, y, i, pass->samples);
+                // spread over the pixel, centered on it like single samples
+                struct render_sample res;
+                pass->sample(&res, image, &pass->ctx, x + u - 0.5,
+                             y + v - 0.5);
+                sum = vec3_add(&sum, &res.color);
+            }
 
-            // Set the pixel into the surface
-            rgb_image_set(output, i, j, tmp);
+            sum = vec3_mul(&sum, 1. / pass->samples);
+            rgb_image_set(image, x, y, rgb_color_from_light(&sum));
         }
     }
 }
-#endif
+
+void antialias_refine_edges(struct rgb_image *image, struct scene *scene,
+                            render_sample_f sample, size_t samples,
+                            size_t threads)
+{
+    size_t pixels = image->width * image->height;
+    bool *edges = xcalloc(pixels, sizeof(*edges));
+    size_t edges_count = find_edges(image, scene->gbuffer, edges);
+
+    warnx("AA - Refining %li edge pixels (%.2f%%) with %li samples",
+          edges_count, 100. * edges_count / pixels, samples);
+
+    struct refine_pass pass = {
+        .image = image,
+        .sample = sample,
+        .samples = samples,
+        .edges = edges,
+    };
+    render_ctx_init(&pass.ctx, scene, NULL, NULL, 0);
+    if (samples != 0 && edges_count != 0)
+        parallel_rows(image->height, threads, refine_rows, &pass);
+    render_ctx_destroy(&pass.ctx);
+
+    free(edges);
+    warnx("AA - Completed refinement");
+}
 
 /*
 ** Select the correct Anti-alias setting from argument parser
@@ -108,6 +157,18 @@ enum aa_type select_alias_opt(char *option)
         return ANTIALIAS_SSAA_2X;
     else if (strcmp(option, "=ssaa4x") == 0)
         return ANTIALIAS_SSAA_4X;
+    else if (strcmp(option, "=adaptive") == 0)
+        return ANTIALIAS_ADAPTIVE;
+    else if (strcmp(option, "=box") == 0)
+        return ANTIALIAS_BOX;
+    else if (strcmp(option, "=tent") == 0)
+        return ANTIALIAS_TENT;
+    else if (strcmp(option, "=gaussian") == 0)
+        return ANTIALIAS_GAUSSIAN;
+    else if (strcmp(option, "=fxaa") == 0)
+        return ANTIALIAS_FXAA;
+    else if (strcmp(option, "=mlaa") == 0)
+        return ANTIALIAS_MLAA;
     else if (strcmp(option, "=none") == 0)
         return ANTIALIAS_NONE;
 
@@ -115,6 +176,31 @@ enum aa_type select_alias_opt(char *option)
     return ANTIALIAS_UNKNOWN;
 }
 
+bool antialias_filter(enum aa_type aalias_type, enum pixel_filter *filter)
+{
+    if (aalias_type == ANTIALIAS_BOX)
+        *filter = PIXEL_FILTER_BOX;
+    else if (aalias_type == ANTIALIAS_TENT)
+        *filter = PIXEL_FILTER_TENT;
+    else if (aalias_type == ANTIALIAS_GAUSSIAN)
+        *filter = PIXEL_FILTER_GAUSSIAN;
+    else
+        return false;
+    return true;
+}
+
+/*
+** The upscale factor of the image for SSAA, or 0 for other methods
+*/
+static size_t ssaa_factor(enum aa_type aalias_type)
+{
+    if (aalias_type == ANTIALIAS_SSAA_2X)
+        return SSAA_2X_UPSCALE_FACTOR;
+    else if (aalias_type == ANTIALIAS_SSAA_4X)
+        return SSAA_4X_UPSCALE_FACTOR;
+    return 0;
+}
+
 /*
 ** Modify the context of the rendering based on the anti-aliasing selected
 */
@@ -124,7 +210,7 @@ void preprocess_antialias(enum aa_type aalias_type, struct rgb_image **image)
     struct rgb_image *image_p = *image;
 
     // Used to upscale the image when SSAA is used
-    size_t upscale_factor = 0;
+    size_t upscale_factor = ssaa_factor(aalias_type);
     size_t width = image_p->width;
     size_t height = image_p->height;
 
@@ -132,16 +218,11 @@ void preprocess_antialias(enum aa_type aalias_type, struct rgb_image **image)
     if (aalias_type == ANTIALIAS_UNKNOWN)
         errx(4, "Invalid anti-aliasing technique requested");
 
-    // Exit when we don't want antialiasing
-    if (aalias_type == ANTIALIAS_NONE)
+    // Exit when we don't want antialiasing, or when it doesn't need a larger
+    // image
+    if (upscale_factor == 0)
         return;
 
-    // Set the SSAA upscale factor (such as 2X / 4X)
-    if (aalias_type == ANTIALIAS_SSAA_2X)
-        upscale_factor = SSAA_2X_UPSCALE_FACTOR;
-    else if (aalias_type == ANTIALIAS_SSAA_4X)
-        upscale_factor = SSAA_4X_UPSCALE_FACTOR;
-
     // Logging
     warnx("AA - Using SSAA");
     warnx("AA - Using %lix upscale factor (from %lix%li to %lix%li)",
@@ -156,24 +237,33 @@ void preprocess_antialias(enum aa_type aalias_type, struct rgb_image **image)
 /*
 ** Select and apply run a post processing antialiasing
 */
-void postprocess_antialias(enum aa_type aalias_type, struct rgb_image **image)
+void postprocess_antialias(enum aa_type aalias_type, struct rgb_image **image,
+                           enum resample_filter filter,
+                           const struct gbuffer *gbuffer, size_t threads)
 {
+    // Image space methods filter the final image in place
+    if (aalias_type == ANTIALIAS_FXAA)
+    {
+        postprocess_fxaa(*image, gbuffer, threads);
+        return;
+    }
+    else if (aalias_type == ANTIALIAS_MLAA)
+    {
+        postprocess_mlaa(*image, gbuffer, threads);
+        return;
+    }
+
     // Dereference image
     struct rgb_image *image_p = *image;
-    size_t downscale_factor = 0;
+    size_t downscale_factor = ssaa_factor(aalias_type);
     size_t width = image_p->width;
     size_t height = image_p->height;
 
-    // Exit when we don't want antialiasing
-    if (aalias_type == ANTIALIAS_NONE)
+    // Exit when we don't want antialiasing, or when the image is already
+    // at its final size
+    if (downscale_factor == 0)
         return;
 
-    // Downscale image - Antialiasing
-    if (aalias_type == ANTIALIAS_SSAA_2X)
-        downscale_factor = SSAA_2X_UPSCALE_FACTOR;
-    else if (aalias_type == ANTIALIAS_SSAA_4X)
-        downscale_factor = SSAA_4X_UPSCALE_FACTOR;
-
     // Allocate a new image
     struct rgb_image *downscaled
         = rgb_image_alloc(width / downscale_factor, height / downscale_factor);
@@ -183,11 +273,7 @@ void postprocess_antialias(enum aa_type aalias_type, struct rgb_image **image)
           width / downscale_factor, height / downscale_factor);
 
     // Do the downscale
-#if USE_BILINEAR
-    downscale_image_bilinear(image_p, downscaled);
-#else
-    downscale_image_aa(image_p, downscaled, downscale_factor);
-#endif
+    image_resample(image_p, downscaled, filter, threads);
 
     // Logging
     warnx("AA - Completed downscale");
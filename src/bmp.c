@@ -2,9 +2,15 @@
 #include "image.h"
 #include "utils/align.h"
 #include "utils/alloc.h"
+#include "utils/parallel.h"
 #include "utils/static_assert.h"
+#include "utils/thread_pool.h"
 
+#include <err.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 enum bmp_compression
 {
@@ -48,6 +54,34 @@ struct __attribute__((packed)) bmp_header
 
 STATIC_ASSERT(bmp_header_size, sizeof(struct bmp_header) == 54);
 
+/*
+** The rows of an image being converted to the layout of bmp files
+*/
+struct bmp_encode
+{
+    const struct rgb_image *image;
+    uint8_t *data;
+    size_t stride;
+};
+
+static void encode_rows(void *arg, size_t y_from, size_t y_to)
+{
+    struct bmp_encode *encode = arg;
+    for (size_t line_i = y_from; line_i < y_to; line_i++)
+    {
+        // bmp images are written from the bottom up
+        const struct rgb_pixel *line
+            = &encode->image->data[encode->image->width * line_i];
+        uint8_t *out_data = &encode->data[encode->stride * line_i];
+        for (size_t col = 0; col < encode->image->width; col++)
+        {
+            out_data[3 * col] = line[col].b;
+            out_data[3 * col + 1] = line[col].g;
+            out_data[3 * col + 2] = line[col].r;
+        }
+    }
+}
+
 int bmp_write(struct rgb_image *image, size_t pixel_density, FILE *file)
 {
     size_t unpadded_stride = image->width * sizeof(struct rgb_pixel);
@@ -78,25 +112,106 @@ int bmp_write(struct rgb_image *image, size_t pixel_density, FILE *file)
         .important_colors = 0, // obsolete and ignored field
     };
 
-    fwrite(&header, sizeof(header), 1, file);
+    // convert the rows on the thread pool, padding included, and write
+    // them at once
+    struct bmp_encode encode = {image, xcalloc(data_size, 1), stride};
+    parallel_rows(image->height, thread_pool_size(), encode_rows, &encode);
 
-    size_t padding_size = stride - unpadded_stride;
-    char padding[4] = {0};
+    int res = 0;
+    if (fwrite(&header, sizeof(header), 1, file) != 1
+        || (data_size != 0 && fwrite(encode.data, data_size, 1, file) != 1))
+    {
+        warn("failed to write the bmp file");
+        res = 1;
+    }
+
+    free(encode.data);
+    return res;
+}
+
+int bmp_save(const struct rgb_image *image, const char *path)
+{
+    size_t path_size = strlen(path) + sizeof(".part");
+    char *part_path = xalloc(path_size);
+    snprintf(part_path, path_size, "%s.part", path);
 
-    for (size_t line_i = 0; line_i < image->height; line_i++)
+    FILE *fp = fopen(part_path, "w");
+    if (fp == NULL)
     {
-        // bmp images are written from the bottom up
-        struct rgb_pixel *line = &image->data[image->width * line_i];
-        for (size_t col = 0; col < image->width; col++)
+        warn("failed to open '%s'", part_path);
+        free(part_path);
+        return 1;
+    }
+
+    int res = bmp_write((struct rgb_image *)image, ppm_from_ppi(80), fp);
+    if (fclose(fp) != 0 || res != 0)
+    {
+        warnx("failed to write '%s'", part_path);
+        res = 1;
+    }
+    else if (rename(part_path, path) != 0)
+    {
+        warn("failed to move the image to '%s'", path);
+        res = 1;
+    }
+
+    free(part_path);
+    return res;
+}
+
+struct rgb_image *bmp_read(FILE *file)
+{
+    struct bmp_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || header.file.signature[0] != 'B' || header.file.signature[1] != 'M')
+    {
+        warnx("not a bmp file");
+        return NULL;
+    }
+
+    // images stored from the top down have a negative height
+    int32_t height = (int32_t)header.bim.height;
+    bool top_down = height < 0;
+    size_t width = header.bim.width;
+    size_t abs_height = top_down ? -(int64_t)height : height;
+    size_t pixel_size = header.bim.bits_per_pixel / 8;
+
+    if (header.bim.compression_method != BI_RGB
+        || (pixel_size != 3 && pixel_size != 4) || width == 0
+        || abs_height == 0)
+    {
+        warnx("unsupported bmp format: %u bits per pixel, compression %u",
+              header.bim.bits_per_pixel, header.bim.compression_method);
+        return NULL;
+    }
+
+    if (fseek(file, header.file.data_file_offset, SEEK_SET) != 0)
+        return NULL;
+
+    size_t stride = align_up(width * pixel_size, 4);
+    uint8_t *line = xalloc(stride);
+    struct rgb_image *image = rgb_image_alloc(width, abs_height);
+
+    for (size_t line_i = 0; line_i < abs_height; line_i++)
+    {
+        if (fread(line, stride, 1, file) != 1)
         {
-            struct rgb_pixel *pixel = &line[col];
-            uint8_t out_data[3];
-            out_data[0] = pixel->b;
-            out_data[1] = pixel->g;
-            out_data[2] = pixel->r;
-            fwrite(out_data, 3, 1, file);
+            warnx("truncated bmp file");
+            free(line);
+            free(image);
+            return NULL;
+        }
+
+        size_t y = top_down ? abs_height - 1 - line_i : line_i;
+        for (size_t col = 0; col < width; col++)
+        {
+            uint8_t *in_data = &line[col * pixel_size];
+            rgb_image_set(image, col, y,
+                          (struct rgb_pixel){in_data[2], in_data[1],
+                                             in_data[0]});
         }
-        fwrite(padding, padding_size, 1, file);
     }
-    return 0;
+
+    free(line);
+    return image;
 }
@@ -0,0 +1,327 @@
+#include "checkpoint.h"
+#include "utils/alloc.h"
+#include "utils/clock.h"
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The arguments of the program which don't change the rendered pixels
+static const char *const run_options[] = {
+    "--checkpoint", "--resume",        "--threads",          "--pin",
+    "--stats",      "--texture-cache", "--preview-interval",
+};
+#define RUN_OPTIONS (sizeof(run_options) / sizeof(*run_options))
+
+/*
+** 64 bits FNV-1a hash of a string
+*/
+static uint64_t string_hash(const char *str)
+{
+    uint64_t res = 0xcbf29ce484222325;
+    for (; *str != '\0'; str++)
+        res = (res ^ (unsigned char)*str) * 0x100000001b3;
+    return res;
+}
+
+uint64_t checkpoint_render_key(int argc, char *argv[])
+{
+    // arguments are added up, so that their order doesn't matter
+    uint64_t res = argc > 1 ? string_hash(argv[1]) : 0;
+    for (int i = 3; i < argc; i++)
+    {
+        bool run_option = false;
+        for (size_t j = 0; j < RUN_OPTIONS && !run_option; j++)
+            run_option = strncmp(argv[i], run_options[j],
+                                 strlen(run_options[j]))
+                         == 0;
+        if (!run_option)
+            res += string_hash(argv[i]);
+    }
+    return res;
+}
+
+/*
+** The pixels of a tile, clipped to the image
+*/
+static void tile_bounds(const struct checkpoint *checkpoint, size_t tile,
+                        size_t *x_from, size_t *y_from, size_t *x_to,
+                        size_t *y_to)
+{
+    *x_from = (tile % checkpoint->tiles_x) * checkpoint->tile_size;
+    *y_from = (tile / checkpoint->tiles_x) * checkpoint->tile_size;
+    *x_to = *x_from + checkpoint->tile_size;
+    *y_to = *y_from + checkpoint->tile_size;
+    if (*x_to > checkpoint->image->width)
+        *x_to = checkpoint->image->width;
+    if (*y_to > checkpoint->image->height)
+        *y_to = checkpoint->image->height;
+}
+
+static struct checkpoint_header header_of(const struct checkpoint *checkpoint)
+{
+    struct checkpoint_header res = {
+        .magic = CHECKPOINT_MAGIC,
+        .width = checkpoint->image->width,
+        .height = checkpoint->image->height,
+        .tile_size = checkpoint->tile_size,
+        .tiles = checkpoint->tiles,
+        .accum = checkpoint->accum != NULL,
+        .render_key = checkpoint->render_key,
+    };
+    return res;
+}
+
+/*
+** Write or read the rows of a tile, in the image and accumulation buffer
+*/
+static bool transfer_tile(struct checkpoint *checkpoint, size_t tile,
+                          FILE *fp, bool write)
+{
+    size_t x_from, y_from, x_to, y_to;
+    tile_bounds(checkpoint, tile, &x_from, &y_from, &x_to, &y_to);
+    size_t width = checkpoint->image->width;
+    size_t count = x_to - x_from;
+
+    bool res = true;
+    for (size_t y = y_from; y < y_to && res; y++)
+    {
+        struct rgb_pixel *row = &checkpoint->image->data[y * width + x_from];
+        if (write)
+            res = fwrite(row, sizeof(*row), count, fp) == count;
+        else
+            res = fread(row, sizeof(*row), count, fp) == count;
+    }
+
+    for (size_t y = y_from; y < y_to && res && checkpoint->accum; y++)
+    {
+        struct accum_pixel *row = accum_buffer_get(checkpoint->accum, x_from,
+                                                   y);
+        if (write)
+            res = fwrite(row, sizeof(*row), count, fp) == count;
+        else
+            res = fread(row, sizeof(*row), count, fp) == count;
+    }
+    return res;
+}
+
+static bool write_tiles(struct checkpoint *checkpoint, const uint8_t *saved,
+                        FILE *fp)
+{
+    struct checkpoint_header header = header_of(checkpoint);
+    if (fwrite(&header, sizeof(header), 1, fp) != 1
+        || fwrite(saved, 1, checkpoint->tiles, fp) != checkpoint->tiles)
+        return false;
+
+    for (size_t tile = 0; tile < checkpoint->tiles; tile++)
+        if (saved[tile] && !transfer_tile(checkpoint, tile, fp, true))
+            return false;
+
+    // the checkpoint must be on disk before it replaces the last one
+    return fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+}
+
+/*
+** Save the tiles done so far next to the path, and move the file there,
+** so that a crash never leaves a partial checkpoint
+*/
+static void checkpoint_write(struct checkpoint *checkpoint)
+{
+    double start = clock_seconds();
+
+    // tiles completed meanwhile are saved by the next checkpoint
+    uint8_t *saved = xalloc(checkpoint->tiles);
+    size_t count = 0;
+    for (size_t tile = 0; tile < checkpoint->tiles; tile++)
+    {
+        saved[tile] = checkpoint_is_done(checkpoint, tile);
+        count += saved[tile];
+    }
+    if (count == checkpoint->saved)
+    {
+        free(saved);
+        return;
+    }
+
+    size_t path_size = strlen(checkpoint->path) + sizeof(".part");
+    char *part_path = xalloc(path_size);
+    snprintf(part_path, path_size, "%s.part", checkpoint->path);
+
+    FILE *fp = fopen(part_path, "w");
+    if (fp == NULL)
+        warn("CHECKPOINT - Failed to open '%s'", part_path);
+    else
+    {
+        bool res = write_tiles(checkpoint, saved, fp);
+        if (fclose(fp) != 0 || !res)
+            warnx("CHECKPOINT - Failed to write '%s'", part_path);
+        else if (rename(part_path, checkpoint->path) != 0)
+            warn("CHECKPOINT - Failed to move the checkpoint to '%s'",
+                 checkpoint->path);
+        else
+            checkpoint->saved = count;
+    }
+
+    double elapsed = clock_seconds() - start;
+    checkpoint->writes++;
+    checkpoint->write_time += elapsed;
+    warnx("CHECKPOINT - Saved %li of %li tiles in %.3fs", count,
+          checkpoint->tiles, elapsed);
+    free(part_path);
+    free(saved);
+}
+
+/*
+** Write checkpoints every interval, until stopped
+*/
+static void *checkpoint_writer(void *arg)
+{
+    struct checkpoint *checkpoint = arg;
+
+    pthread_mutex_lock(&checkpoint->lock);
+    while (!checkpoint->stopping)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        double seconds = deadline.tv_nsec * 1e-9 + checkpoint->interval;
+        deadline.tv_sec += seconds;
+        deadline.tv_nsec = (seconds - (time_t)seconds) * 1e9;
+
+        int res = 0;
+        while (!checkpoint->stopping && res != ETIMEDOUT)
+            res = pthread_cond_timedwait(&checkpoint->wake, &checkpoint->lock,
+                                         &deadline);
+        if (checkpoint->stopping)
+            break;
+
+        // workers never wait for the writer
+        pthread_mutex_unlock(&checkpoint->lock);
+        checkpoint_write(checkpoint);
+        pthread_mutex_lock(&checkpoint->lock);
+    }
+    pthread_mutex_unlock(&checkpoint->lock);
+    return NULL;
+}
+
+/*
+** Load the tiles of the checkpoint at the path, made with the same render
+** key, image size, tile size and buffers
+*/
+static int checkpoint_load(struct checkpoint *checkpoint)
+{
+    FILE *fp = fopen(checkpoint->path, "r");
+    if (fp == NULL && errno == ENOENT)
+    {
+        warnx("CHECKPOINT - No checkpoint at '%s', starting from scratch",
+              checkpoint->path);
+        return 0;
+    }
+    else if (fp == NULL)
+    {
+        warn("CHECKPOINT - Failed to open '%s'", checkpoint->path);
+        return 1;
+    }
+
+    struct checkpoint_header expected = header_of(checkpoint);
+    struct checkpoint_header header;
+    int res = 0;
+    if (fread(&header, sizeof(header), 1, fp) != 1
+        || memcmp(&header, &expected, sizeof(header)) != 0)
+    {
+        warnx("CHECKPOINT - '%s' isn't a checkpoint of this render, check "
+              "the scene, size, tile size, render mode and options",
+              checkpoint->path);
+        res = 1;
+    }
+    else if (fread(checkpoint->done, 1, checkpoint->tiles, fp)
+             != checkpoint->tiles)
+        res = 1;
+
+    for (size_t tile = 0; tile < checkpoint->tiles && res == 0; tile++)
+        if (checkpoint->done[tile])
+        {
+            if (!transfer_tile(checkpoint, tile, fp, false))
+                res = 1;
+            else
+                checkpoint->resumed++;
+        }
+
+    if (res != 0)
+        warnx("CHECKPOINT - Failed to load '%s'", checkpoint->path);
+    else
+        warnx("CHECKPOINT - Resumed %li of %li tiles", checkpoint->resumed,
+              checkpoint->tiles);
+    checkpoint->saved = checkpoint->resumed;
+    fclose(fp);
+    return res;
+}
+
+int checkpoint_start(struct checkpoint *checkpoint, const char *path,
+                     double interval, struct rgb_image *image,
+                     struct accum_buffer *accum, size_t tile_size,
+                     uint64_t render_key, bool resume)
+{
+    size_t tiles_x = (image->width + tile_size - 1) / tile_size;
+    size_t tiles_y = (image->height + tile_size - 1) / tile_size;
+    *checkpoint = (struct checkpoint){
+        .path = path,
+        .interval = interval,
+        .image = image,
+        .accum = accum,
+        .tile_size = tile_size,
+        .tiles_x = tiles_x,
+        .tiles = tiles_x * tiles_y,
+        .render_key = render_key,
+        .start = clock_seconds(),
+    };
+    checkpoint->done = xcalloc(checkpoint->tiles, 1);
+
+    if (resume && checkpoint_load(checkpoint) != 0)
+    {
+        free(checkpoint->done);
+        return 1;
+    }
+
+    pthread_mutex_init(&checkpoint->lock, NULL);
+    pthread_cond_init(&checkpoint->wake, NULL);
+    int res = pthread_create(&checkpoint->writer, NULL, checkpoint_writer,
+                             checkpoint);
+    if (res != 0)
+    {
+        warnx("CHECKPOINT - Failed to start the writer: %s", strerror(res));
+        pthread_cond_destroy(&checkpoint->wake);
+        pthread_mutex_destroy(&checkpoint->lock);
+        free(checkpoint->done);
+        return 1;
+    }
+
+    warnx("CHECKPOINT - Saving %li tiles to '%s' every %.1fs",
+          checkpoint->tiles, path, interval);
+    return 0;
+}
+
+void checkpoint_stop(struct checkpoint *checkpoint)
+{
+    pthread_mutex_lock(&checkpoint->lock);
+    checkpoint->stopping = true;
+    pthread_cond_signal(&checkpoint->wake);
+    pthread_mutex_unlock(&checkpoint->lock);
+    pthread_join(checkpoint->writer, NULL);
+
+    double elapsed = clock_seconds() - checkpoint->start;
+    warnx("CHECKPOINT - %li checkpoints took %.3fs on the writer thread, "
+          "%.1f%% of %.3fs",
+          checkpoint->writes, checkpoint->write_time,
+          100 * checkpoint->write_time / elapsed, elapsed);
+
+    // the render completed, there is nothing left to resume
+    if (unlink(checkpoint->path) != 0 && errno != ENOENT)
+        warn("CHECKPOINT - Failed to remove '%s'", checkpoint->path);
+
+    pthread_cond_destroy(&checkpoint->wake);
+    pthread_mutex_destroy(&checkpoint->lock);
+    free(checkpoint->done);
+}
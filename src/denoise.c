@@ -0,0 +1,299 @@
+#include <err.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "denoise.h"
+#include "utils/alloc.h"
+#include "utils/parallel.h"
+
+// how much luminance differences are tolerated, in standard deviations
+#define SIGMA_LUMINANCE 4.
+// the exponent applied to the cosine between normals
+#define SIGMA_NORMAL 128.
+// how much depth differences are tolerated, relative to the depth gradient
+#define SIGMA_DEPTH 1.
+// the variance of pixels with a single sample, which can't be estimated
+#define UNKNOWN_VARIANCE 1.
+
+/*
+** The pixel being filtered: its color, and the variance of its luminance
+*/
+struct denoise_pixel
+{
+    float r;
+    float g;
+    float b;
+    float variance;
+};
+
+/*
+** How fast the depth changes from a pixel to the next one, per axis
+*/
+struct depth_gradient
+{
+    float dx;
+    float dy;
+};
+
+struct denoise_pass
+{
+    const struct accum_buffer *accum;
+    const struct depth_gradient *gradients;
+    const struct denoise_pixel *input;
+    struct denoise_pixel *output;
+    // the distance between filter taps, in pixels
+    size_t step;
+};
+
+// the B3 spline interpolation kernel
+static const float kernel[5] = {1. / 16, 1. / 4, 3. / 8, 1. / 4, 1. / 16};
+
+static float pixel_luminance(const struct denoise_pixel *pixel)
+{
+    return 0.2126f * pixel->r + 0.7152f * pixel->g + 0.0722f * pixel->b;
+}
+
+static bool is_background(const struct accum_pixel *pixel)
+{
+    return pixel->nx == 0 && pixel->ny == 0 && pixel->nz == 0;
+}
+
+/*
+** How much the neighbor q should contribute to the pixel p, based on how
+** different their surfaces and luminances are.
+*/
+static float edge_weight(const struct denoise_pass *pass, size_t p_i,
+                         size_t q_i, float offset_x, float offset_y,
+                         float lum_sigma)
+{
+    const struct accum_pixel *ap = &pass->accum->data[p_i];
+    const struct accum_pixel *aq = &pass->accum->data[q_i];
+    if (is_background(aq))
+        return 0;
+
+    float cos_normals = ap->nx * aq->nx + ap->ny * aq->ny + ap->nz * aq->nz;
+    if (cos_normals <= 0)
+        return 0;
+    float w_normal = powf(cos_normals, SIGMA_NORMAL);
+
+    // the depth difference expected on a plane going through p
+    const struct depth_gradient *grad = &pass->gradients[p_i];
+    float expected = fabsf(grad->dx * offset_x + grad->dy * offset_y);
+    float w_depth = -fabsf(ap->depth - aq->depth) / (SIGMA_DEPTH * expected
+                                                     + 1e-4f);
+
+    float lum_p = pixel_luminance(&pass->input[p_i]);
+    float lum_q = pixel_luminance(&pass->input[q_i]);
+    float w_lum = -fabsf(lum_p - lum_q) / lum_sigma;
+
+    return w_normal * expf(w_depth + w_lum);
+}
+
+/*
+** The variance around a pixel, blurred with a 3x3 gaussian. Single pixels
+** may have a very low variance by chance, which would prevent filtering.
+*/
+static float local_variance(const struct denoise_pass *pass, size_t x,
+                            size_t y)
+{
+    static const float gaussian[3] = {1. / 4, 1. / 2, 1. / 4};
+    size_t width = pass->accum->width;
+    size_t height = pass->accum->height;
+    float sum = 0;
+    float weight_sum = 0;
+
+    for (int ky = -1; ky <= 1; ky++)
+    {
+        for (int kx = -1; kx <= 1; kx++)
+        {
+            long qx = (long)x + kx;
+            long qy = (long)y + ky;
+            if (qx < 0 || qy < 0 || qx >= (long)width || qy >= (long)height)
+                continue;
+
+            float w = gaussian[kx + 1] * gaussian[ky + 1];
+            sum += w * pass->input[qy * width + qx].variance;
+            weight_sum += w;
+        }
+    }
+
+    return sum / weight_sum;
+}
+
+/*
+** Apply one level of the a-trous filter to some rows.
+*/
+static void denoise_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct denoise_pass *pass = data;
+    size_t width = pass->accum->width;
+    size_t height = pass->accum->height;
+    long step = pass->step;
+
+    for (size_t y = y_from; y < y_to; y++)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            size_t p_i = y * width + x;
+            const struct denoise_pixel *p = &pass->input[p_i];
+            if (is_background(&pass->accum->data[p_i]))
+            {
+                pass->output[p_i] = *p;
+                continue;
+            }
+
+            float variance = local_variance(pass, x, y);
+            float lum_sigma = SIGMA_LUMINANCE * sqrtf(variance) + 1e-4f;
+            struct denoise_pixel sum = {0};
+            float weight_sum = 0;
+
+            for (int ky = -2; ky <= 2; ky++)
+            {
+                long qy = (long)y + ky * step;
+                if (qy < 0 || qy >= (long)height)
+                    continue;
+
+                for (int kx = -2; kx <= 2; kx++)
+                {
+                    long qx = (long)x + kx * step;
+                    if (qx < 0 || qx >= (long)width)
+                        continue;
+
+                    size_t q_i = qy * width + qx;
+                    float w = kernel[kx + 2] * kernel[ky + 2];
+                    if (q_i != p_i)
+                        w *= edge_weight(pass, p_i, q_i, kx * step, ky * step,
+                                         lum_sigma);
+
+                    const struct denoise_pixel *q = &pass->input[q_i];
+                    sum.r += w * q->r;
+                    sum.g += w * q->g;
+                    sum.b += w * q->b;
+                    // the variance of a weighted sum uses squared weights
+                    sum.variance += w * w * q->variance;
+                    weight_sum += w;
+                }
+            }
+
+            // the center tap always has a positive weight
+            sum.r /= weight_sum;
+            sum.g /= weight_sum;
+            sum.b /= weight_sum;
+            sum.variance /= weight_sum * weight_sum;
+            pass->output[p_i] = sum;
+        }
+    }
+}
+
+/*
+** Compute the depth gradients using central differences, falling back to
+** one sided differences at borders and depth discontinuities.
+*/
+static float depth_slope(const struct accum_buffer *accum, size_t i,
+                         size_t prev_i, size_t next_i)
+{
+    const struct accum_pixel *p = &accum->data[i];
+    float prev = fabsf(p->depth - accum->data[prev_i].depth);
+    float next = fabsf(accum->data[next_i].depth - p->depth);
+    if (i == prev_i || is_background(&accum->data[prev_i]))
+        return next;
+    if (i == next_i || is_background(&accum->data[next_i]))
+        return prev;
+    return fminf(prev, next);
+}
+
+static struct depth_gradient *compute_gradients(
+    const struct accum_buffer *accum)
+{
+    size_t width = accum->width;
+    size_t height = accum->height;
+    struct depth_gradient *res = xcalloc(width * height, sizeof(*res));
+
+    for (size_t y = 0; y < height; y++)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            size_t i = y * width + x;
+            size_t left = x > 0 ? i - 1 : i;
+            size_t right = x + 1 < width ? i + 1 : i;
+            size_t down = y > 0 ? i - width : i;
+            size_t up = y + 1 < height ? i + width : i;
+            res[i].dx = depth_slope(accum, i, left, right);
+            res[i].dy = depth_slope(accum, i, down, up);
+        }
+    }
+
+    return res;
+}
+
+void postprocess_denoise(struct rgb_image *image,
+                         const struct accum_buffer *accum, size_t iterations,
+                         size_t threads)
+{
+    // once taps are a whole image apart, only the center one is left in
+    // it, and further iterations don't change anything
+    size_t size = accum->width > accum->height ? accum->width : accum->height;
+    size_t useful = 0;
+    while (useful < iterations && ((size_t)1 << useful) < size)
+        useful++;
+    if (iterations > useful)
+    {
+        warnx("DENOISE - Only %li iterations change a %lix%li image, "
+              "skipping the others",
+              useful, accum->width, accum->height);
+        iterations = useful;
+    }
+
+    size_t pixels = accum->width * accum->height;
+    struct denoise_pixel *input = xcalloc(pixels, sizeof(*input));
+    struct denoise_pixel *output = xcalloc(pixels, sizeof(*output));
+
+    warnx("DENOISE - Filtering %lix%li image with %li iterations",
+          accum->width, accum->height, iterations);
+
+    for (size_t i = 0; i < pixels; i++)
+    {
+        const struct accum_pixel *pixel = &accum->data[i];
+        double variance = accum_pixel_variance(pixel);
+        if (isinf(variance))
+            variance = UNKNOWN_VARIANCE;
+        input[i] = (struct denoise_pixel){pixel->r, pixel->g, pixel->b,
+                                          variance};
+    }
+
+    struct depth_gradient *gradients = compute_gradients(accum);
+    struct denoise_pass pass = {
+        .accum = accum,
+        .gradients = gradients,
+    };
+
+    // each iteration doubles the distance between taps
+    for (size_t i = 0; i < iterations; i++)
+    {
+        pass.input = input;
+        pass.output = output;
+        pass.step = (size_t)1 << i;
+        parallel_rows(accum->height, threads, denoise_rows, &pass);
+
+        struct denoise_pixel *tmp = input;
+        input = output;
+        output = tmp;
+    }
+
+    for (size_t y = 0; y < image->height; y++)
+    {
+        for (size_t x = 0; x < image->width; x++)
+        {
+            const struct denoise_pixel *pixel = &input[y * image->width + x];
+            struct vec3 color = {pixel->r, pixel->g, pixel->b};
+            rgb_image_set(image, x, y, rgb_color_from_light(&color));
+        }
+    }
+
+    free(gradients);
+    free(input);
+    free(output);
+
+    warnx("DENOISE - Complete");
+}
@@ -0,0 +1,68 @@
+#include "dynamic_resolution.h"
+
+#include <math.h>
+
+// the weight of the last frame in the smoothed pixel cost
+#define DYNRES_SMOOTHING 0.3
+// the part of the target aimed at, leaving room for noisy frames
+#define DYNRES_HEADROOM 0.9
+// the largest change of scale from a frame to the next
+#define DYNRES_MAX_STEP 1.25
+// smaller changes of scale are ignored, so that the size doesn't flicker
+#define DYNRES_HYSTERESIS 0.03
+
+static size_t scale_size(size_t size, double scale)
+{
+    size_t res = lround(size * scale);
+    return res > 0 ? res : 1;
+}
+
+static void dynres_resize(struct dynres_controller *controller, double scale)
+{
+    controller->scale = scale;
+    controller->width = scale_size(controller->full_width, scale);
+    controller->height = scale_size(controller->full_height, scale);
+}
+
+void dynres_init(struct dynres_controller *controller, size_t width,
+                 size_t height, double target, double min_scale)
+{
+    controller->full_width = width;
+    controller->full_height = height;
+    controller->target = target;
+    controller->min_scale = fmin(fmax(min_scale, 0), 1);
+    controller->pixel_cost = 0;
+    dynres_resize(controller, 1);
+}
+
+bool dynres_update(struct dynres_controller *controller, double frame_time)
+{
+    double pixels = (double)controller->width * controller->height;
+    double cost = frame_time / pixels;
+    if (controller->pixel_cost == 0)
+        controller->pixel_cost = cost;
+    else
+        controller->pixel_cost += DYNRES_SMOOTHING
+                                  * (cost - controller->pixel_cost);
+
+    // the number of pixels fitting in the target, as a scale of the output
+    double full_pixels
+        = (double)controller->full_width * controller->full_height;
+    double scale = sqrt(DYNRES_HEADROOM * controller->target
+                        / (controller->pixel_cost * full_pixels));
+
+    scale = fmin(scale, controller->scale * DYNRES_MAX_STEP);
+    scale = fmax(scale, controller->scale / DYNRES_MAX_STEP);
+    scale = fmin(fmax(scale, controller->min_scale), 1);
+
+    // always reach the bounds, which may be closer than the hysteresis
+    bool bound = scale == 1 || scale == controller->min_scale;
+    if (scale == controller->scale
+        || (!bound && fabs(scale - controller->scale) < DYNRES_HYSTERESIS))
+        return false;
+
+    size_t width = controller->width;
+    size_t height = controller->height;
+    dynres_resize(controller, scale);
+    return width != controller->width || height != controller->height;
+}
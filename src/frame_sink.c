@@ -0,0 +1,145 @@
+#include "frame_sink.h"
+#include "utils/align.h"
+#include "utils/alloc.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static size_t frame_size(const struct frame_sink *sink)
+{
+    return sink->width * sink->height * sizeof(struct rgb_pixel);
+}
+
+static int ring_open(struct frame_sink *sink, const char *name)
+{
+    size_t data_offset = align_up(sizeof(struct frame_ring_header), 64);
+    sink->ring_size = data_offset + FRAME_RING_SLOTS * frame_size(sink);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        warn("failed to open the shared memory '%s'", name);
+        return 1;
+    }
+
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, sink->ring_size) == 0)
+        map = mmap(NULL, sink->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        warn("failed to map the shared memory '%s'", name);
+        shm_unlink(name);
+        return 1;
+    }
+
+    sink->shm_name = strdup(name);
+    sink->ring = map;
+    sink->ring->width = sink->width;
+    sink->ring->height = sink->height;
+    sink->ring->slots = FRAME_RING_SLOTS;
+    sink->ring->data_offset = data_offset;
+    sink->ring->frames = 0;
+    // readers check the magic last
+    __atomic_store_n(&sink->ring->magic, FRAME_RING_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int frame_sink_open(struct frame_sink *sink, const char *spec, size_t width,
+                    size_t height)
+{
+    *sink = (struct frame_sink){
+        .type = FRAME_SINK_NONE,
+        .width = width,
+        .height = height,
+    };
+
+    if (spec == NULL)
+        return 0;
+
+    if (strcmp(spec, "-") == 0)
+    {
+        // a reader going away ends the stream instead of the process
+        signal(SIGPIPE, SIG_IGN);
+        sink->type = FRAME_SINK_STDOUT;
+        sink->buffer = xalloc(frame_size(sink));
+        return 0;
+    }
+
+    if (strncmp(spec, "shm:", 4) == 0)
+    {
+        sink->type = FRAME_SINK_SHM;
+        return ring_open(sink, spec + 4);
+    }
+
+    warnx("Invalid frame sink '%s'", spec);
+    return 1;
+}
+
+/*
+** Copy the image with its top row first, as images are stored bottom up
+*/
+static void frame_copy(uint8_t *dst, const struct rgb_image *image)
+{
+    size_t row_size = image->width * sizeof(struct rgb_pixel);
+    for (size_t y = 0; y < image->height; y++)
+        memcpy(dst + row_size * y,
+               &image->data[image->width * (image->height - 1 - y)],
+               row_size);
+}
+
+static int write_all(int fd, const uint8_t *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return 1;
+        data += written;
+        size -= written;
+    }
+    return 0;
+}
+
+int frame_sink_write(struct frame_sink *sink, const struct rgb_image *image)
+{
+    if (sink->type == FRAME_SINK_STDOUT)
+    {
+        frame_copy(sink->buffer, image);
+        if (write_all(STDOUT_FILENO, sink->buffer, frame_size(sink)))
+        {
+            warn("failed to write a frame to stdout");
+            return 1;
+        }
+    }
+    else if (sink->type == FRAME_SINK_SHM)
+    {
+        struct frame_ring_header *ring = sink->ring;
+        uint64_t frame = ring->frames;
+        uint8_t *slot = (uint8_t *)ring + ring->data_offset
+                        + (frame % ring->slots) * frame_size(sink);
+        frame_copy(slot, image);
+        __atomic_store_n(&ring->frames, frame + 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+void frame_sink_close(struct frame_sink *sink)
+{
+    if (sink->ring != NULL)
+    {
+        munmap(sink->ring, sink->ring_size);
+        shm_unlink(sink->shm_name);
+    }
+    free(sink->shm_name);
+    free(sink->buffer);
+}
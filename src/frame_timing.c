@@ -0,0 +1,118 @@
+#include "frame_timing.h"
+#include "utils/alloc.h"
+
+#include <err.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// quarters of the budget, up to twice the budget
+#define FRAME_HISTOGRAM_BUCKETS 9
+// the length of the bar of the largest bucket
+#define FRAME_HISTOGRAM_WIDTH 40
+
+void frame_timing_init(struct frame_timing *timing)
+{
+    timing->times = NULL;
+    timing->count = 0;
+    timing->capacity = 0;
+}
+
+void frame_timing_destroy(struct frame_timing *timing)
+{
+    free(timing->times);
+}
+
+void frame_timing_add(struct frame_timing *timing, double time)
+{
+    if (timing->count == timing->capacity)
+    {
+        timing->capacity = timing->capacity ? 2 * timing->capacity : 64;
+        timing->times = xrealloc(timing->times,
+                                 timing->capacity * sizeof(*timing->times));
+    }
+    timing->times[timing->count++] = time;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+    double time_a = *(const double *)a;
+    double time_b = *(const double *)b;
+    return (time_a > time_b) - (time_a < time_b);
+}
+
+double frame_timing_percentile(const struct frame_timing *timing,
+                               double fraction)
+{
+    if (timing->count == 0)
+        return 0;
+
+    double *sorted = xcalloc(timing->count, sizeof(*sorted));
+    memcpy(sorted, timing->times, timing->count * sizeof(*sorted));
+    qsort(sorted, timing->count, sizeof(*sorted), compare_times);
+
+    // the nearest rank
+    size_t rank = ceil(fraction * timing->count);
+    double res = sorted[rank > 0 ? rank - 1 : 0];
+    free(sorted);
+    return res;
+}
+
+void frame_timing_report(const struct frame_timing *timing, double budget)
+{
+    if (timing->count == 0)
+        return;
+
+    size_t over_budget = 0;
+    double total = 0;
+    for (size_t i = 0; i < timing->count; i++)
+    {
+        over_budget += budget > 0 && timing->times[i] > budget;
+        total += timing->times[i];
+    }
+
+    warnx("FRAMES - %li frames, %.2fms on average", timing->count,
+          1e3 * total / timing->count);
+    warnx("FRAMES - p50 %.2fms, p90 %.2fms, p99 %.2fms, max %.2fms",
+          1e3 * frame_timing_percentile(timing, 0.5),
+          1e3 * frame_timing_percentile(timing, 0.9),
+          1e3 * frame_timing_percentile(timing, 0.99),
+          1e3 * frame_timing_percentile(timing, 1));
+    if (budget > 0)
+        warnx("FRAMES - %li frames over the %.2fms budget", over_budget,
+              1e3 * budget);
+}
+
+void frame_timing_histogram(const struct frame_timing *timing, double budget)
+{
+    if (timing->count == 0 || budget <= 0)
+        return;
+
+    // the last bucket holds all the frames taking twice the budget or more
+    size_t buckets[FRAME_HISTOGRAM_BUCKETS] = {0};
+    size_t largest = 0;
+    for (size_t i = 0; i < timing->count; i++)
+    {
+        size_t bucket = timing->times[i] / budget * 4;
+        if (bucket >= FRAME_HISTOGRAM_BUCKETS)
+            bucket = FRAME_HISTOGRAM_BUCKETS - 1;
+        buckets[bucket]++;
+        if (buckets[bucket] > largest)
+            largest = buckets[bucket];
+    }
+
+    char bar[FRAME_HISTOGRAM_WIDTH + 1];
+    for (size_t i = 0; i < FRAME_HISTOGRAM_BUCKETS; i++)
+    {
+        size_t length = buckets[i] * FRAME_HISTOGRAM_WIDTH / largest;
+        memset(bar, '#', length);
+        bar[length] = '\0';
+
+        double from = 1e3 * budget * i / 4;
+        if (i + 1 < FRAME_HISTOGRAM_BUCKETS)
+            warnx("FRAMES - %7.2f-%7.2fms %6li %s", from,
+                  1e3 * budget * (i + 1) / 4, buckets[i], bar);
+        else
+            warnx("FRAMES - %7.2fms and up %6li %s", from, buckets[i], bar);
+    }
+}
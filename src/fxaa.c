@@ -0,0 +1,285 @@
+#include "fxaa.h"
+#include "utils/alloc.h"
+#include "utils/parallel.h"
+
+#include <err.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the smallest local contrast considered as an edge, in dark areas
+#define EDGE_THRESHOLD_MIN 0.0312f
+// the smallest local contrast considered as an edge, relative to the
+// brightest neighbor
+#define EDGE_THRESHOLD 0.125f
+// how much blur is applied to single pixel details
+#define SUBPIXEL_QUALITY 0.75f
+// the steps taken along edges while looking for their ends, in pixels
+static const float search_steps[] = {1, 1, 1, 1, 1, 1.5, 2, 2, 2, 2, 4, 8};
+#define SEARCH_STEPS_COUNT (sizeof(search_steps) / sizeof(search_steps[0]))
+
+struct fxaa_pass
+{
+    const struct rgb_image *input;
+    const struct gbuffer *gbuffer;
+    const float *luma;
+    struct rgb_image *output;
+};
+
+static float pixel_luma(struct rgb_pixel pixel)
+{
+    return (0.2126f * pixel.r + 0.7152f * pixel.g + 0.0722f * pixel.b) / 255;
+}
+
+static size_t clamp_coord(long coord, size_t size)
+{
+    if (coord < 0)
+        return 0;
+    if (coord >= (long)size)
+        return size - 1;
+    return coord;
+}
+
+static float luma_at(const struct fxaa_pass *pass, long x, long y)
+{
+    size_t width = pass->input->width;
+    return pass->luma[clamp_coord(y, pass->input->height) * width
+                      + clamp_coord(x, width)];
+}
+
+/*
+** Bilinear interpolation of the luma, at a point in pixels. Pixel centers
+** are at half coordinates.
+*/
+static float luma_sample(const struct fxaa_pass *pass, float x, float y)
+{
+    x -= 0.5f;
+    y -= 0.5f;
+    long x0 = floorf(x);
+    long y0 = floorf(y);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    float top = luma_at(pass, x0, y0) * (1 - fx) + luma_at(pass, x0 + 1, y0) * fx;
+    float bottom = luma_at(pass, x0, y0 + 1) * (1 - fx)
+                   + luma_at(pass, x0 + 1, y0 + 1) * fx;
+    return top * (1 - fy) + bottom * fy;
+}
+
+static struct rgb_pixel color_at(const struct fxaa_pass *pass, long x, long y)
+{
+    const struct rgb_image *image = pass->input;
+    return image->data[clamp_coord(y, image->height) * image->width
+                       + clamp_coord(x, image->width)];
+}
+
+static struct rgb_pixel color_sample(const struct fxaa_pass *pass, float x,
+                                     float y)
+{
+    x -= 0.5f;
+    y -= 0.5f;
+    long x0 = floorf(x);
+    long y0 = floorf(y);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    struct rgb_pixel c00 = color_at(pass, x0, y0);
+    struct rgb_pixel c10 = color_at(pass, x0 + 1, y0);
+    struct rgb_pixel c01 = color_at(pass, x0, y0 + 1);
+    struct rgb_pixel c11 = color_at(pass, x0 + 1, y0 + 1);
+    float w00 = (1 - fx) * (1 - fy);
+    float w10 = fx * (1 - fy);
+    float w01 = (1 - fx) * fy;
+    float w11 = fx * fy;
+
+    struct rgb_pixel res = {
+        c00.r * w00 + c10.r * w10 + c01.r * w01 + c11.r * w11 + 0.5f,
+        c00.g * w00 + c10.g * w10 + c01.g * w01 + c11.g * w11 + 0.5f,
+        c00.b * w00 + c10.b * w10 + c01.b * w01 + c11.b * w11 + 0.5f,
+    };
+    return res;
+}
+
+/*
+** Tells whether the pixel is inside an object, away from its silhouette.
+*/
+static bool inside_object(const struct gbuffer *gbuffer, size_t x, size_t y)
+{
+    const struct object *object = gbuffer->data[y * gbuffer->width + x].object;
+    if (x > 0 && gbuffer->data[y * gbuffer->width + x - 1].object != object)
+        return false;
+    if (x + 1 < gbuffer->width
+        && gbuffer->data[y * gbuffer->width + x + 1].object != object)
+        return false;
+    if (y > 0 && gbuffer->data[(y - 1) * gbuffer->width + x].object != object)
+        return false;
+    if (y + 1 < gbuffer->height
+        && gbuffer->data[(y + 1) * gbuffer->width + x].object != object)
+        return false;
+    return true;
+}
+
+/*
+** Walk along the edge in both directions until the luma changes, and
+** return how far the pixel is from the closest end, relative to the length
+** of the edge. Returns 0 when the pixel should keep its color.
+*/
+static float edge_offset(const struct fxaa_pass *pass, float x, float y,
+                         bool horizontal, float luma_center,
+                         float local_average, float gradient)
+{
+    float step_x = horizontal ? 1 : 0;
+    float step_y = horizontal ? 0 : 1;
+    float x1 = x - step_x, y1 = y - step_y;
+    float x2 = x + step_x, y2 = y + step_y;
+    float end1 = luma_sample(pass, x1, y1) - local_average;
+    float end2 = luma_sample(pass, x2, y2) - local_average;
+    bool reached1 = fabsf(end1) >= gradient;
+    bool reached2 = fabsf(end2) >= gradient;
+
+    for (size_t i = 1; i < SEARCH_STEPS_COUNT && !(reached1 && reached2); i++)
+    {
+        if (!reached1)
+        {
+            x1 -= step_x * search_steps[i];
+            y1 -= step_y * search_steps[i];
+            end1 = luma_sample(pass, x1, y1) - local_average;
+            reached1 = fabsf(end1) >= gradient;
+        }
+        if (!reached2)
+        {
+            x2 += step_x * search_steps[i];
+            y2 += step_y * search_steps[i];
+            end2 = luma_sample(pass, x2, y2) - local_average;
+            reached2 = fabsf(end2) >= gradient;
+        }
+    }
+
+    float distance1 = horizontal ? x - x1 : y - y1;
+    float distance2 = horizontal ? x2 - x : y2 - y;
+    bool closest_is_1 = distance1 < distance2;
+    float distance = fminf(distance1, distance2);
+
+    // only blend when the luma at the closest end varies the other way
+    bool center_smaller = luma_center < local_average;
+    float end = closest_is_1 ? end1 : end2;
+    if ((end < 0) == center_smaller)
+        return 0;
+
+    return 0.5f - distance / (distance1 + distance2);
+}
+
+static struct rgb_pixel fxaa_pixel(const struct fxaa_pass *pass, size_t x,
+                                   size_t y)
+{
+    struct rgb_pixel center_color = pass->input->data[y * pass->input->width
+                                                      + x];
+    // guided by objects, only their silhouettes are filtered
+    if (pass->gbuffer != NULL && inside_object(pass->gbuffer, x, y))
+        return center_color;
+
+    float center = luma_at(pass, x, y);
+    float up = luma_at(pass, x, (long)y - 1);
+    float down = luma_at(pass, x, y + 1);
+    float left = luma_at(pass, (long)x - 1, y);
+    float right = luma_at(pass, x + 1, y);
+
+    float luma_min = fminf(center, fminf(fminf(up, down), fminf(left, right)));
+    float luma_max = fmaxf(center, fmaxf(fmaxf(up, down), fmaxf(left, right)));
+    float range = luma_max - luma_min;
+    if (range < fmaxf(EDGE_THRESHOLD_MIN, luma_max * EDGE_THRESHOLD))
+        return center_color;
+
+    float up_left = luma_at(pass, (long)x - 1, (long)y - 1);
+    float up_right = luma_at(pass, x + 1, (long)y - 1);
+    float down_left = luma_at(pass, (long)x - 1, y + 1);
+    float down_right = luma_at(pass, x + 1, y + 1);
+
+    // find whether the edge is horizontal or vertical
+    float edge_horizontal = fabsf(-2 * left + up_left + down_left)
+                            + 2 * fabsf(-2 * center + up + down)
+                            + fabsf(-2 * right + up_right + down_right);
+    float edge_vertical = fabsf(-2 * up + up_left + up_right)
+                          + 2 * fabsf(-2 * center + left + right)
+                          + fabsf(-2 * down + down_left + down_right);
+    bool horizontal = edge_horizontal >= edge_vertical;
+
+    // find on which side of the pixel the edge is
+    float luma1 = horizontal ? up : left;
+    float luma2 = horizontal ? down : right;
+    float gradient1 = luma1 - center;
+    float gradient2 = luma2 - center;
+    bool side1 = fabsf(gradient1) >= fabsf(gradient2);
+    float gradient = 0.25f * fmaxf(fabsf(gradient1), fabsf(gradient2));
+    float step = side1 ? -1 : 1;
+    float local_average = 0.5f * ((side1 ? luma1 : luma2) + center);
+
+    // move to the edge, between the pixel and its neighbor
+    float edge_x = x + 0.5f;
+    float edge_y = y + 0.5f;
+    if (horizontal)
+        edge_y += step * 0.5f;
+    else
+        edge_x += step * 0.5f;
+
+    float offset = edge_offset(pass, edge_x, edge_y, horizontal, center,
+                               local_average, gradient);
+
+    // single pixel details are blurred depending on their contrast
+    float average = (2 * (up + down + left + right) + up_left + up_right
+                     + down_left + down_right)
+                    / 12;
+    float subpixel = fminf(1, fabsf(average - center) / range);
+    subpixel = (-2 * subpixel + 3) * subpixel * subpixel;
+    offset = fmaxf(offset, subpixel * subpixel * SUBPIXEL_QUALITY);
+
+    float sample_x = x + 0.5f;
+    float sample_y = y + 0.5f;
+    if (horizontal)
+        sample_y += offset * step;
+    else
+        sample_x += offset * step;
+    return color_sample(pass, sample_x, sample_y);
+}
+
+static void fxaa_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct fxaa_pass *pass = data;
+    for (size_t y = y_from; y < y_to; y++)
+        for (size_t x = 0; x < pass->output->width; x++)
+            rgb_image_set(pass->output, x, y, fxaa_pixel(pass, x, y));
+}
+
+static void luma_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct fxaa_pass *pass = data;
+    size_t width = pass->input->width;
+    float *luma = (float *)pass->luma;
+    for (size_t i = y_from * width; i < y_to * width; i++)
+        luma[i] = pixel_luma(pass->input->data[i]);
+}
+
+void postprocess_fxaa(struct rgb_image *image, const struct gbuffer *gbuffer,
+                      size_t threads)
+{
+    size_t pixels = image->width * image->height;
+    struct rgb_image *input = rgb_image_alloc(image->width, image->height);
+    memcpy(input->data, image->data, pixels * sizeof(*image->data));
+    float *luma = xcalloc(pixels, sizeof(*luma));
+
+    warnx("AA - Applying FXAA%s", gbuffer ? " on object edges" : "");
+
+    struct fxaa_pass pass = {
+        .input = input,
+        .gbuffer = gbuffer,
+        .luma = luma,
+        .output = image,
+    };
+    parallel_rows(image->height, threads, luma_rows, &pass);
+    parallel_rows(image->height, threads, fxaa_rows, &pass);
+
+    free(luma);
+    free(input);
+    warnx("AA - Completed FXAA");
+}
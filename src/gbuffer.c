@@ -0,0 +1,13 @@
+#include "gbuffer.h"
+
+struct gbuffer *gbuffer_alloc(size_t width, size_t height)
+{
+    size_t alloc_size = sizeof(struct gbuffer);
+    alloc_size += sizeof(struct gbuffer_pixel) * width * height;
+
+    // left untouched until rendering threads write it, like accum buffers
+    struct gbuffer *res = xcalloc(1, alloc_size);
+    res->width = width;
+    res->height = height;
+    return res;
+}
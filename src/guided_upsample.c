@@ -0,0 +1,189 @@
+#include <err.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "gbuffer.h"
+#include "guided_upsample.h"
+#include "utils/alloc.h"
+#include "utils/parallel.h"
+
+// how far low resolution pixels contribute, in low resolution pixels
+#define GUIDED_RADIUS 1.5
+// how much depth differences are tolerated, relative to the depth
+#define GUIDED_DEPTH_TOLERANCE 0.05
+// the exponent applied to the cosine between normals
+#define GUIDED_NORMAL_POWER 16.
+// pixels matched by less are rendered at full resolution
+#define GUIDED_MIN_WEIGHT 0.05
+
+struct guided_pass
+{
+    struct rgb_image *image;
+    const struct rgb_image *low;
+    const struct gbuffer *low_gbuffer;
+    const struct gbuffer *gbuffer;
+    // the pixels rendered again at full resolution, and how
+    uint8_t *missed;
+    struct render_ctx ctx;
+};
+
+static double tent(double distance)
+{
+    return fmax(0, 1 - fabs(distance) / GUIDED_RADIUS);
+}
+
+/*
+** How much a low resolution pixel looks like the full resolution one, from
+** 0 to 1. Only pixels seeing the same object match.
+*/
+static double geometry_weight(const struct gbuffer_pixel *guide,
+                              const struct gbuffer_pixel *sample)
+{
+    if (guide->object != sample->object)
+        return 0;
+    if (guide->object == NULL)
+        return 1;
+
+    double cosine = vec3_dot(&guide->normal, &sample->normal);
+    if (cosine <= 0)
+        return 0;
+
+    double depth = (sample->depth - guide->depth)
+                   / (GUIDED_DEPTH_TOLERANCE * guide->depth);
+    return exp(-depth * depth) * pow(cosine, GUIDED_NORMAL_POWER);
+}
+
+static void upsample_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct guided_pass *pass = data;
+    struct rgb_image *image = pass->image;
+    const struct rgb_image *low = pass->low;
+
+    for (size_t y = y_from; y < y_to; y++)
+    {
+        // low resolution pixel i is cast where full resolution pixel
+        // i * width / low width is
+        double v = (double)y * low->height / image->height;
+        for (size_t x = 0; x < image->width; x++)
+        {
+            double u = (double)x * low->width / image->width;
+            const struct gbuffer_pixel *guide
+                = &pass->gbuffer->data[y * pass->gbuffer->width + x];
+
+            double r = 0, g = 0, b = 0, weight_sum = 0;
+            long i_first = floor(u - GUIDED_RADIUS) + 1;
+            long j_first = floor(v - GUIDED_RADIUS) + 1;
+            for (long j = j_first; j <= v + GUIDED_RADIUS; j++)
+                for (long i = i_first; i <= u + GUIDED_RADIUS; i++)
+                {
+                    if (i < 0 || j < 0 || i >= (long)low->width
+                        || j >= (long)low->height)
+                        continue;
+
+                    size_t index = j * low->width + i;
+                    double weight = tent(i - u) * tent(j - v);
+                    if (weight == 0)
+                        continue;
+                    weight *= geometry_weight(guide,
+                                              &pass->low_gbuffer->data[index]);
+
+                    r += weight * low->data[index].r;
+                    g += weight * low->data[index].g;
+                    b += weight * low->data[index].b;
+                    weight_sum += weight;
+                }
+
+            size_t index = y * image->width + x;
+            if (weight_sum < GUIDED_MIN_WEIGHT)
+            {
+                // thin objects and new edges, the background is left black
+                pass->missed[index] = 1;
+                image->data[index] = (struct rgb_pixel){0};
+                continue;
+            }
+
+            image->data[index] = (struct rgb_pixel){
+                r / weight_sum + 0.5,
+                g / weight_sum + 0.5,
+                b / weight_sum + 0.5,
+            };
+        }
+    }
+}
+
+static void render_missed_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct guided_pass *pass = data;
+    render_tile(&pass->ctx, 0, y_from, pass->image->width, y_to - y_from,
+                pass->image);
+}
+
+int render_guided(struct rgb_image *image, struct scene *scene,
+                  enum runner_type runner,
+                  const struct render_mode *renderer,
+                  const struct render_mode *visibility,
+                  const struct runner_options *options, size_t factor,
+                  size_t threads)
+{
+    size_t low_width = (image->width + factor - 1) / factor;
+    size_t low_height = (image->height + factor - 1) / factor;
+    warnx("GUIDED - Shading at %lix%li, upscaled to %lix%li", low_width,
+          low_height, image->width, image->height);
+
+    // shade at low resolution, keeping what each pixel saw
+    struct gbuffer *full_gbuffer = scene->gbuffer;
+    struct gbuffer *low_gbuffer = gbuffer_alloc(low_width, low_height);
+    struct rgb_image *low = rgb_image_alloc(low_width, low_height);
+    struct rgb_pixel background = {0};
+    rgb_image_clear(low, &background);
+    scene->gbuffer = low_gbuffer;
+    int res = run_renderer(low, scene, runner, renderer, options);
+
+    // then find what full resolution pixels see
+    scene->gbuffer = full_gbuffer;
+    if (scene->gbuffer == NULL)
+        scene->gbuffer = gbuffer_alloc(image->width, image->height);
+    if (res == 0)
+        res = run_renderer(image, scene, runner, visibility, options);
+
+    if (res == 0)
+    {
+        size_t pixels = image->width * image->height;
+        struct guided_pass pass = {
+            .image = image,
+            .low = low,
+            .low_gbuffer = low_gbuffer,
+            .gbuffer = scene->gbuffer,
+            .missed = xcalloc(pixels, sizeof(uint8_t)),
+        };
+        parallel_rows(image->height, threads, upsample_rows, &pass);
+
+        size_t missed = 0;
+        for (size_t i = 0; i < pixels; i++)
+            missed += pass.missed[i];
+        warnx("GUIDED - Rendering %li unmatched pixels (%.2f%%) at full "
+              "resolution",
+              missed, 100. * missed / pixels);
+        if (missed != 0)
+        {
+            render_ctx_init(&pass.ctx, scene, renderer, pass.missed, 0);
+            parallel_rows(image->height, threads, render_missed_rows, &pass);
+            render_ctx_destroy(&pass.ctx);
+        }
+
+        warnx("GUIDED - Shaded %.1f%% of the pixels of a full render",
+              100. * (low_width * low_height + missed) / pixels);
+        free(pass.missed);
+    }
+
+    // the geometry buffer of the caller keeps the full resolution pixels
+    if (full_gbuffer == NULL)
+    {
+        free(scene->gbuffer);
+        scene->gbuffer = NULL;
+    }
+    free(low_gbuffer);
+    free(low);
+    return res;
+}
@@ -1,6 +1,13 @@
 #include <string.h>
 
 #include "image.h"
+#include "utils/parallel.h"
+
+struct clear_pass
+{
+    struct rgb_image *image;
+    const struct rgb_pixel *pix;
+};
 
 struct rgb_image *rgb_image_alloc(size_t width, size_t height)
 {
@@ -19,3 +26,29 @@ void rgb_image_clear(struct rgb_image *image, const struct rgb_pixel *pix)
         for (size_t x = 0; x < image->width; x++)
             memcpy(&image->data[image->width * y + x], pix, sizeof(*pix));
 }
+
+static void clear_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct clear_pass *pass = data;
+    struct rgb_image *image = pass->image;
+    for (size_t y = y_from; y < y_to; y++)
+        for (size_t x = 0; x < image->width; x++)
+            memcpy(&image->data[image->width * y + x], pass->pix,
+                   sizeof(*pass->pix));
+}
+
+void rgb_image_clear_parallel(struct rgb_image *image,
+                              const struct rgb_pixel *pix, size_t threads)
+{
+    struct clear_pass pass = {image, pix};
+    parallel_rows(image->height, threads, clear_rows, &pass);
+}
+
+struct rgb_pixel rgb_color_from_light(const struct vec3 *light)
+{
+    struct rgb_pixel res;
+    res.r = translate_light_component(light->x);
+    res.g = translate_light_component(light->y);
+    res.b = translate_light_component(light->z);
+    return res;
+}
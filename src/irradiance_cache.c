@@ -0,0 +1,407 @@
+#include "irradiance_cache.h"
+#include "sampler.h"
+#include "stats.h"
+#include "utils/alloc.h"
+#include "utils/pvect.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// the hemisphere is sampled using a grid of THETA_STRATA x PHI_STRATA cells
+#define THETA_STRATA 6
+#define PHI_STRATA 19
+// the bounds of the distance of records to surrounding objects
+#define MIN_MEAN_DISTANCE 0.01
+#define MAX_MEAN_DISTANCE 1.
+// the side of the octree when the first record is inserted
+#define INITIAL_ROOT_SIZE 8.
+// records slightly in front of a point can't be used, as they may see
+// objects the point can't
+#define FRONT_TOLERANCE 0.05
+// how far secondary rays start from the surface, to avoid self-intersection
+#define RECORD_EPSILON 1e-6
+
+#define GVECT_NAME record_vect
+#define GVECT_TYPE struct irradiance_record *
+#include "utils/pvect_wrap.h"
+#undef GVECT_NAME
+#undef GVECT_TYPE
+
+struct irradiance_node
+{
+    struct vec3 center;
+    double half_size;
+    struct irradiance_node *children[8];
+    // the records whose validity radius is at most half_size
+    struct record_vect records;
+};
+
+static struct irradiance_node *node_create(struct vec3 center,
+                                           double half_size)
+{
+    struct irradiance_node *node = zalloc(sizeof(*node));
+    node->center = center;
+    node->half_size = half_size;
+    record_vect_init(&node->records, 4);
+    return node;
+}
+
+static void node_free(struct irradiance_node *node)
+{
+    if (node == NULL)
+        return;
+
+    for (size_t i = 0; i < 8; i++)
+        node_free(node->children[i]);
+
+    for (size_t i = 0; i < record_vect_size(&node->records); i++)
+        free(record_vect_get(&node->records, i));
+    record_vect_destroy(&node->records);
+    free(node);
+}
+
+void irradiance_cache_init(struct irradiance_cache *cache, double accuracy)
+{
+    pthread_rwlock_init(&cache->lock, NULL);
+    cache->root = NULL;
+    cache->accuracy = accuracy;
+    cache->records_count = 0;
+}
+
+void irradiance_cache_destroy(struct irradiance_cache *cache)
+{
+    node_free(cache->root);
+    pthread_rwlock_destroy(&cache->lock);
+}
+
+static bool node_contains(const struct irradiance_node *node,
+                          const struct vec3 *p, double margin)
+{
+    double extent = node->half_size + margin;
+    return fabs(p->x - node->center.x) <= extent
+           && fabs(p->y - node->center.y) <= extent
+           && fabs(p->z - node->center.z) <= extent;
+}
+
+static size_t octant_of(const struct irradiance_node *node,
+                        const struct vec3 *p)
+{
+    return (p->x >= node->center.x) | (p->y >= node->center.y) << 1
+           | (p->z >= node->center.z) << 2;
+}
+
+static struct vec3 octant_center(const struct irradiance_node *node,
+                                 size_t octant)
+{
+    double quarter = node->half_size / 2;
+    return (struct vec3){
+        node->center.x + (octant & 1 ? quarter : -quarter),
+        node->center.y + (octant & 2 ? quarter : -quarter),
+        node->center.z + (octant & 4 ? quarter : -quarter),
+    };
+}
+
+/*
+** Double the size of the octree until it contains the point.
+** The cache must be locked for writing.
+*/
+static void grow_root(struct irradiance_cache *cache, const struct vec3 *p)
+{
+    while (!node_contains(cache->root, p, 0))
+    {
+        struct irradiance_node *old = cache->root;
+        double half = old->half_size;
+
+        // the new root extends towards the point
+        struct vec3 center = {
+            old->center.x + (p->x >= old->center.x ? half : -half),
+            old->center.y + (p->y >= old->center.y ? half : -half),
+            old->center.z + (p->z >= old->center.z ? half : -half),
+        };
+
+        cache->root = node_create(center, half * 2);
+        cache->root->children[octant_of(cache->root, &old->center)] = old;
+    }
+}
+
+static void cache_insert(struct irradiance_cache *cache,
+                         struct irradiance_record *record)
+{
+    double radius = cache->accuracy * record->mean_distance;
+
+    pthread_rwlock_wrlock(&cache->lock);
+
+    if (cache->root == NULL)
+        cache->root = node_create(record->position, INITIAL_ROOT_SIZE / 2);
+    grow_root(cache, &record->position);
+
+    // go down while the children are still larger than the valid area of
+    // the record, so lookups only have to look around nodes by half their size
+    struct irradiance_node *node = cache->root;
+    while (node->half_size / 2 >= radius)
+    {
+        size_t octant = octant_of(node, &record->position);
+        if (node->children[octant] == NULL)
+            node->children[octant] = node_create(octant_center(node, octant),
+                                                 node->half_size / 2);
+        node = node->children[octant];
+    }
+
+    record_vect_push(&node->records, record);
+    cache->records_count++;
+
+    pthread_rwlock_unlock(&cache->lock);
+    stats_count_irradiance_record();
+}
+
+struct lookup_state
+{
+    const struct vec3 *position;
+    const struct vec3 *normal;
+    double min_weight;
+    struct vec3 sum;
+    double weight_sum;
+};
+
+/*
+** Extrapolate the irradiance of a record to a nearby point, using its
+** gradients.
+*/
+static struct vec3 record_extrapolate(const struct irradiance_record *record,
+                                      const struct vec3 *position,
+                                      const struct vec3 *normal)
+{
+    struct vec3 rotation = vec3_cross(&record->normal, normal);
+    struct vec3 translation = vec3_sub(position, &record->position);
+    double channels[3];
+
+    for (size_t c = 0; c < 3; c++)
+        channels[c] = vec3_dot(&rotation, &record->rot_gradient[c])
+                      + vec3_dot(&translation, &record->trans_gradient[c]);
+
+    struct vec3 change = {channels[0], channels[1], channels[2]};
+    struct vec3 res = vec3_add(&record->irradiance, &change);
+    // gradients may overshoot far from the record
+    res.x = fmax(res.x, 0);
+    res.y = fmax(res.y, 0);
+    res.z = fmax(res.z, 0);
+    return res;
+}
+
+static void node_lookup(const struct irradiance_node *node,
+                        struct lookup_state *state)
+{
+    // records of a node may be valid up to half the node size outside of it
+    if (!node_contains(node, state->position, node->half_size))
+        return;
+
+    for (size_t i = 0; i < record_vect_size(&node->records); i++)
+    {
+        const struct irradiance_record *record
+            = record_vect_get(&node->records, i);
+
+        struct vec3 offset = vec3_sub(state->position, &record->position);
+        struct vec3 mean_normal = vec3_add(state->normal, &record->normal);
+        if (vec3_dot(&offset, &mean_normal) / 2
+            < -FRONT_TOLERANCE * record->mean_distance)
+            continue;
+
+        double normal_error = 1 - vec3_dot(state->normal, &record->normal);
+        double error = vec3_length(&offset) / record->mean_distance
+                       + sqrt(fmax(0, normal_error));
+        if (error <= 0)
+            error = 1e-9;
+
+        double weight = 1 / error;
+        if (weight <= state->min_weight)
+            continue;
+
+        struct vec3 irradiance
+            = record_extrapolate(record, state->position, state->normal);
+        irradiance = vec3_mul(&irradiance, weight);
+        state->sum = vec3_add(&state->sum, &irradiance);
+        state->weight_sum += weight;
+    }
+
+    for (size_t i = 0; i < 8; i++)
+        if (node->children[i] != NULL)
+            node_lookup(node->children[i], state);
+}
+
+bool irradiance_cache_lookup(struct irradiance_cache *cache,
+                             const struct vec3 *position,
+                             const struct vec3 *normal,
+                             struct vec3 *irradiance)
+{
+    struct lookup_state state = {
+        .position = position,
+        .normal = normal,
+        .min_weight = 1 / cache->accuracy,
+    };
+
+    pthread_rwlock_rdlock(&cache->lock);
+    if (cache->root != NULL)
+        node_lookup(cache->root, &state);
+    pthread_rwlock_unlock(&cache->lock);
+
+    if (state.weight_sum <= 0)
+        return false;
+
+    *irradiance = vec3_mul(&state.sum, 1 / state.weight_sum);
+    return true;
+}
+
+static double channel(const struct vec3 *v, size_t c)
+{
+    if (c == 0)
+        return v->x;
+    if (c == 1)
+        return v->y;
+    return v->z;
+}
+
+/*
+** Add a vector times a color to a gradient, channel by channel.
+*/
+static void gradient_add(struct vec3 gradient[3], const struct vec3 *dir,
+                         const struct vec3 *color, double coeff)
+{
+    for (size_t c = 0; c < 3; c++)
+    {
+        struct vec3 term = vec3_mul(dir, coeff * channel(color, c));
+        gradient[c] = vec3_add(&gradient[c], &term);
+    }
+}
+
+/*
+** The direction in the tangent plane at the given azimuth.
+*/
+static struct vec3 plane_dir(const struct vec3 *t, const struct vec3 *b,
+                             double phi)
+{
+    struct vec3 dir_t = vec3_mul(t, cos(phi));
+    struct vec3 dir_b = vec3_mul(b, sin(phi));
+    return vec3_add(&dir_t, &dir_b);
+}
+
+void irradiance_cache_compute(struct irradiance_cache *cache,
+                              struct irradiance_record *record,
+                              const struct scene *scene,
+                              irradiance_radiance_f radiance)
+{
+    struct vec3 radiances[THETA_STRATA][PHI_STRATA];
+    double distances[THETA_STRATA][PHI_STRATA];
+    double sin_thetas[THETA_STRATA][PHI_STRATA];
+
+    struct vec3 t, b;
+    vec3_make_basis(&record->normal, &t, &b);
+    struct vec3 offset = vec3_mul(&record->normal, RECORD_EPSILON);
+    struct ray ray = {.source = vec3_add(&record->position, &offset)};
+
+    // sample the hemisphere with a cosine-weighted stratified grid
+    struct vec3 sum = {0};
+    double inv_dist_sum = 0;
+    for (size_t j = 0; j < THETA_STRATA; j++)
+    {
+        for (size_t k = 0; k < PHI_STRATA; k++)
+        {
+            double sin2 = (j + sampler_next()) / THETA_STRATA;
+            double phi = 2 * M_PI * (k + sampler_next()) / PHI_STRATA;
+            double sin_theta = sqrt(sin2);
+
+            struct vec3 dir_plane = plane_dir(&t, &b, phi);
+            dir_plane = vec3_mul(&dir_plane, sin_theta);
+            struct vec3 dir_n = vec3_mul(&record->normal, sqrt(1 - sin2));
+            ray.direction = vec3_add(&dir_plane, &dir_n);
+
+            double dist;
+            radiances[j][k] = radiance(scene, &ray, &dist);
+            distances[j][k] = dist;
+            sin_thetas[j][k] = sin_theta;
+            sum = vec3_add(&sum, &radiances[j][k]);
+            if (!isinf(dist) && dist > 0)
+                inv_dist_sum += 1 / dist;
+        }
+    }
+
+    double samples = THETA_STRATA * PHI_STRATA;
+    record->irradiance = vec3_mul(&sum, M_PI / samples);
+
+    record->mean_distance = MAX_MEAN_DISTANCE;
+    if (inv_dist_sum > 0)
+        record->mean_distance = fmin(samples / inv_dist_sum,
+                                     MAX_MEAN_DISTANCE);
+    record->mean_distance = fmax(record->mean_distance, MIN_MEAN_DISTANCE);
+
+    // gradients, from Ward and Heckbert, "Irradiance Gradients"
+    for (size_t c = 0; c < 3; c++)
+    {
+        record->rot_gradient[c] = (struct vec3){0};
+        record->trans_gradient[c] = (struct vec3){0};
+    }
+
+    for (size_t k = 0; k < PHI_STRATA; k++)
+    {
+        double phi_center = 2 * M_PI * (k + 0.5) / PHI_STRATA;
+        double phi_start = 2 * M_PI * k / PHI_STRATA;
+        struct vec3 u_k = plane_dir(&t, &b, phi_center);
+        struct vec3 v_k = plane_dir(&t, &b, phi_center + M_PI / 2);
+        struct vec3 v_k_start = plane_dir(&t, &b, phi_start + M_PI / 2);
+        size_t prev_k = (k + PHI_STRATA - 1) % PHI_STRATA;
+
+        for (size_t j = 0; j < THETA_STRATA; j++)
+        {
+            const struct vec3 *l = &radiances[j][k];
+            double sin_theta = sin_thetas[j][k];
+            double tan_theta = sin_theta / sqrt(fmax(1e-9, 1 - sin_theta
+                                                               * sin_theta));
+            gradient_add(record->rot_gradient, &v_k, l,
+                         -tan_theta * M_PI / samples);
+
+            // the change across the boundary with the previous theta ring
+            if (j > 0)
+            {
+                double sin_start = sqrt((double)j / THETA_STRATA);
+                double cos_start2 = 1 - (double)j / THETA_STRATA;
+                double dist = fmin(distances[j][k], distances[j - 1][k]);
+                struct vec3 diff = vec3_sub(l, &radiances[j - 1][k]);
+                gradient_add(record->trans_gradient, &u_k, &diff,
+                             2 * M_PI / PHI_STRATA * sin_start * cos_start2
+                                 / dist);
+            }
+
+            // the change across the boundary with the previous phi wedge
+            double cos_start = sqrt(1 - (double)j / THETA_STRATA);
+            double cos_end = sqrt(1 - (double)(j + 1) / THETA_STRATA);
+            double cos_center = sqrt(1 - sin_theta * sin_theta);
+            double dist = fmin(distances[j][k], distances[j][prev_k]);
+            struct vec3 diff = vec3_sub(l, &radiances[j][prev_k]);
+            gradient_add(record->trans_gradient, &v_k_start, &diff,
+                         cos_center * (cos_start - cos_end)
+                             / (fmax(sin_theta, 1e-9) * dist));
+        }
+    }
+
+    cache_insert(cache, record);
+}
+
+struct vec3 irradiance_cache_get(struct irradiance_cache *cache,
+                                 const struct scene *scene,
+                                 const struct vec3 *position,
+                                 const struct vec3 *normal,
+                                 irradiance_radiance_f radiance)
+{
+    struct vec3 res;
+    stats_count_irradiance_lookup();
+    if (irradiance_cache_lookup(cache, position, normal, &res))
+    {
+        stats_count_irradiance_hit();
+        return res;
+    }
+
+    struct irradiance_record *record = zalloc(sizeof(*record));
+    record->position = *position;
+    record->normal = *normal;
+    irradiance_cache_compute(cache, record, scene, radiance);
+    return record->irradiance;
+}
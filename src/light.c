@@ -0,0 +1,155 @@
+#include "light.h"
+
+#include <math.h>
+
+static double luminance(const struct vec3 *c)
+{
+    return 0.2126 * c->x + 0.7152 * c->y + 0.0722 * c->z;
+}
+
+double light_power(const struct light *light)
+{
+    double power = light->intensity * luminance(&light->color);
+
+    // a small area light at distance d sends about radiance * area / d^2,
+    // just like a point light with an intensity of radiance * area
+    if (light->type == LIGHT_QUAD)
+    {
+        struct vec3 normal = vec3_cross(&light->edge_u, &light->edge_v);
+        power *= vec3_length(&normal);
+    }
+    else if (light->type == LIGHT_SPHERE)
+    {
+        double radius = light->sphere.radius;
+        power *= M_PI * radius * radius;
+    }
+
+    return power;
+}
+
+void light_bounds(const struct light *light, struct vec3 *min,
+                  struct vec3 *max)
+{
+    *min = light->position;
+    *max = light->position;
+
+    if (light->type == LIGHT_QUAD)
+    {
+        struct vec3 corners[3];
+        corners[0] = vec3_add(&light->position, &light->edge_u);
+        corners[1] = vec3_add(&light->position, &light->edge_v);
+        corners[2] = vec3_add(&corners[0], &light->edge_v);
+        for (size_t i = 0; i < 3; i++)
+        {
+            vec3_update_min_components(min, &corners[i]);
+            vec3_update_max_components(max, &corners[i]);
+        }
+    }
+    else if (light->type == LIGHT_SPHERE)
+    {
+        double r = light->sphere.radius;
+        struct vec3 radius = {r, r, r};
+        *min = vec3_sub(&light->sphere.center, &radius);
+        *max = vec3_add(&light->sphere.center, &radius);
+    }
+}
+
+/*
+** Sample a point of a quad light, uniformly over its area.
+*/
+static bool quad_sample(struct light_sample *sample, const struct light *light,
+                        const struct vec3 *point, double u, double v)
+{
+    struct vec3 offset_u = vec3_mul(&light->edge_u, u);
+    struct vec3 offset_v = vec3_mul(&light->edge_v, v);
+    struct vec3 target = vec3_add(&light->position, &offset_u);
+    target = vec3_add(&target, &offset_v);
+
+    struct vec3 to_light = vec3_sub(&target, point);
+    double distance = vec3_length(&to_light);
+    sample->direction = vec3_mul(&to_light, 1. / distance);
+    sample->distance = distance;
+
+    // only the front side of the quad emits light
+    struct vec3 normal = vec3_cross(&light->edge_u, &light->edge_v);
+    double area = vec3_length(&normal);
+    double cos_light = -vec3_dot(&normal, &sample->direction) / area;
+    if (cos_light <= 0)
+        return false;
+
+    // convert the area density to a solid angle density
+    double solid_angle = cos_light * area / (distance * distance);
+    sample->color = vec3_mul(&light->color, solid_angle);
+    return true;
+}
+
+/*
+** Sample a direction of the cone of directions under which the sphere light
+** is seen, uniformly over its solid angle.
+*/
+static bool sphere_sample(struct light_sample *sample,
+                          const struct light *light, const struct vec3 *point,
+                          double u, double v)
+{
+    const struct sphere *sphere = &light->sphere;
+    struct vec3 to_center = vec3_sub(&sphere->center, point);
+    double center_dist = vec3_length(&to_center);
+    double radius = sphere->radius;
+
+    // points inside the light don't get lit
+    if (center_dist <= radius)
+        return false;
+
+    struct vec3 w = vec3_mul(&to_center, 1. / center_dist);
+    struct vec3 t, b;
+    vec3_make_basis(&w, &t, &b);
+
+    double sin_max2 = (radius * radius) / (center_dist * center_dist);
+    double cos_max = sqrt(1 - sin_max2);
+    double cos_theta = 1 - u * (1 - cos_max);
+    double sin_theta = sqrt(fmax(0, 1 - cos_theta * cos_theta));
+    double phi = 2 * M_PI * v;
+
+    struct vec3 dir_t = vec3_mul(&t, cos(phi) * sin_theta);
+    struct vec3 dir_b = vec3_mul(&b, sin(phi) * sin_theta);
+    struct vec3 dir_w = vec3_mul(&w, cos_theta);
+    sample->direction = vec3_add(&dir_t, &dir_b);
+    sample->direction = vec3_add(&sample->direction, &dir_w);
+
+    // the distance to the near side of the sphere along the direction
+    double sin2 = sin_theta * sin_theta;
+    double chord = radius * radius - center_dist * center_dist * sin2;
+    sample->distance = center_dist * cos_theta - sqrt(fmax(0, chord));
+
+    double solid_angle = 2 * M_PI * (1 - cos_max);
+    sample->color = vec3_mul(&light->color, solid_angle);
+    return true;
+}
+
+bool light_sample(struct light_sample *sample, const struct light *light,
+                  const struct vec3 *point, double u, double v)
+{
+    sample->intensity = light->intensity;
+
+    if (light->type == LIGHT_QUAD)
+        return quad_sample(sample, light, point, u, v);
+    if (light->type == LIGHT_SPHERE)
+        return sphere_sample(sample, light, point, u, v);
+
+    if (light->type == LIGHT_DIRECTIONAL)
+    {
+        sample->direction = light->direction;
+        vec3_neg(&sample->direction);
+        sample->distance = INFINITY;
+        sample->color = light->color;
+        return true;
+    }
+
+    // point lights fall off with the square of the distance
+    struct vec3 to_light = vec3_sub(&light->position, point);
+    double distance = vec3_length(&to_light);
+    sample->direction = vec3_mul(&to_light, 1. / distance);
+    sample->distance = distance;
+    sample->color = vec3_mul(&light->color, 1. / (distance * distance));
+    return true;
+}
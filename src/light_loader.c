@@ -0,0 +1,102 @@
+#include "light_loader.h"
+#include "light.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+** Parse a single light description, and add it to the scene.
+*/
+static int parse_light(struct scene *scene, const char *line)
+{
+    char type[16];
+    int args_offset;
+    if (sscanf(line, "%15s%n", type, &args_offset) != 1)
+        return -1;
+
+    const char *args = line + args_offset;
+    struct vec3 pos;
+    struct vec3 u;
+    struct vec3 v;
+    struct vec3 color;
+    double radius;
+    double intensity;
+    struct light *light;
+
+    if (strcmp(type, "directional") == 0 || strcmp(type, "point") == 0)
+    {
+        int rc = sscanf(args, "%lf %lf %lf %lf %lf %lf %lf", &pos.x, &pos.y,
+                        &pos.z, &color.x, &color.y, &color.z, &intensity);
+        if (rc != 7)
+            return -1;
+
+        if (type[0] == 'd')
+            light = light_create_directional(pos, color, intensity);
+        else
+            light = light_create_point(pos, color, intensity);
+    }
+    else if (strcmp(type, "quad") == 0)
+    {
+        int rc = sscanf(args,
+                        "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+                        &pos.x, &pos.y, &pos.z, &u.x, &u.y, &u.z, &v.x, &v.y,
+                        &v.z, &color.x, &color.y, &color.z, &intensity);
+        if (rc != 13)
+            return -1;
+
+        light = light_create_quad(pos, u, v, color, intensity);
+    }
+    else if (strcmp(type, "sphere") == 0)
+    {
+        int rc = sscanf(args, "%lf %lf %lf %lf %lf %lf %lf %lf", &pos.x,
+                        &pos.y, &pos.z, &radius, &color.x, &color.y, &color.z,
+                        &intensity);
+        if (rc != 8 || radius <= 0)
+            return -1;
+
+        light = light_create_sphere(pos, radius, color, intensity);
+    }
+    else
+        return -1;
+
+    light_vect_push(&scene->lights, light);
+    return 0;
+}
+
+int load_lights(struct scene *scene, const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+    {
+        warn("failed to open the lights file %s", filename);
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t line_number = 0;
+    int rc = 0;
+
+    while (getline(&line, &line_size, fp) != -1)
+    {
+        line_number++;
+
+        // skip blank lines and comments
+        const char *start = line + strspn(line, " \t\r\n");
+        if (*start == '\0' || *start == '#')
+            continue;
+
+        if (parse_light(scene, start) != 0)
+        {
+            warnx("%s:%zu: invalid light", filename, line_number);
+            rc = -1;
+            break;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+    return rc;
+}
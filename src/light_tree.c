@@ -0,0 +1,225 @@
+#include "light_tree.h"
+#include "sampler.h"
+#include "utils/alloc.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// keeps importances finite when a point lies on a light
+#define IMPORTANCE_MIN_DIST2 1e-6
+
+static double vec3_axis(const struct vec3 *v, int axis)
+{
+    if (axis == 0)
+        return v->x;
+    if (axis == 1)
+        return v->y;
+    return v->z;
+}
+
+static double light_centroid(const struct light *light, int axis)
+{
+    struct vec3 min, max;
+    light_bounds(light, &min, &max);
+    return (vec3_axis(&min, axis) + vec3_axis(&max, axis)) / 2;
+}
+
+static int light_compare(const void *a, const void *b, void *axis_p)
+{
+    int axis = *(int *)axis_p;
+    double pa = light_centroid(*(const struct light **)a, axis);
+    double pb = light_centroid(*(const struct light **)b, axis);
+    return (pa > pb) - (pa < pb);
+}
+
+/*
+** Build the subtree for the given lights at the given node index.
+** Returns the index following the last node of the subtree.
+*/
+static size_t build_node(struct light_tree *tree, const struct light **lights,
+                         size_t count, size_t node_i)
+{
+    struct light_tree_node *node = &tree->nodes[node_i];
+    light_bounds(lights[0], &node->bounds_min, &node->bounds_max);
+    node->power = 0;
+    node->right = 0;
+    node->light = NULL;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct vec3 min, max;
+        light_bounds(lights[i], &min, &max);
+        vec3_update_min_components(&node->bounds_min, &min);
+        vec3_update_max_components(&node->bounds_max, &max);
+        node->power += light_power(lights[i]);
+    }
+
+    if (count == 1)
+    {
+        node->light = lights[0];
+        return node_i + 1;
+    }
+
+    // split the lights in two halves, along the largest axis
+    struct vec3 extent = vec3_sub(&node->bounds_max, &node->bounds_min);
+    int axis = 0;
+    if (extent.y > extent.x)
+        axis = 1;
+    if (extent.z > vec3_axis(&extent, axis))
+        axis = 2;
+
+    qsort_r(lights, count, sizeof(*lights), light_compare, &axis);
+
+    size_t half = count / 2;
+    size_t right_i = build_node(tree, lights, half, node_i + 1);
+    node->right = right_i;
+    return build_node(tree, lights + half, count - half, right_i);
+}
+
+void light_tree_build(struct light_tree *tree, struct light_vect *lights)
+{
+    light_tree_destroy(tree);
+
+    size_t count = light_vect_size(lights);
+    const struct light **finite = xcalloc(count + 1, sizeof(*finite));
+    tree->infinite = xcalloc(count + 1, sizeof(*tree->infinite));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct light *light = light_vect_get(lights, i);
+        if (light_is_infinite(light))
+            tree->infinite[tree->infinite_count++] = light;
+        else
+            finite[tree->finite_count++] = light;
+    }
+
+    // a binary tree with n leaves has 2n - 1 nodes
+    if (tree->finite_count != 0)
+    {
+        tree->nodes
+            = xcalloc(2 * tree->finite_count - 1, sizeof(*tree->nodes));
+        build_node(tree, finite, tree->finite_count, 0);
+    }
+
+    free(finite);
+}
+
+void light_tree_destroy(struct light_tree *tree)
+{
+    free(tree->nodes);
+    free(tree->infinite);
+    light_tree_init(tree);
+}
+
+/*
+** An estimate of how much light the node sends to the point: its power,
+** divided by the squared distance to the node. Points inside the bounds
+** use the size of the bounds instead, so nearby clusters aren't overrated.
+*/
+static double node_importance(const struct light_tree_node *node,
+                              const struct vec3 *point)
+{
+    struct vec3 center = vec3_add(&node->bounds_min, &node->bounds_max);
+    center = vec3_mul(&center, 0.5);
+    struct vec3 to_center = vec3_sub(&center, point);
+    double dist2 = vec3_dot(&to_center, &to_center);
+
+    struct vec3 diagonal = vec3_sub(&node->bounds_max, &node->bounds_min);
+    double radius2 = vec3_dot(&diagonal, &diagonal) / 4;
+
+    if (dist2 < radius2)
+        dist2 = radius2;
+    if (dist2 < IMPORTANCE_MIN_DIST2)
+        dist2 = IMPORTANCE_MIN_DIST2;
+    return node->power / dist2;
+}
+
+/*
+** Walk down the hierarchy, randomly picking children by importance.
+** The probability of picking the returned light is stored in pdf.
+*/
+static const struct light *tree_sample(const struct light_tree *tree,
+                                       const struct vec3 *point, double *pdf)
+{
+    size_t node_i = 0;
+    *pdf = 1;
+
+    while (tree->nodes[node_i].right != 0)
+    {
+        size_t left_i = node_i + 1;
+        size_t right_i = tree->nodes[node_i].right;
+        double left = node_importance(&tree->nodes[left_i], point);
+        double right = node_importance(&tree->nodes[right_i], point);
+
+        // lights without any power may still be picked, but rarely
+        double left_prob = 0.5;
+        if (left + right > 0)
+            left_prob = left / (left + right);
+
+        if (sampler_next() < left_prob)
+        {
+            node_i = left_i;
+            *pdf *= left_prob;
+        }
+        else
+        {
+            node_i = right_i;
+            *pdf *= 1 - left_prob;
+        }
+    }
+
+    return tree->nodes[node_i].light;
+}
+
+size_t light_tree_select(const struct light_tree *tree,
+                         const struct vec3 *point, size_t budget,
+                         struct light_choice *choices)
+{
+    size_t total = tree->infinite_count + tree->finite_count;
+    if (budget > LIGHT_SAMPLES_MAX)
+        budget = LIGHT_SAMPLES_MAX;
+
+    // when all lights fit in the budget, there's no need to sample
+    if (total <= budget)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < tree->infinite_count; i++)
+            choices[count++] = (struct light_choice){tree->infinite[i], 1};
+
+        // the finite lights are held by the leaves of the hierarchy
+        size_t nodes_count = 0;
+        if (tree->finite_count != 0)
+            nodes_count = 2 * tree->finite_count - 1;
+        for (size_t node_i = 0; node_i < nodes_count; node_i++)
+            if (tree->nodes[node_i].right == 0)
+                choices[count++]
+                    = (struct light_choice){tree->nodes[node_i].light, 1};
+        return total;
+    }
+
+    // infinite lights and the hierarchy as a whole are picked uniformly
+    size_t strategies = tree->infinite_count + (tree->finite_count != 0);
+    double strategy_prob = 1. / strategies;
+
+    for (size_t i = 0; i < budget; i++)
+    {
+        size_t strategy = sampler_next() * strategies;
+        if (strategy >= strategies)
+            strategy = strategies - 1;
+
+        double pdf = strategy_prob;
+        const struct light *light;
+        if (strategy < tree->infinite_count)
+            light = tree->infinite[strategy];
+        else
+        {
+            double tree_pdf;
+            light = tree_sample(tree, point, &tree_pdf);
+            pdf *= tree_pdf;
+        }
+
+        choices[i] = (struct light_choice){light, 1. / (pdf * budget)};
+    }
+
+    return budget;
+}
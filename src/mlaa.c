@@ -0,0 +1,298 @@
+#include "mlaa.h"
+#include "utils/alloc.h"
+#include "utils/parallel.h"
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the smallest luma difference between two pixels considered as an edge
+#define EDGE_THRESHOLD 0.1f
+
+// the pixel differs from its left neighbor
+#define EDGE_LEFT 1
+// the pixel differs from its top neighbor
+#define EDGE_TOP 2
+
+/*
+** How much of each neighbor a pixel is blended with.
+*/
+struct mlaa_weights
+{
+    float up;
+    float down;
+    float left;
+    float right;
+};
+
+struct mlaa_pass
+{
+    const struct rgb_image *input;
+    const struct gbuffer *gbuffer;
+    uint8_t *edges;
+    struct mlaa_weights *weights;
+    struct rgb_image *output;
+};
+
+static float pixel_luma(struct rgb_pixel pixel)
+{
+    return (0.2126f * pixel.r + 0.7152f * pixel.g + 0.0722f * pixel.b) / 255;
+}
+
+static bool pixels_differ(const struct mlaa_pass *pass, size_t a, size_t b)
+{
+    if (pass->gbuffer != NULL)
+        return pass->gbuffer->data[a].object != pass->gbuffer->data[b].object;
+
+    float luma_a = pixel_luma(pass->input->data[a]);
+    float luma_b = pixel_luma(pass->input->data[b]);
+    return luma_a - luma_b > EDGE_THRESHOLD || luma_b - luma_a > EDGE_THRESHOLD;
+}
+
+static void detect_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct mlaa_pass *pass = data;
+    size_t width = pass->input->width;
+    for (size_t y = y_from; y < y_to; y++)
+        for (size_t x = 0; x < width; x++)
+        {
+            size_t i = y * width + x;
+            uint8_t edges = 0;
+            if (x > 0 && pixels_differ(pass, i - 1, i))
+                edges |= EDGE_LEFT;
+            if (y > 0 && pixels_differ(pass, i - width, i))
+                edges |= EDGE_TOP;
+            pass->edges[i] = edges;
+        }
+}
+
+/*
+** Edges are processed along lines: horizontal edges along the rows, between
+** a row and the one above it, and vertical edges along the columns, between
+** a column and the one left of it. The first side of a line is the row
+** above or the column on the left.
+*/
+static size_t line_pixel(const struct mlaa_pass *pass, bool vertical,
+                         size_t line, size_t pos, bool first_side)
+{
+    size_t width = pass->input->width;
+    if (vertical)
+        return pos * width + line - first_side;
+    return (line - first_side) * width + pos;
+}
+
+static bool line_edge(const struct mlaa_pass *pass, bool vertical, size_t line,
+                      size_t pos)
+{
+    uint8_t edges = pass->edges[line_pixel(pass, vertical, line, pos, false)];
+    return edges & (vertical ? EDGE_LEFT : EDGE_TOP);
+}
+
+/*
+** Find on which side of the line an edge crossing it before pos goes.
+** Returns 1 for the first side, -1 for the second side, and 0 if there is
+** no such edge or it goes both ways.
+*/
+static int line_crossing(const struct mlaa_pass *pass, bool vertical,
+                         size_t line, size_t pos, size_t length)
+{
+    if (pos == 0 || pos == length)
+        return 0;
+
+    uint8_t flag = vertical ? EDGE_TOP : EDGE_LEFT;
+    bool first = pass->edges[line_pixel(pass, vertical, line, pos, true)]
+                 & flag;
+    bool second = pass->edges[line_pixel(pass, vertical, line, pos, false)]
+                  & flag;
+    return first - second;
+}
+
+static void add_weights(struct mlaa_pass *pass, bool vertical, size_t line,
+                        size_t pos, float first_area, float second_area)
+{
+    struct mlaa_weights *first
+        = &pass->weights[line_pixel(pass, vertical, line, pos, true)];
+    struct mlaa_weights *second
+        = &pass->weights[line_pixel(pass, vertical, line, pos, false)];
+    if (vertical)
+    {
+        first->right = first_area;
+        second->left = second_area;
+    }
+    else
+    {
+        first->down = first_area;
+        second->up = second_area;
+    }
+}
+
+/*
+** The signed distance from the edge to the reconstructed silhouette, at a
+** position along a run of edges. Positive distances go to the first side.
+** Z shapes are crossed by a single line, while L and U shapes join the
+** middle of the run.
+*/
+static float run_height(float start, float end, float start_height,
+                        float end_height, float pos)
+{
+    float middle = (start + end) / 2;
+    if (start_height != 0 && end_height != 0 && start_height != end_height)
+        return start_height
+               + (end_height - start_height) * (pos - start) / (end - start);
+    if (pos < middle)
+        return start_height * (middle - pos) / (middle - start);
+    return end_height * (pos - middle) / (end - middle);
+}
+
+/*
+** Compute the blending weights of the pixels on both sides of a run of
+** edges. The silhouette never crosses the edge inside a half of the run,
+** so the area between them is a trapezoid on either side.
+*/
+static void blend_run(struct mlaa_pass *pass, bool vertical, size_t line,
+                      size_t start, size_t end, float start_height,
+                      float end_height)
+{
+    if (start_height == 0 && end_height == 0)
+        return;
+
+    float middle = (start + end) / 2.f;
+    for (size_t pos = start; pos < end; pos++)
+    {
+        float points[3] = {pos, pos + 1, pos + 1};
+        size_t points_count = 2;
+        if (middle > pos && middle < pos + 1)
+        {
+            points[1] = middle;
+            points_count = 3;
+        }
+
+        float first_area = 0;
+        float second_area = 0;
+        for (size_t i = 0; i + 1 < points_count; i++)
+        {
+            float height_a = run_height(start, end, start_height, end_height,
+                                        points[i]);
+            float height_b = run_height(start, end, start_height, end_height,
+                                        points[i + 1]);
+            float area = (points[i + 1] - points[i]) * (height_a + height_b) / 2;
+            if (area > 0)
+                first_area += area;
+            else
+                second_area -= area;
+        }
+        add_weights(pass, vertical, line, pos, first_area, second_area);
+    }
+}
+
+static void process_line(struct mlaa_pass *pass, bool vertical, size_t line)
+{
+    size_t length = vertical ? pass->input->height : pass->input->width;
+    size_t pos = 0;
+    while (pos < length)
+    {
+        if (!line_edge(pass, vertical, line, pos))
+        {
+            pos++;
+            continue;
+        }
+
+        size_t start = pos;
+        while (pos < length && line_edge(pass, vertical, line, pos))
+            pos++;
+
+        float start_height
+            = 0.5f * line_crossing(pass, vertical, line, start, length);
+        float end_height = 0.5f * line_crossing(pass, vertical, line, pos, length);
+        blend_run(pass, vertical, line, start, pos, start_height, end_height);
+    }
+}
+
+static void horizontal_rows(void *data, size_t y_from, size_t y_to)
+{
+    for (size_t y = y_from > 0 ? y_from : 1; y < y_to; y++)
+        process_line(data, false, y);
+}
+
+static void vertical_columns(void *data, size_t x_from, size_t x_to)
+{
+    for (size_t x = x_from > 0 ? x_from : 1; x < x_to; x++)
+        process_line(data, true, x);
+}
+
+static void blend_color(float *res, float weight, struct rgb_pixel pixel)
+{
+    res[0] += weight * pixel.r;
+    res[1] += weight * pixel.g;
+    res[2] += weight * pixel.b;
+}
+
+static void blend_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct mlaa_pass *pass = data;
+    size_t width = pass->input->width;
+    const struct rgb_pixel *input = pass->input->data;
+    for (size_t y = y_from; y < y_to; y++)
+        for (size_t x = 0; x < width; x++)
+        {
+            size_t i = y * width + x;
+            struct mlaa_weights weights = pass->weights[i];
+            float total = weights.up + weights.down + weights.left
+                          + weights.right;
+            if (total == 0)
+            {
+                pass->output->data[i] = input[i];
+                continue;
+            }
+
+            // corners may get blended from both directions
+            float scale = total > 1 ? 1 / total : 1;
+            float res[3] = {0, 0, 0};
+            blend_color(res, 1 - total * scale, input[i]);
+            if (weights.up > 0)
+                blend_color(res, weights.up * scale, input[i - width]);
+            if (weights.down > 0)
+                blend_color(res, weights.down * scale, input[i + width]);
+            if (weights.left > 0)
+                blend_color(res, weights.left * scale, input[i - 1]);
+            if (weights.right > 0)
+                blend_color(res, weights.right * scale, input[i + 1]);
+
+            struct rgb_pixel pixel = {
+                res[0] + 0.5f,
+                res[1] + 0.5f,
+                res[2] + 0.5f,
+            };
+            pass->output->data[i] = pixel;
+        }
+}
+
+void postprocess_mlaa(struct rgb_image *image, const struct gbuffer *gbuffer,
+                      size_t threads)
+{
+    size_t pixels = image->width * image->height;
+    struct rgb_image *input = rgb_image_alloc(image->width, image->height);
+    memcpy(input->data, image->data, pixels * sizeof(*image->data));
+
+    warnx("AA - Applying MLAA%s", gbuffer ? " on object edges" : "");
+
+    struct mlaa_pass pass = {
+        .input = input,
+        .gbuffer = gbuffer,
+        .edges = xcalloc(pixels, sizeof(*pass.edges)),
+        .weights = xcalloc(pixels, sizeof(*pass.weights)),
+        .output = image,
+    };
+    parallel_rows(image->height, threads, detect_rows, &pass);
+    // lines only write the weights of their own edges, so they don't overlap
+    parallel_rows(image->height, threads, horizontal_rows, &pass);
+    parallel_rows(image->width, threads, vertical_columns, &pass);
+    parallel_rows(image->height, threads, blend_rows, &pass);
+
+    free(pass.weights);
+    free(pass.edges);
+    free(input);
+    warnx("AA - Completed MLAA");
+}
@@ -84,6 +84,39 @@ static void get_file_data(const char *filename, const int is_mtl,
 #undef GVECT_NAME
 #undef GVECT_TYPE
 
+/*
+** Load a texture, relative to the directory of the obj file.
+*/
+static const struct texture *load_texture(struct scene *scene,
+                                          const char *obj_filename,
+                                          const char *texname)
+{
+    char *basedirname_buf = strdup(obj_filename);
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dirname(basedirname_buf), texname);
+    free(basedirname_buf);
+
+    return texture_load(&scene->textures, path);
+}
+
+/*
+** Read the texture coordinates of a face. Returns false if some are missing.
+*/
+static bool face_texcoords(const tinyobj_attrib_t *attrib, size_t face_off,
+                           struct texcoord texcoords[3])
+{
+    for (size_t node_i = 0; node_i < 3; node_i++)
+    {
+        int vt_idx = attrib->faces[face_off + node_i].vt_idx;
+        if (vt_idx < 0 || (unsigned int)vt_idx >= attrib->num_texcoords)
+            return false;
+
+        texcoords[node_i].u = attrib->texcoords[2 * vt_idx + 0];
+        texcoords[node_i].v = attrib->texcoords[2 * vt_idx + 1];
+    }
+    return true;
+}
+
 int load_obj(struct scene *scene, const char *filename)
 {
     tinyobj_attrib_t attrib;
@@ -118,6 +151,10 @@ int load_obj(struct scene *scene, const char *filename)
             materials[i].diffuse[2],
         };
         shape_material->surface_color = surface_color;
+        // materials keep their plain color when the texture can't be loaded
+        if (materials[i].diffuse_texname)
+            shape_material->diffuse_texture = load_texture(
+                scene, filename, materials[i].diffuse_texname);
         phong_material_vect_push(&conv_materials, shape_material);
     }
 
@@ -142,6 +179,9 @@ int load_obj(struct scene *scene, const char *filename)
         }
 
         struct triangle *trian = triangle_create(points, &mat->base);
+        struct texcoord texcoords[3];
+        if (mat->diffuse_texture && face_texcoords(&attrib, face_off, texcoords))
+            triangle_set_texcoords(trian, texcoords);
         object_vect_push(&scene->objects, &trian->base);
     }
 
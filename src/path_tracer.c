@@ -0,0 +1,351 @@
+#include "path_tracer.h"
+#include "accum_buffer.h"
+#include "irradiance_cache.h"
+#include "phong_material.h"
+#include "rendering.h"
+#include "sampler.h"
+#include "stats.h"
+
+#include <math.h>
+#include <stdbool.h>
+
+// how far secondary rays start from the surface, to avoid self-intersection
+#define PATH_EPSILON 1e-6
+// the smallest error worth refining, a fraction of a display level
+#define PATH_ERROR_FLOOR (0.5 / 255)
+
+/*
+** The Phong material as a BRDF: a lambertian diffuse lobe reflecting
+** diffuse_Kn of the color, and a normalized Phong specular lobe around the
+** mirror direction. Neither reflects more light than it receives.
+*/
+static struct vec3 brdf_diffuse(const struct phong_material *mat)
+{
+    return vec3_mul(&mat->surface_color, mat->diffuse_Kn / M_PI);
+}
+
+static double brdf_specular(const struct phong_material *mat,
+                            const struct vec3 *mirror, const struct vec3 *wi)
+{
+    double cos_alpha = vec3_dot(mirror, wi);
+    if (cos_alpha <= 0)
+        return 0;
+    return mat->spec_Ks * (mat->spec_n + 2) / (2 * M_PI)
+           * pow(cos_alpha, mat->spec_n);
+}
+
+static struct vec3 brdf_eval(const struct phong_material *mat,
+                             const struct vec3 *mirror, const struct vec3 *wi)
+{
+    struct vec3 res = brdf_diffuse(mat);
+    double spec = brdf_specular(mat, mirror, wi);
+    struct vec3 spec_color = {spec, spec, spec};
+    return vec3_add(&res, &spec_color);
+}
+
+/*
+** The probability of sampling the specular lobe instead of the diffuse one.
+*/
+static double specular_prob(const struct phong_material *mat)
+{
+    double diffuse_albedo
+        = mat->diffuse_Kn * color_luminance(&mat->surface_color);
+    if (mat->spec_Ks + diffuse_albedo <= 0)
+        return 0;
+    return mat->spec_Ks / (mat->spec_Ks + diffuse_albedo);
+}
+
+/*
+** The density of sampling wi, combining both lobes.
+*/
+static double brdf_pdf(const struct phong_material *mat,
+                       const struct vec3 *normal, const struct vec3 *mirror,
+                       const struct vec3 *wi)
+{
+    double spec_prob = specular_prob(mat);
+    double cos_theta = vec3_dot(normal, wi);
+    double pdf = (1 - spec_prob) * fmax(0, cos_theta) / M_PI;
+
+    double cos_alpha = vec3_dot(mirror, wi);
+    if (cos_alpha > 0)
+        pdf += spec_prob * (mat->spec_n + 1) / (2 * M_PI)
+               * pow(cos_alpha, mat->spec_n);
+    return pdf;
+}
+
+/*
+** Build a direction from spherical coordinates around the axis.
+*/
+static struct vec3 direction_around(const struct vec3 *axis, double cos_theta,
+                                    double phi)
+{
+    struct vec3 t, b;
+    vec3_make_basis(axis, &t, &b);
+
+    double sin_theta = sqrt(fmax(0, 1 - cos_theta * cos_theta));
+    struct vec3 dir_t = vec3_mul(&t, cos(phi) * sin_theta);
+    struct vec3 dir_b = vec3_mul(&b, sin(phi) * sin_theta);
+    struct vec3 dir_a = vec3_mul(axis, cos_theta);
+    struct vec3 res = vec3_add(&dir_t, &dir_b);
+    return vec3_add(&res, &dir_a);
+}
+
+/*
+** Pick the direction the path continues in, and update its throughput.
+** Returns false when the path should stop.
+*/
+static bool brdf_sample(const struct phong_material *mat,
+                        const struct vec3 *normal, const struct vec3 *mirror,
+                        struct vec3 *wi, struct vec3 *throughput)
+{
+    double u, v;
+    sampler_next_2d(&u, &v);
+    double phi = 2 * M_PI * v;
+
+    if (sampler_next() < specular_prob(mat))
+        *wi = direction_around(mirror, pow(u, 1 / (mat->spec_n + 1)), phi);
+    else
+        *wi = direction_around(normal, sqrt(1 - u), phi);
+
+    double cos_theta = vec3_dot(normal, wi);
+    if (cos_theta <= 0)
+        return false;
+
+    double pdf = brdf_pdf(mat, normal, mirror, wi);
+    if (pdf <= 0)
+        return false;
+
+    struct vec3 f = brdf_eval(mat, mirror, wi);
+    struct vec3 weight = vec3_mul(&f, cos_theta / pdf);
+    *throughput = vec3_mul_vec(throughput, &weight);
+    return true;
+}
+
+/*
+** Like brdf_sample, but only samples the specular lobe, for when the diffuse
+** lobe is handled separately.
+*/
+static bool specular_sample(const struct phong_material *mat,
+                            const struct vec3 *normal,
+                            const struct vec3 *mirror, struct vec3 *wi,
+                            struct vec3 *throughput)
+{
+    if (mat->spec_Ks <= 0)
+        return false;
+
+    double u, v;
+    sampler_next_2d(&u, &v);
+    double cos_alpha = pow(u, 1 / (mat->spec_n + 1));
+    *wi = direction_around(mirror, cos_alpha, 2 * M_PI * v);
+
+    double cos_theta = vec3_dot(normal, wi);
+    if (cos_theta <= 0)
+        return false;
+
+    // most of the lobe and its density cancel out
+    double weight
+        = mat->spec_Ks * (mat->spec_n + 2) / (mat->spec_n + 1) * cos_theta;
+    *throughput = vec3_mul(throughput, weight);
+    return true;
+}
+
+/*
+** Next event estimation: directly sample lights from the path vertex.
+*/
+static struct vec3 sample_lights(const struct phong_material *mat,
+                                 const struct intersection *inter,
+                                 const struct vec3 *mirror,
+                                 const struct scene *scene)
+{
+    struct light_choice lights[LIGHT_SAMPLES_MAX];
+    size_t lights_count = light_tree_select(
+        &scene->light_tree, &inter->point, scene->light_samples, lights);
+
+    struct vec3 res = {0};
+    for (size_t i = 0; i < lights_count; i++)
+    {
+        double u, v;
+        sampler_next_2d(&u, &v);
+        struct light_sample sample;
+        if (!light_sample(&sample, lights[i].light, &inter->point, u, v))
+            continue;
+
+        double cos_theta = vec3_dot(&inter->normal, &sample.direction);
+        if (cos_theta <= 0)
+            continue;
+
+        struct vec3 offset = vec3_mul(&inter->normal, PATH_EPSILON);
+        struct ray shadow_ray = {
+            .source = vec3_add(&inter->point, &offset),
+            .direction = sample.direction,
+        };
+
+        stats_count_shadow_ray();
+        if (scene_occluded(scene, &shadow_ray, sample.distance))
+            continue;
+
+        // the Phong shader lights surfaces with diffuse_Kn of the light
+        // intensity, which takes pi times the intensity with the normalized
+        // diffuse lobe, the specular lobe is already normalized
+        struct vec3 diffuse = brdf_diffuse(mat);
+        struct vec3 f = vec3_mul(&diffuse, M_PI);
+        double spec = brdf_specular(mat, mirror, &sample.direction);
+        struct vec3 spec_color = {spec, spec, spec};
+        f = vec3_add(&f, &spec_color);
+        struct vec3 light = vec3_mul(
+            &sample.color, sample.intensity * cos_theta * lights[i].weight);
+        struct vec3 contribution = vec3_mul_vec(&f, &light);
+        res = vec3_add(&res, &contribution);
+    }
+
+    return res;
+}
+
+static struct vec3 record_radiance(const struct scene *scene,
+                                   const struct ray *ray, double *distance);
+
+/*
+** Estimate the light coming back along the ray.
+** The normal and distance of the first hit are stored for post processing.
+** When use_cache is set, the diffuse indirect lighting of the first hit comes
+** from the irradiance cache.
+*/
+static struct vec3 trace_path(const struct scene *scene, struct ray ray,
+                              struct vec3 *first_normal, double *first_depth,
+                              bool use_cache)
+{
+    *first_normal = (struct vec3){0};
+    *first_depth = ACCUM_FAR_DEPTH;
+
+    struct vec3 radiance = {0};
+    struct vec3 throughput = {1, 1, 1};
+
+    for (size_t depth = 0; depth < PATH_MAX_DEPTH; depth++)
+    {
+        struct object_intersection hit;
+        // paths escaping the scene don't bring any light
+        double hit_dist = scene_intersect_ray(&hit, scene, &ray);
+        if (isinf(hit_dist))
+            break;
+
+        if (depth == 0)
+        {
+            *first_normal = hit.location.normal;
+            *first_depth = hit_dist;
+        }
+
+        const struct intersection *inter = &hit.location;
+        // shade using the color of the texture at this point
+        struct phong_material textured_mat
+            = *(const struct phong_material *)hit.material;
+        textured_mat.surface_color
+            = phong_material_color(&textured_mat, inter, &ray);
+        const struct phong_material *mat = &textured_mat;
+        struct vec3 mirror = vec3_reflect(&ray.direction, &inter->normal);
+
+        struct vec3 direct = sample_lights(mat, inter, &mirror, scene);
+        direct = vec3_mul_vec(&direct, &throughput);
+        radiance = vec3_add(&radiance, &direct);
+
+        struct vec3 wi;
+        if (depth == 0 && use_cache)
+        {
+            struct vec3 irradiance = irradiance_cache_get(
+                scene->irradiance_cache, scene, &inter->point, &inter->normal,
+                record_radiance);
+            struct vec3 diffuse = brdf_diffuse(mat);
+            diffuse = vec3_mul_vec(&diffuse, &irradiance);
+            radiance = vec3_add(&radiance, &diffuse);
+
+            // only reflections are left to trace
+            if (!specular_sample(mat, &inter->normal, &mirror, &wi,
+                                 &throughput))
+                break;
+
+            struct vec3 offset = vec3_mul(&inter->normal, PATH_EPSILON);
+            ray.cone_width = ray_cone_width(&ray, &inter->point);
+            ray.source = vec3_add(&inter->point, &offset);
+            ray.direction = wi;
+            continue;
+        }
+
+        // randomly stop paths which don't carry much light anymore
+        if (depth >= PATH_ROULETTE_DEPTH)
+        {
+            double survival = fmax(throughput.x, fmax(throughput.y,
+                                                      throughput.z));
+            if (survival < 1)
+            {
+                if (sampler_next() >= survival)
+                    break;
+                throughput = vec3_mul(&throughput, 1 / survival);
+            }
+        }
+
+        if (!brdf_sample(mat, &inter->normal, &mirror, &wi, &throughput))
+            break;
+
+        struct vec3 offset = vec3_mul(&inter->normal, PATH_EPSILON);
+        ray.cone_width = ray_cone_width(&ray, &inter->point);
+        ray.source = vec3_add(&inter->point, &offset);
+        ray.direction = wi;
+    }
+
+    return radiance;
+}
+
+/*
+** The radiance used to compute irradiance records, traced without the cache.
+*/
+static struct vec3 record_radiance(const struct scene *scene,
+                                   const struct ray *ray, double *distance)
+{
+    struct vec3 normal;
+    struct vec3 res = trace_path(scene, *ray, &normal, distance, false);
+    if (*distance >= ACCUM_FAR_DEPTH)
+        *distance = INFINITY;
+    return res;
+}
+
+/*
+** Tells whether the pixel estimate is known precisely enough.
+*/
+static bool pixel_converged(const struct accum_pixel *pixel, double max_error)
+{
+    double threshold = fmax(max_error * pixel->lum_mean, PATH_ERROR_FLOOR);
+    return accum_pixel_error(pixel) <= threshold;
+}
+
+static void render_path(struct rgb_image *image, const struct render_ctx *ctx,
+                        size_t x, size_t y)
+{
+    const struct scene *scene = ctx->scene;
+    struct accum_pixel *pixel = accum_buffer_get(scene->accum, x, y);
+
+    // most pixels converge after a few samples, only the noisiest
+    // ones go all the way
+    while (pixel->samples < scene->path_samples_max)
+    {
+        if (pixel->samples >= scene->path_samples_min
+            && pixel_converged(pixel, scene->path_error))
+            break;
+
+        double u, v;
+        sampler_get_2d(x, y, pixel->samples, scene->path_samples_max,
+                       SAMPLER_DIM_PIXEL, &u, &v);
+        sampler_start(x, y, pixel->samples, scene->path_samples_max);
+        struct ray ray
+            = image_cast_ray(image, ctx, x + u - 0.5, y + v - 0.5);
+        struct vec3 normal;
+        double depth;
+        struct vec3 color = trace_path(scene, ray, &normal, &depth,
+                                       scene->irradiance_cache != NULL);
+        accum_pixel_add(pixel, &color, &normal, depth);
+        stats_count_path_sample();
+    }
+
+    struct vec3 color = accum_pixel_color(pixel);
+    rgb_image_set(image, x, y, rgb_color_from_light(&color));
+}
+
+const struct render_mode path_render_mode = {render_path, NULL};
@@ -1,49 +1,202 @@
 #include "phong_material.h"
+#include "sampler.h"
 #include "scene.h"
+#include "stats.h"
 
 #define MAX_DEPTH 2
 
-double scene_intersect_ray(struct object_intersection *closest_intersection,
-                           const struct scene *scene, struct ray *ray);
+// how far shadow rays start from the surface, to avoid self-shadowing
+#define SHADOW_EPSILON 1e-6
+// limits how much grazing angles stretch the footprint of rays on textures
+#define MIN_FOOTPRINT_COS 0.05
 
-struct vec3 phong_metarial_shade(const struct material *base_material,
+struct vec3 phong_material_color(const struct phong_material *mat,
                                  const struct intersection *inter,
-                                 const struct scene *scene,
-                                 const struct ray *ray, size_t depth)
+                                 const struct ray *ray)
 {
-    const struct phong_material *mat
-        = (const struct phong_material *)base_material;
+    if (mat->diffuse_texture == NULL)
+        return mat->surface_color;
 
-    // a coefficient teaking how much diffuse light to add
-    struct vec3 light = vec3_mul(&scene->light_color, scene->light_intensity);
-    struct vec3 diffuse_light_color = vec3_mul_vec(&light, &mat->surface_color);
+    // the cone of the ray covers a wider area at grazing angles
+    double width = ray_cone_width(ray, &inter->point);
+    double cos_theta = fabs(vec3_dot(&inter->normal, &ray->direction));
+    width /= fmax(cos_theta, MIN_FOOTPRINT_COS);
+
+    struct vec3 texel = texture_sample(mat->diffuse_texture, inter->u,
+                                       inter->v, width * inter->uv_scale);
+    return vec3_mul_vec(&texel, &mat->surface_color);
+}
+
+/*
+** Tells whether the light is blocked before reaching the point.
+*/
+static bool in_shadow(const struct intersection *inter,
+                      const struct scene *scene,
+                      const struct light_sample *light)
+{
+    stats_count_shadow_ray();
+
+    struct vec3 offset = vec3_mul(&inter->normal, SHADOW_EPSILON);
+    struct ray shadow_ray = {
+        .source = vec3_add(&inter->point, &offset),
+        .direction = light->direction,
+    };
+
+    // only objects between the point and the light block it
+    return scene_occluded(scene, &shadow_ray, light->distance);
+}
 
+/*
+** Compute the diffuse and specular lighting a light sample brings to a point.
+** lit tells whether the sample actually reached the point.
+*/
+static struct vec3 sample_contribution(const struct phong_material *mat,
+                                       const struct intersection *inter,
+                                       const struct scene *scene,
+                                       const struct ray *ray,
+                                       const struct light_sample *sample,
+                                       bool *lit)
+{
     // compute the diffuse lighting contribution by applying the cosine
-    // law
-    double diffuse_intensity
-        = -vec3_dot(&inter->normal, &scene->light_direction);
-    if (diffuse_intensity < 0)
-        diffuse_intensity = 0;
+    // law. surfaces facing away from the light can't see it, and don't need
+    // a shadow ray
+    double diffuse_intensity = vec3_dot(&inter->normal, &sample->direction);
+    *lit = diffuse_intensity > 0 && !in_shadow(inter, scene, sample);
+    if (!*lit)
+        return (struct vec3){0};
+
+    // a coefficient teaking how much diffuse light to add
+    struct vec3 light = vec3_mul(&sample->color, sample->intensity);
+    struct vec3 diffuse_light_color = vec3_mul_vec(&light, &mat->surface_color);
 
     struct vec3 diffuse_contribution
         = vec3_mul(&diffuse_light_color, diffuse_intensity * mat->diffuse_Kn);
 
     // compute the specular reflection contribution
-
+    struct vec3 light_direction = sample->direction;
+    vec3_neg(&light_direction);
     struct vec3 light_reflection_dir
-        = vec3_reflect(&scene->light_direction, &inter->normal);
-    struct vec3 specular_contribution = {0};
+        = vec3_reflect(&light_direction, &inter->normal);
+
     // computes how much the reflection goes in the direction of the
     // camera
     double light_reflection_proj
         = -vec3_dot(&light_reflection_dir, &ray->direction);
-    if (light_reflection_proj < 0.0)
-        light_reflection_proj = 0.0;
-    else
+    if (light_reflection_proj <= 0.0)
+        return diffuse_contribution;
+
+    double spec_coeff = pow(light_reflection_proj, mat->spec_n) * mat->spec_Ks;
+    struct vec3 specular_contribution = vec3_mul(&sample->color, spec_coeff);
+    return vec3_add(&diffuse_contribution, &specular_contribution);
+}
+
+/*
+** Sample an area light using a grid of grid_size x grid_size strata, with
+** a random point in each. Contributions are added to sum, and the number
+** of samples which reached the point to lit_count.
+*/
+static void area_light_pass(const struct phong_material *mat,
+                            const struct intersection *inter,
+                            const struct scene *scene, const struct ray *ray,
+                            const struct light *light, size_t grid_size,
+                            struct vec3 *sum, size_t *lit_count)
+{
+    for (size_t i = 0; i < grid_size; i++)
+    {
+        for (size_t j = 0; j < grid_size; j++)
+        {
+            double u, v;
+            sampler_next_2d(&u, &v);
+            u = (i + u) / grid_size;
+            v = (j + v) / grid_size;
+
+            struct light_sample sample;
+            if (!light_sample(&sample, light, &inter->point, u, v))
+                continue;
+
+            bool lit;
+            struct vec3 contribution
+                = sample_contribution(mat, inter, scene, ray, &sample, &lit);
+            *sum = vec3_add(sum, &contribution);
+            *lit_count += lit;
+        }
+    }
+}
+
+/*
+** The side of the largest grid of strata holding at most count samples.
+*/
+static size_t grid_size(size_t count)
+{
+    size_t size = sqrt(count);
+    return size ? size : 1;
+}
+
+/*
+** Compute the lighting a single light brings to a point.
+** Area lights start with a few shadow rays, and only get more when they
+** don't agree on whether the light is visible, which happens in penumbras.
+*/
+static struct vec3 light_contribution(const struct phong_material *mat,
+                                      const struct intersection *inter,
+                                      const struct scene *scene,
+                                      const struct ray *ray,
+                                      const struct light *light)
+{
+    if (!light_is_area(light))
+    {
+        struct light_sample sample;
+        bool lit;
+        if (!light_sample(&sample, light, &inter->point, 0, 0))
+            return (struct vec3){0};
+        return sample_contribution(mat, inter, scene, ray, &sample, &lit);
+    }
+
+    struct vec3 sum = {0};
+    size_t lit_count = 0;
+    size_t first_grid = grid_size(scene->area_samples_min);
+    size_t samples = first_grid * first_grid;
+    area_light_pass(mat, inter, scene, ray, light, first_grid, &sum,
+                    &lit_count);
+
+    // add a denser grid in penumbras
+    size_t refine_grid = grid_size(scene->area_samples_penumbra);
+    if (lit_count != 0 && lit_count != samples
+        && scene->area_samples_penumbra != 0)
+    {
+        area_light_pass(mat, inter, scene, ray, light, refine_grid, &sum,
+                        &lit_count);
+        samples += refine_grid * refine_grid;
+    }
+
+    return vec3_mul(&sum, 1. / samples);
+}
+
+struct vec3 phong_metarial_shade(const struct material *base_material,
+                                 const struct intersection *inter,
+                                 const struct scene *scene,
+                                 const struct ray *ray, size_t depth)
+{
+    const struct phong_material *base_mat
+        = (const struct phong_material *)base_material;
+
+    // shade using the color of the texture at this point
+    struct phong_material textured_mat = *base_mat;
+    textured_mat.surface_color = phong_material_color(base_mat, inter, ray);
+    const struct phong_material *mat = &textured_mat;
+
+    // pick the lights which matter the most for this point
+    struct light_choice lights[LIGHT_SAMPLES_MAX];
+    size_t lights_count = light_tree_select(
+        &scene->light_tree, &inter->point, scene->light_samples, lights);
+
+    struct vec3 direct_contribution = {0};
+    for (size_t i = 0; i < lights_count; i++)
     {
-        double spec_coeff
-            = pow(light_reflection_proj, mat->spec_n) * mat->spec_Ks;
-        specular_contribution = vec3_mul(&scene->light_color, spec_coeff);
+        struct vec3 contribution
+            = light_contribution(mat, inter, scene, ray, lights[i].light);
+        contribution = vec3_mul(&contribution, lights[i].weight);
+        direct_contribution = vec3_add(&direct_contribution, &contribution);
     }
 
     double ambient_intensity = 0.2;
@@ -52,13 +205,14 @@ struct vec3 phong_metarial_shade(const struct material *base_material,
 
     struct vec3 pix_color = {0};
     pix_color = vec3_add(&pix_color, &ambient_contribution);
-    pix_color = vec3_add(&pix_color, &diffuse_contribution);
-    pix_color = vec3_add(&pix_color, &specular_contribution);
+    pix_color = vec3_add(&pix_color, &direct_contribution);
 
     // Create a new ray that has ben reflected
     struct ray reflexion
         = {.source = inter->point,
-           .direction = vec3_reflect(&ray->direction, &inter->normal)};
+           .direction = vec3_reflect(&ray->direction, &inter->normal),
+           .cone_width = ray_cone_width(ray, &inter->point),
+           .cone_spread = ray->cone_spread};
 
     // The new ray intersection
     struct object_intersection new_intersection;
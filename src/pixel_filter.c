@@ -0,0 +1,39 @@
+#include "pixel_filter.h"
+
+#include <math.h>
+
+// the standard deviation of the gaussian filter, in pixels
+#define GAUSSIAN_SIGMA 0.5
+
+double pixel_filter_radius(enum pixel_filter filter)
+{
+    if (filter == PIXEL_FILTER_TENT)
+        return 1;
+    else if (filter == PIXEL_FILTER_GAUSSIAN)
+        return 1.5;
+    return 0.5;
+}
+
+static double gaussian(double d)
+{
+    return exp(-d * d / (2 * GAUSSIAN_SIGMA * GAUSSIAN_SIGMA));
+}
+
+/*
+** The weight along one axis.
+*/
+static double filter_1d(enum pixel_filter filter, double d)
+{
+    double radius = pixel_filter_radius(filter);
+    if (filter == PIXEL_FILTER_TENT)
+        return fmax(0, 1 - fabs(d) / radius);
+    // shifted so the weight gets to zero at the radius
+    else if (filter == PIXEL_FILTER_GAUSSIAN)
+        return fmax(0, gaussian(d) - gaussian(radius));
+    return 1;
+}
+
+double pixel_filter_weight(enum pixel_filter filter, double dx, double dy)
+{
+    return filter_1d(filter, dx) * filter_1d(filter, dy);
+}
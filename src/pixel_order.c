@@ -0,0 +1,119 @@
+#include "pixel_order.h"
+#include "utils/alloc.h"
+
+#include <string.h>
+
+static enum pixel_order pixel_order = ORDER_SCANLINE;
+
+enum pixel_order select_order_opt(const char *option)
+{
+    if (strcmp(option, "=scanline") == 0)
+        return ORDER_SCANLINE;
+    else if (strcmp(option, "=morton") == 0)
+        return ORDER_MORTON;
+    else if (strcmp(option, "=hilbert") == 0)
+        return ORDER_HILBERT;
+    return ORDER_UNKNOWN;
+}
+
+void pixel_order_init(enum pixel_order order)
+{
+    pixel_order = order;
+}
+
+/*
+** The even bits of a Morton index, packed
+*/
+static uint32_t compact_bits(uint64_t x)
+{
+    x &= 0x5555555555555555;
+    x = (x | (x >> 1)) & 0x3333333333333333;
+    x = (x | (x >> 2)) & 0x0f0f0f0f0f0f0f0f;
+    x = (x | (x >> 4)) & 0x00ff00ff00ff00ff;
+    x = (x | (x >> 8)) & 0x0000ffff0000ffff;
+    x = (x | (x >> 16)) & 0x00000000ffffffff;
+    return x;
+}
+
+static struct pixel_pos morton_pos(uint64_t index)
+{
+    return (struct pixel_pos){compact_bits(index), compact_bits(index >> 1)};
+}
+
+/*
+** The position of the index-th cell of the Hilbert curve filling a square
+** of the given side, a power of two
+*/
+static struct pixel_pos hilbert_pos(uint64_t side, uint64_t index)
+{
+    uint64_t x = 0;
+    uint64_t y = 0;
+    for (uint64_t s = 1; s < side; s *= 2)
+    {
+        uint64_t rx = 1 & (index / 2);
+        uint64_t ry = 1 & (index ^ rx);
+        // rotate the quadrant so that the sub-curves connect
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            uint64_t tmp = x;
+            x = y;
+            y = tmp;
+        }
+        x += s * rx;
+        y += s * ry;
+        index /= 4;
+    }
+    return (struct pixel_pos){x, y};
+}
+
+static struct pixel_pos curve_pos(uint64_t side, uint64_t index)
+{
+    if (pixel_order == ORDER_MORTON)
+        return morton_pos(index);
+    return hilbert_pos(side, index);
+}
+
+struct pixel_pos *pixel_order_build(size_t width, size_t height)
+{
+    if (pixel_order == ORDER_SCANLINE || width == 0 || height == 0)
+        return NULL;
+
+    // curves fill the power of two square around the grid
+    uint64_t side = 1;
+    while (side < width || side < height)
+        side *= 2;
+
+    struct pixel_pos *res = xalloc(width * height * sizeof(*res));
+    size_t count = 0;
+    for (uint64_t index = 0; count < width * height;)
+    {
+        struct pixel_pos pos = curve_pos(side, index);
+        if (pos.x < width && pos.y < height)
+        {
+            res[count++] = pos;
+            index++;
+            continue;
+        }
+
+        // both curves fill aligned squares of side 2^k with runs of 4^k
+        // cells, so the largest such square starting here and lying out
+        // of the grid is skipped at once
+        uint64_t run = 1;
+        uint64_t run_side = 1;
+        while (index % (4 * run) == 0 && 2 * run_side <= side)
+        {
+            uint64_t mask = ~(2 * run_side - 1);
+            if ((pos.x & mask) < width && (pos.y & mask) < height)
+                break;
+            run *= 4;
+            run_side *= 2;
+        }
+        index += run;
+    }
+    return res;
+}
@@ -9,7 +9,10 @@
 #include "obj_loader.h"
 #include "phong_material.h"
 #include "rendering.h"
+#include "sampler.h"
 #include "runners/run_multi.h"
+#include "runners/run_progressive.h"
+#include "runners/run_realtime.h"
 #include "runners/run_single.h"
 #include "scene.h"
 #include "sphere.h"
@@ -17,7 +20,175 @@
 #include "vec3.h"
 
 // Number of runners
-#define RUNNERS_NB 4
+#define RUNNERS_NB 5
+
+struct ray image_cast_ray(const struct rgb_image *image,
+                          const struct render_ctx *ctx, double x, double y)
+{
+    const struct camera *camera = &ctx->scene->camera;
+    // find the position of the current pixel in the image plane
+    // camera_cast_ray takes camera relative positions, from -0.5 to 0.5 for
+    // both axis
+    double cam_x = (x / image->width) - 0.5;
+    double cam_y = (y / image->height) - 0.5;
+
+    // find the starting point and direction of this ray
+    struct ray ray;
+    camera_view_cast_ray(&ray, &ctx->view, camera, cam_x, cam_y);
+
+    // the cone of the ray covers a pixel
+    ray.cone_width = 0;
+    ray.cone_spread = camera->height / image->height / camera->focal_distance;
+    return ray;
+}
+
+void image_cast_rays(const struct rgb_image *image,
+                     const struct render_ctx *ctx, size_t x, size_t y,
+                     size_t count, struct ray *rays)
+{
+    const struct camera *camera = &ctx->scene->camera;
+    // the ray of pixel x + i leaves the image plane i steps right of the
+    // one of pixel x
+    struct ray first = image_cast_ray(image, ctx, x, y);
+    struct vec3 step
+        = vec3_mul(&ctx->view.right, camera->width / image->width);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct vec3 offset = vec3_mul(&step, i);
+        rays[i] = first;
+        rays[i].source = vec3_add(&first.source, &offset);
+        rays[i].direction
+            = vec3_sub(&rays[i].source, &ctx->view.vantage_point);
+        vec3_normalize(&rays[i].direction);
+    }
+}
+
+/*
+** Take several samples around the center of the pixel, (x, y), weighted by
+** the filter of the scene. The first sample gives the geometry of the pixel.
+*/
+static void filter_samples(struct render_sample *res,
+                           const struct rgb_image *image,
+                           const struct render_ctx *ctx,
+                           render_sample_f sample, size_t x, size_t y)
+{
+    const struct scene *scene = ctx->scene;
+    double radius = pixel_filter_radius(scene->pixel_filter);
+    struct vec3 sum = {0};
+    double weight_sum = 0;
+
+    for (size_t i = 0; i < scene->pixel_samples; i++)
+    {
+        // stratified positions over the footprint of the filter
+        double u, v;
+        sampler_get_2d(x, y, i, scene->pixel_samples, SAMPLER_DIM_PIXEL, &u,
+                       &v);
+        sampler_start(x, y, i, scene->pixel_samples);
+        double dx = (2 * u - 1) * radius;
+        double dy = (2 * v - 1) * radius;
+
+        struct render_sample cur;
+        sample(&cur, image, ctx, x + dx, y + dy);
+        if (i == 0)
+            *res = cur;
+
+        double weight = pixel_filter_weight(scene->pixel_filter, dx, dy);
+        struct vec3 color = vec3_mul(&cur.color, weight);
+        sum = vec3_add(&sum, &color);
+        weight_sum += weight;
+    }
+
+    res->color = (struct vec3){0};
+    if (weight_sum > 0)
+        res->color = vec3_mul(&sum, 1 / weight_sum);
+}
+
+void render_pixel(struct rgb_image *image, const struct render_ctx *ctx,
+                  render_sample_f sample, size_t x, size_t y)
+{
+    const struct scene *scene = ctx->scene;
+    struct render_sample res;
+    if (scene->pixel_samples > 1)
+        filter_samples(&res, image, ctx, sample, x, y);
+    else
+    {
+        sampler_start(x, y, 0, 1);
+        sample(&res, image, ctx, x, y);
+    }
+
+    if (scene->gbuffer != NULL)
+    {
+        struct gbuffer_pixel *pixel = gbuffer_get(scene->gbuffer, x, y);
+        pixel->object = res.object;
+        pixel->depth = res.depth;
+        pixel->normal = res.normal;
+    }
+
+    // the background is left as is, unless samples hit some objects
+    if (res.object != NULL || scene->pixel_samples > 1)
+        rgb_image_set(image, x, y, rgb_color_from_light(&res.color));
+}
+
+void render_ctx_init(struct render_ctx *ctx, struct scene *scene,
+                     const struct render_mode *renderer, const uint8_t *mask,
+                     size_t tile_size)
+{
+    *ctx = (struct render_ctx){
+        .scene = scene,
+        .renderer = renderer,
+        .mask = mask,
+        .order = pixel_order_build(tile_size, tile_size),
+        .order_side = tile_size,
+    };
+    camera_view_init(&ctx->view, &scene->camera);
+}
+
+void render_ctx_destroy(struct render_ctx *ctx)
+{
+    free(ctx->order);
+    ctx->order = NULL;
+}
+
+void render_tile(const struct render_ctx *ctx, size_t x0, size_t y0, size_t w,
+                 size_t h, struct rgb_image *out)
+{
+    size_t x_to = x0 + w;
+    size_t y_to = y0 + h;
+    if (x_to > out->width)
+        x_to = out->width;
+    if (y_to > out->height)
+        y_to = out->height;
+
+    if (ctx->renderer->tile != NULL)
+    {
+        if (x0 < x_to && y0 < y_to)
+            ctx->renderer->tile(out, ctx, x0, y0, x_to, y_to);
+        return;
+    }
+
+    const uint8_t *mask = ctx->mask;
+    const struct pixel_pos *order = ctx->order;
+    render_pixel_f pixel = ctx->renderer->pixel;
+    if (order == NULL || w > ctx->order_side || h > ctx->order_side)
+    {
+        for (size_t y = y0; y < y_to; y++)
+            for (size_t x = x0; x < x_to; x++)
+                if (mask == NULL || mask[y * out->width + x])
+                    pixel(out, ctx, x, y);
+        return;
+    }
+
+    // The order covers whole tiles, which the image may cut
+    size_t count = ctx->order_side * ctx->order_side;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t x = x0 + order[i].x;
+        size_t y = y0 + order[i].y;
+        if (x < x_to && y < y_to && (mask == NULL || mask[y * out->width + x]))
+            pixel(out, ctx, x, y);
+    }
+}
 
 /*
 ** Get runner type from options parser
@@ -26,6 +197,8 @@ enum runner_type get_runner_opt(char *input)
 {
     if (strcmp(input, "=realtime") == 0)
         return RUNNER_REALTIME;
+    else if (strcmp(input, "=progressive") == 0)
+        return RUNNER_PROGRESSIVE;
     else if (strcmp(input, "=mt") == 0)
         return RUNNER_MULTITHREADED;
     else if (strcmp(input, "=single") == 0)
@@ -41,7 +214,8 @@ enum runner_type get_runner_opt(char *input)
 static char *runner_str(enum runner_type runner)
 {
     char *runners[RUNNERS_NB]
-        = {"SINGLETHREADED", "MULTI-THREADED", "REALTIME", "UNKNOWN"};
+        = {"SINGLETHREADED", "MULTI-THREADED", "REALTIME", "PROGRESSIVE",
+           "UNKNOWN"};
     return runners[(int)runner];
 }
 
@@ -49,18 +223,20 @@ static char *runner_str(enum runner_type runner)
 ** Run the renderer
 */
 int run_renderer(struct rgb_image *image, struct scene *scene,
-                 enum runner_type runner, render_mode_f renderer,
-                 size_t threads)
+                 enum runner_type runner, const struct render_mode *renderer,
+                 const struct runner_options *options)
 {
     // Logging
     warnx("Using '%s' runner.", runner_str(runner));
 
     if (runner == RUNNER_SINGLETHREADED)
-        return runner_singlethread(image, scene, renderer);
+        return runner_singlethread(image, scene, renderer, options);
     else if (runner == RUNNER_MULTITHREADED)
-        return runner_multithread(image, scene, renderer, threads);
+        return runner_multithread(image, scene, renderer, options);
     else if (runner == RUNNER_REALTIME)
-        warnx("REALTIME NOT IMPLEMENTED!");
+        return runner_realtime(image, scene, renderer, options);
+    else if (runner == RUNNER_PROGRESSIVE)
+        return runner_progressive(image, scene, renderer, options);
 
     // Unknown runner
     warnx("Unknown runner detected, please check your options.");
@@ -0,0 +1,200 @@
+#include "resample.h"
+#include "utils/alloc.h"
+#include "utils/parallel.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the number of lobes of the lanczos filter
+#define LANCZOS_LOBES 3
+
+/*
+** The source pixels contributing to an output pixel along one axis, and
+** their weights, which add up to one.
+*/
+struct filter_taps
+{
+    size_t first;
+    size_t count;
+    float *weights;
+};
+
+struct resample_pass
+{
+    const struct rgb_image *src;
+    struct rgb_image *dst;
+    const struct filter_taps *rows;
+    const struct filter_taps *cols;
+};
+
+enum resample_filter select_resample_opt(const char *option)
+{
+    if (strcmp(option, "=box") == 0)
+        return RESAMPLE_BOX;
+    else if (strcmp(option, "=lanczos") == 0)
+        return RESAMPLE_LANCZOS;
+
+    // Wrong option
+    return RESAMPLE_UNKNOWN;
+}
+
+static double sinc(double x)
+{
+    if (fabs(x) < 1e-8)
+        return 1;
+    return sin(M_PI * x) / (M_PI * x);
+}
+
+static double lanczos(double x)
+{
+    if (fabs(x) >= LANCZOS_LOBES)
+        return 0;
+    return sinc(x) * sinc(x / LANCZOS_LOBES);
+}
+
+/*
+** Compute the taps of all the output pixels along an axis.
+*/
+static struct filter_taps *compute_taps(size_t src_size, size_t dst_size,
+                                        enum resample_filter filter)
+{
+    struct filter_taps *res = xcalloc(dst_size, sizeof(*res));
+    double scale = (double)src_size / dst_size;
+    // when upscaling, the filter still needs to cover a source pixel
+    double filter_scale = scale > 1 ? scale : 1;
+    double support = filter == RESAMPLE_LANCZOS
+                         ? LANCZOS_LOBES * filter_scale
+                         : scale / 2;
+
+    for (size_t i = 0; i < dst_size; i++)
+    {
+        // the center of the output pixel, in source pixels
+        double center = (i + 0.5) * scale;
+        long first = floor(center - support);
+        long last = ceil(center + support);
+        if (first < 0)
+            first = 0;
+        if (last > (long)src_size)
+            last = src_size;
+
+        struct filter_taps *taps = &res[i];
+        taps->first = first;
+        taps->count = last - first;
+        taps->weights = xcalloc(taps->count, sizeof(*taps->weights));
+
+        double sum = 0;
+        for (size_t k = 0; k < taps->count; k++)
+        {
+            double pixel_center = first + k + 0.5;
+            double weight;
+            if (filter == RESAMPLE_LANCZOS)
+                weight = lanczos((pixel_center - center) / filter_scale);
+            else
+            {
+                // the part of the source pixel covered by the output one
+                double lo = fmax(first + k, center - support);
+                double hi = fmin(first + k + 1, center + support);
+                weight = fmax(0, hi - lo);
+            }
+            taps->weights[k] = weight;
+            sum += weight;
+        }
+
+        // pixels near the borders have fewer taps
+        for (size_t k = 0; k < taps->count; k++)
+            taps->weights[k] /= sum;
+    }
+
+    return res;
+}
+
+static void free_taps(struct filter_taps *taps, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        free(taps[i].weights);
+    free(taps);
+}
+
+/*
+** Add a weighted source row to a row of floating point channels. Both rows
+** are contiguous, so the compiler can vectorize this loop.
+*/
+static void accumulate_row(float *restrict acc,
+                           const uint8_t *restrict src, size_t count,
+                           float weight)
+{
+    for (size_t i = 0; i < count; i++)
+        acc[i] += weight * src[i];
+}
+
+static uint8_t clamp_channel(float value)
+{
+    if (value <= 0)
+        return 0;
+    if (value >= 255)
+        return 255;
+    return value + 0.5f;
+}
+
+static void resample_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct resample_pass *pass = data;
+    const struct rgb_image *src = pass->src;
+    struct rgb_image *dst = pass->dst;
+    size_t channels = src->width * 3;
+    float *row = xcalloc(channels, sizeof(*row));
+
+    for (size_t y = y_from; y < y_to; y++)
+    {
+        // gather the source rows under the output row
+        memset(row, 0, channels * sizeof(*row));
+        const struct filter_taps *row_taps = &pass->rows[y];
+        for (size_t k = 0; k < row_taps->count; k++)
+        {
+            const struct rgb_pixel *line
+                = &src->data[(row_taps->first + k) * src->width];
+            accumulate_row(row, (const uint8_t *)line, channels,
+                           row_taps->weights[k]);
+        }
+
+        // then filter along the row
+        for (size_t x = 0; x < dst->width; x++)
+        {
+            const struct filter_taps *col_taps = &pass->cols[x];
+            const float *pixels = &row[col_taps->first * 3];
+            float r = 0, g = 0, b = 0;
+            for (size_t k = 0; k < col_taps->count; k++)
+            {
+                float weight = col_taps->weights[k];
+                r += weight * pixels[3 * k + 0];
+                g += weight * pixels[3 * k + 1];
+                b += weight * pixels[3 * k + 2];
+            }
+
+            struct rgb_pixel pixel
+                = {clamp_channel(r), clamp_channel(g), clamp_channel(b)};
+            rgb_image_set(dst, x, y, pixel);
+        }
+    }
+
+    free(row);
+}
+
+void image_resample(const struct rgb_image *src, struct rgb_image *dst,
+                    enum resample_filter filter, size_t threads)
+{
+    struct filter_taps *rows = compute_taps(src->height, dst->height, filter);
+    struct filter_taps *cols = compute_taps(src->width, dst->width, filter);
+    struct resample_pass pass = {
+        .src = src,
+        .dst = dst,
+        .rows = rows,
+        .cols = cols,
+    };
+
+    parallel_rows(dst->height, threads, resample_rows, &pass);
+
+    free_taps(rows, dst->height);
+    free_taps(cols, dst->width);
+}
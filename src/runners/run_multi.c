@@ -1,135 +1,313 @@
 #include <err.h>
 #include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "bmp.h"
 #include "camera.h"
+#include "checkpoint.h"
 #include "image.h"
 #include "normal_material.h"
 #include "obj_loader.h"
 #include "phong_material.h"
+#include "pixel_order.h"
 #include "rendering.h"
 #include "runners/run_multi.h"
 #include "scene.h"
 #include "sphere.h"
+#include "stats.h"
 #include "triangle.h"
 #include "utils/alloc.h"
+#include "utils/clock.h"
+#include "utils/thread_pool.h"
 #include "vec3.h"
 
 /*
-** Split task for threads
+** Split tiles between threads, each getting a contiguous range so that
+** neighboring pixels are rendered by the same thread.
 */
-int mt_split_tasks(struct rgb_image *image, struct scene *scene,
-                   render_mode_f renderer, struct mt_worker_args **args_lists,
-                   size_t threads)
+static void mt_split_tasks(struct mt_scheduler *scheduler, size_t tiles_count)
 {
-    // Init arguments structs
-    for (size_t arg = 0; arg < threads; arg++)
-        args_lists[arg] = xcalloc(1, sizeof(struct mt_worker_args));
+    size_t tiles_thread = tiles_count / scheduler->threads;
+    size_t tiles_remain = tiles_count % scheduler->threads;
+    size_t begin = 0;
 
-    // Divide tasks
-
-    // Number of line per thread
-    size_t nb_line_thread = image->height / threads;
-    // If it exist a remainder (The image height can't be perfectly splitted
-    // Between threads)
-    size_t nb_line_thread_remain = image->height % threads;
-
-    // Initialize every struct with correct data
-    for (size_t arg = 0; arg < threads; arg++)
+    for (size_t i = 0; i < scheduler->threads; i++)
     {
-        args_lists[arg]->image = image;
-        args_lists[arg]->renderer = renderer;
-        args_lists[arg]->scene = scene;
-        args_lists[arg]->y_from = arg * nb_line_thread;
-        args_lists[arg]->y_to = arg * nb_line_thread + nb_line_thread;
+        struct mt_tile_queue *queue = &scheduler->queues[i];
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->begin = begin;
+        // Spread the remainder over the first threads
+        queue->end = begin + tiles_thread + (i < tiles_remain);
+        begin = queue->end;
     }
+}
 
-    // For now, only the last thread have more work
-    args_lists[threads - 1]->y_to += nb_line_thread_remain;
+/*
+** Take the next tile of a thread's own queue
+*/
+static bool queue_pop(struct mt_tile_queue *queue, size_t *tile)
+{
+    pthread_mutex_lock(&queue->lock);
+    bool res = queue->begin < queue->end;
+    if (res)
+        *tile = queue->begin++;
+    pthread_mutex_unlock(&queue->lock);
+    return res;
+}
 
-    return 0;
+static size_t queue_remaining(struct mt_tile_queue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    size_t res = queue->end - queue->begin;
+    pthread_mutex_unlock(&queue->lock);
+    return res;
 }
 
 /*
-** Task given to thread
+** Move half of the tiles of the busiest thread to an idle thread's queue.
+** Returns the number of tiles stolen, 0 once there is nothing left.
 */
-void *worker(void *arg)
+static size_t steal_tiles(struct mt_scheduler *scheduler, size_t thief)
 {
-    // Get arguments
-    struct mt_worker_args *worker_data = (struct mt_worker_args *)arg;
+    while (true)
+    {
+        size_t victim = thief;
+        size_t victim_remaining = 0;
+        for (size_t i = 0; i < scheduler->threads; i++)
+        {
+            size_t remaining = queue_remaining(&scheduler->queues[i]);
+            if (i != thief && remaining > victim_remaining)
+            {
+                victim = i;
+                victim_remaining = remaining;
+            }
+        }
 
-    // Logging
-    printf("MT: FROM %li TO %li\n", worker_data->y_from, worker_data->y_to);
-    fflush(stdout);
+        if (victim_remaining == 0)
+            return 0;
 
-    // Apply the renderer to some pixels of the image
-    for (size_t y = worker_data->y_from; y < worker_data->y_to; y++)
-        for (size_t x = 0; x < worker_data->image->width; x++)
-            worker_data->renderer(worker_data->image, worker_data->scene, x, y);
+        // The victim may have progressed since it was picked
+        struct mt_tile_queue *queue = &scheduler->queues[victim];
+        pthread_mutex_lock(&queue->lock);
+        size_t count = (queue->end - queue->begin + 1) / 2;
+        queue->end -= count;
+        size_t begin = queue->end;
+        pthread_mutex_unlock(&queue->lock);
+        if (count == 0)
+            continue;
+
+        queue = &scheduler->queues[thief];
+        pthread_mutex_lock(&queue->lock);
+        queue->begin = begin;
+        queue->end = begin + count;
+        pthread_mutex_unlock(&queue->lock);
+        return count;
+    }
+}
 
-    return NULL;
+static void run_tile(struct mt_scheduler *scheduler, size_t tile)
+{
+    size_t x_from = (tile % scheduler->tiles_x) * scheduler->tile_size;
+    size_t y_from = (tile / scheduler->tiles_x) * scheduler->tile_size;
+    render_tile(&scheduler->ctx, x_from, y_from, scheduler->tile_size,
+                scheduler->tile_size, scheduler->image);
 }
 
 /*
-** Multithreaded runner
+** Task given to thread
 */
-int runner_multithread(struct rgb_image *image, struct scene *scene,
-                       render_mode_f renderer, size_t threads_requested)
+static void worker(void *arg, size_t id)
 {
-    size_t thread_number
-        = threads_requested; /* Number of thread(s) requested */
-    pthread_t *threads; /* Pthread ID */
-    size_t current_thread;
-    // This is the structure given to the threads as data
-    struct mt_worker_args **thread_data;
+    // Get arguments
+    struct mt_worker_args *worker_data = &((struct mt_worker_args *)arg)[id];
+    struct mt_scheduler *scheduler = worker_data->scheduler;
 
-    // Check the number of thread
-    if (thread_number == 0)
-        warnx("Invalid number of threads - Got %li, expected at least 1",
-              thread_number);
-    else
-        warnx("MULTI-THREADED RUNNER - Using %li threads", thread_number);
+    // Counters stay on the thread's stack until the end, rather than
+    // sharing cache lines with the other threads' ones
+    size_t tiles_rendered = 0;
+    size_t tiles_stolen = 0;
+    size_t tiles_skipped = 0;
+    double busy_time = 0;
 
-    // Create a array of thread id
-    threads = xalloc(thread_number * sizeof(pthread_t));
+    // Render tiles from the thread's queue, then from the other ones
+    while (true)
+    {
+        size_t tile;
+        if (!queue_pop(&scheduler->queues[worker_data->id], &tile))
+        {
+            size_t stolen = steal_tiles(scheduler, worker_data->id);
+            if (stolen == 0)
+                break;
+            tiles_stolen += stolen;
+            continue;
+        }
 
-    // Create the thread argument list
-    thread_data = xalloc(thread_number * sizeof(struct mt_worker_args));
+        // Queues hold positions along the order of the scheduled tiles
+        if (scheduler->tiles != NULL)
+            tile = scheduler->tiles[tile].y * scheduler->tiles_x
+                   + scheduler->tiles[tile].x;
+        tile += scheduler->tiles_y_from * scheduler->tiles_x;
 
-    // Set arguments array and divide task for threads
-    mt_split_tasks(image, scene, renderer, thread_data, thread_number);
+        // Tiles resumed from a checkpoint are already rendered
+        struct checkpoint *checkpoint = scheduler->checkpoint;
+        if (checkpoint != NULL && checkpoint_is_done(checkpoint, tile))
+            continue;
 
-    // Spawn the threads and give them data
-    for (current_thread = 0; current_thread < thread_number; current_thread++)
-    {
-        // Spawn a thread and set the data for each of them
-        if (pthread_create(&threads[current_thread], NULL, worker,
-                           thread_data[current_thread])
-            != 0)
+        // Past the deadline, the remaining tiles are only marked
+        double start = clock_seconds();
+        if (scheduler->deadline > 0 && start >= scheduler->deadline)
         {
-            // The thread creation failed
-            warnx("Failed thread creation");
-            return 1;
+            scheduler->skipped[tile] = 1;
+            tiles_skipped++;
+            continue;
         }
+
+        run_tile(scheduler, tile);
+        if (checkpoint != NULL)
+            checkpoint_tile_done(checkpoint, tile);
+        busy_time += clock_seconds() - start;
+        tiles_rendered++;
     }
 
-    // Join thread(s) when task is finished
-    for (current_thread = 0; current_thread < thread_number; current_thread++)
+    worker_data->tiles_rendered = tiles_rendered;
+    worker_data->tiles_stolen = tiles_stolen;
+    worker_data->tiles_skipped = tiles_skipped;
+    worker_data->busy_time = busy_time;
+
+    stats_flush();
+}
+
+/*
+** Log how much each thread worked, and how long it waited for the others
+*/
+static void mt_report(const struct mt_worker_args *thread_data,
+                      size_t thread_number, double elapsed)
+{
+    double busy_total = 0;
+    for (size_t i = 0; i < thread_number; i++)
     {
-        pthread_join(threads[current_thread], NULL);
+        const struct mt_worker_args *data = &thread_data[i];
+        double idle = elapsed - data->busy_time;
+        warnx("MT - Thread %li: %li tiles (%li stolen), busy %.3fs, "
+              "idle %.3fs",
+              i, data->tiles_rendered, data->tiles_stolen, data->busy_time,
+              idle > 0 ? idle : 0);
+        busy_total += data->busy_time;
     }
 
-    // Free thread list
-    free(threads);
+    if (elapsed > 0)
+        warnx("MT - Threads were busy %.1f%% of %.3fs",
+              100 * busy_total / (elapsed * thread_number), elapsed);
+}
 
-    // Free thread data
+/*
+** Render the tiles over the rows from y_from to y_to on the thread pool,
+** and log how busy threads were if asked to. With a deadline, the tiles
+** skipped are set in the skipped array, and their number is returned. With
+** a checkpoint, the tiles it holds are skipped, and the others are added to
+** it.
+*/
+static size_t mt_render(struct rgb_image *image, struct scene *scene,
+                        const struct render_mode *renderer,
+                        const uint8_t *mask, size_t y_from, size_t y_to,
+                        size_t thread_number, size_t tile_size, bool report,
+                        double deadline, uint8_t *skipped,
+                        struct checkpoint *checkpoint)
+{
+    // Cut the rows in tiles
+    struct mt_scheduler scheduler = {
+        .image = image,
+        .tile_size = tile_size,
+        .tiles_x = (image->width + tile_size - 1) / tile_size,
+        .tiles_y_from = y_from / tile_size,
+        .threads = thread_number,
+        .deadline = deadline,
+        .skipped = skipped,
+        .checkpoint = checkpoint,
+    };
+    size_t tiles_y
+        = (y_to + tile_size - 1) / tile_size - scheduler.tiles_y_from;
+    if (y_from >= y_to)
+        tiles_y = 0;
+    scheduler.tiles = pixel_order_build(scheduler.tiles_x, tiles_y);
+    render_ctx_init(&scheduler.ctx, scene, renderer, mask, tile_size);
+    scheduler.queues = xcalloc(thread_number, sizeof(*scheduler.queues));
+    mt_split_tasks(&scheduler, scheduler.tiles_x * tiles_y);
+
+    // Create the thread argument list
+    struct mt_worker_args *thread_data
+        = xcalloc(thread_number, sizeof(struct mt_worker_args));
+    for (size_t i = 0; i < thread_number; i++)
+    {
+        thread_data[i].scheduler = &scheduler;
+        thread_data[i].id = i;
+    }
+
+    // Run a worker on each thread of the pool
+    double start = clock_seconds();
+    thread_pool_run(thread_number, worker, thread_data);
+    if (report)
+        mt_report(thread_data, thread_number, clock_seconds() - start);
+
+    size_t tiles_skipped = 0;
     for (size_t i = 0; i < thread_number; i++)
-        free(thread_data[i]);
+        tiles_skipped += thread_data[i].tiles_skipped;
 
-    // Free the thread data array containet
+    // Free thread data
     free(thread_data);
+    for (size_t i = 0; i < thread_number; i++)
+        pthread_mutex_destroy(&scheduler.queues[i].lock);
+    free(scheduler.queues);
+    render_ctx_destroy(&scheduler.ctx);
+    free(scheduler.tiles);
+    return tiles_skipped;
+}
+
+/*
+** Multithreaded runner
+*/
+int runner_multithread(struct rgb_image *image, struct scene *scene,
+                       const struct render_mode *renderer,
+                       const struct runner_options *options)
+{
+    size_t thread_number
+        = options->threads; /* Number of thread(s) requested */
+    size_t tile_size = options->tile_size;
+
+    // Check the number of thread
+    if (thread_number == 0 || tile_size == 0)
+    {
+        warnx("Invalid number of threads or tile size - Got %li and %li, "
+              "expected at least 1",
+              thread_number, tile_size);
+        return 1;
+    }
+    if (thread_number > thread_pool_size())
+        warnx("Only %li threads are running, workers will share them",
+              thread_pool_size());
+    warnx("MULTI-THREADED RUNNER - Using %li threads, %lix%li tiles",
+          thread_number, tile_size, tile_size);
+
+    // Completed tiles are saved as they are rendered
+    struct checkpoint checkpoint;
+    struct checkpoint *saved = NULL;
+    if (options->checkpoint_path != NULL)
+    {
+        if (checkpoint_start(&checkpoint, options->checkpoint_path,
+                             options->checkpoint_interval, image,
+                             scene->accum, tile_size, options->render_key,
+                             options->resume)
+            != 0)
+            return 1;
+        saved = &checkpoint;
+    }
+
+    mt_render(image, scene, renderer, NULL, 0, image->height, thread_number,
+              tile_size, true, 0, NULL, saved);
+    if (saved != NULL)
+        checkpoint_stop(saved);
 
     // Logging - Completed render
     warnx("MT - Complete");
@@ -137,3 +315,39 @@ int runner_multithread(struct rgb_image *image, struct scene *scene,
     // Success!
     return 0;
 }
+
+int runner_multithread_frame(struct rgb_image *image, struct scene *scene,
+                             const struct render_mode *renderer,
+                             size_t threads, size_t tile_size,
+                             const uint8_t *mask)
+{
+    if (threads == 0 || tile_size == 0)
+        return 1;
+
+    mt_render(image, scene, renderer, mask, 0, image->height, threads,
+              tile_size, false, 0, NULL, NULL);
+    return 0;
+}
+
+size_t runner_multithread_until(struct rgb_image *image, struct scene *scene,
+                                const struct render_mode *renderer,
+                                size_t threads, size_t tile_size,
+                                uint8_t *mask, size_t y_from, size_t y_to,
+                                double deadline)
+{
+    size_t tiles_x = (image->width + tile_size - 1) / tile_size;
+    size_t tiles_y = (image->height + tile_size - 1) / tile_size;
+    uint8_t *skipped = xcalloc(tiles_x * tiles_y, sizeof(*skipped));
+    size_t tiles_skipped
+        = mt_render(image, scene, renderer, mask, y_from, y_to, threads,
+                    tile_size, false, deadline, skipped, NULL);
+
+    // The pixels of the tiles skipped weren't rendered
+    for (size_t y = y_from; y < y_to && tiles_skipped != 0; y++)
+        for (size_t x = 0; x < image->width; x++)
+            if (skipped[(y / tile_size) * tiles_x + x / tile_size])
+                mask[y * image->width + x] = 0;
+
+    free(skipped);
+    return tiles_skipped;
+}
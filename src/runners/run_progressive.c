@@ -0,0 +1,173 @@
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bmp.h"
+#include "image.h"
+#include "rendering.h"
+#include "runners/run_multi.h"
+#include "runners/run_progressive.h"
+#include "scene.h"
+#include "utils/alloc.h"
+#include "utils/clock.h"
+
+// The first pass renders one pixel in a square of this side
+#define PROGRESSIVE_FIRST_STRIDE 4
+// The number of passes, down to a stride of 1
+#define PROGRESSIVE_PASSES 3
+// Passes are split in bands of rows, between which previews can be written
+#define PROGRESSIVE_BANDS 8
+
+/*
+** The side of the squares of the coarsest pass a pixel is rendered in
+*/
+static size_t pixel_stride(size_t x, size_t y)
+{
+    size_t stride = PROGRESSIVE_FIRST_STRIDE;
+    while (stride > 1 && (x % stride != 0 || y % stride != 0))
+        stride /= 2;
+    return stride;
+}
+
+/*
+** Fill the missing pixels of the preview with the pixel at the corner of
+** their square in the last complete pass, if it was rendered. The preview
+** may be the image itself, as corners are never overwritten.
+*/
+static void fill_preview(struct rgb_image *preview,
+                         const struct rgb_image *image, const uint8_t *done,
+                         size_t stride)
+{
+    if (stride > PROGRESSIVE_FIRST_STRIDE)
+        stride = PROGRESSIVE_FIRST_STRIDE;
+    for (size_t y = 0; y < image->height; y++)
+        for (size_t x = 0; x < image->width; x++)
+        {
+            size_t index = y * image->width + x;
+            size_t corner
+                = (y - y % stride) * image->width + (x - x % stride);
+            if (!done[index] && done[corner])
+                index = corner;
+            preview->data[y * image->width + x] = image->data[index];
+        }
+}
+
+int runner_progressive(struct rgb_image *image, struct scene *scene,
+                       const struct render_mode *renderer,
+                       const struct runner_options *options)
+{
+    if (options->threads == 0 || options->tile_size == 0)
+    {
+        warnx("Invalid number of threads or tile size - Got %li and %li, "
+              "expected at least 1",
+              options->threads, options->tile_size);
+        return 1;
+    }
+    warnx("PROGRESSIVE RUNNER - Using %li threads, %lix%li tiles",
+          options->threads, options->tile_size, options->tile_size);
+
+    size_t pixels = image->width * image->height;
+    uint8_t *mask = xcalloc(pixels, sizeof(*mask));
+    uint8_t *done = xcalloc(pixels, sizeof(*done));
+    struct rgb_image *preview = NULL;
+    if (options->preview_path != NULL)
+        preview = rgb_image_alloc(image->width, image->height);
+
+    double start = clock_seconds();
+    double last_preview = start;
+    double preview_time = 0;
+    size_t previews = 0;
+    // Coarser pixels come first, so the best image so far is kept when
+    // the time budget runs out
+    double deadline = 0;
+    if (options->time_budget > 0)
+        deadline = start + options->time_budget;
+    bool stopped = false;
+    // The stride of the last complete pass
+    size_t complete = 2 * PROGRESSIVE_FIRST_STRIDE;
+
+    // Each pass renders the pixels at the corners of squares half as large
+    for (size_t stride = PROGRESSIVE_FIRST_STRIDE; stride > 0 && !stopped;
+         stride /= 2)
+    {
+        for (size_t band = 0; band < PROGRESSIVE_BANDS && !stopped; band++)
+        {
+            // Only the rows of the band are set in the mask, and only the
+            // tiles over them are scheduled
+            size_t y_from = band * image->height / PROGRESSIVE_BANDS;
+            size_t y_to = (band + 1) * image->height / PROGRESSIVE_BANDS;
+            uint8_t *band_mask = &mask[y_from * image->width];
+            uint8_t *band_done = &done[y_from * image->width];
+            size_t band_pixels = (y_to - y_from) * image->width;
+            for (size_t y = y_from; y < y_to; y++)
+                for (size_t x = 0; x < image->width; x++)
+                    mask[y * image->width + x] = pixel_stride(x, y) == stride;
+
+            size_t skipped = runner_multithread_until(
+                image, scene, renderer, options->threads, options->tile_size,
+                mask, y_from, y_to, deadline);
+            for (size_t i = 0; i < band_pixels; i++)
+                band_done[i] |= band_mask[i];
+            memset(band_mask, 0, band_pixels);
+
+            bool pass_done = band + 1 == PROGRESSIVE_BANDS;
+            if (pass_done && skipped == 0)
+                complete = stride;
+            stopped = deadline > 0 && clock_seconds() >= deadline
+                      && complete != 1;
+            if (preview == NULL || stopped)
+                continue;
+
+            // Missing pixels come from the last complete pass. The first
+            // preview comes as soon as there is one, and the final image
+            // is written by the caller.
+            bool first_preview
+                = pass_done && stride == PROGRESSIVE_FIRST_STRIDE;
+            double now = clock_seconds();
+            if (complete > PROGRESSIVE_FIRST_STRIDE || complete == 1
+                || (!first_preview
+                    && now - last_preview < options->preview_interval))
+                continue;
+
+            fill_preview(preview, image, done, complete);
+            if (bmp_save(preview, options->preview_path) != 0)
+                warnx("PROGRESSIVE - Failed to write the preview");
+            last_preview = clock_seconds();
+            preview_time += last_preview - now;
+            previews++;
+            warnx("PROGRESSIVE - Preview %li at %.2fs", previews,
+                  now - start);
+        }
+    }
+
+    double elapsed = clock_seconds() - start;
+    if (previews != 0)
+        warnx("PROGRESSIVE - %li previews took %.3fs, %.1f%% of %.3fs",
+              previews, preview_time, 100 * preview_time / elapsed, elapsed);
+
+    if (stopped)
+    {
+        // The output is the best image so far, filled like previews
+        fill_preview(image, image, done, complete);
+        size_t rendered = 0;
+        for (size_t i = 0; i < pixels; i++)
+            rendered += done[i];
+        size_t passes = 0;
+        for (size_t stride = PROGRESSIVE_FIRST_STRIDE; stride >= complete;
+             stride /= 2)
+            passes++;
+        warnx("PROGRESSIVE - Time budget of %.3fs reached, rendered "
+              "%.1f%% of the pixels, %li of %i passes complete",
+              options->time_budget, 100. * rendered / pixels, passes,
+              PROGRESSIVE_PASSES);
+    }
+    else
+        warnx("PROGRESSIVE - Complete");
+
+    free(preview);
+    free(done);
+    free(mask);
+    return 0;
+}
@@ -0,0 +1,292 @@
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "accum_buffer.h"
+#include "camera.h"
+#include "dynamic_resolution.h"
+#include "frame_sink.h"
+#include "frame_timing.h"
+#include "gbuffer.h"
+#include "image.h"
+#include "rendering.h"
+#include "resample.h"
+#include "runners/run_multi.h"
+#include "runners/run_realtime.h"
+#include "scene.h"
+#include "temporal.h"
+#include "utils/clock.h"
+#include "vec3.h"
+
+// The longest command of the control pipe
+#define CONTROL_LINE_MAX 256
+
+/*
+** The control pipe, and the end of a command not fully read yet
+*/
+struct realtime_control
+{
+    int fd;
+    char line[CONTROL_LINE_MAX];
+    size_t line_size;
+};
+
+static volatile sig_atomic_t realtime_interrupted;
+
+static void realtime_interrupt(int signum)
+{
+    (void)signum;
+    realtime_interrupted = 1;
+}
+
+/*
+** Rotate v around a unit axis, by an angle in radians (Rodrigues)
+*/
+static struct vec3 rotate_around(const struct vec3 *v, const struct vec3 *axis,
+                                 double angle)
+{
+    struct vec3 cross = vec3_cross(axis, v);
+    struct vec3 res = vec3_mul(v, cos(angle));
+    cross = vec3_mul(&cross, sin(angle));
+    res = vec3_add(&res, &cross);
+    struct vec3 along = vec3_mul(axis, vec3_dot(axis, v) * (1 - cos(angle)));
+    return vec3_add(&res, &along);
+}
+
+/*
+** Apply a command to the camera. Returns true when asked to quit.
+*/
+static bool control_command(const char *command, struct camera *camera,
+                            bool *moved)
+{
+    struct vec3 arg;
+    double yaw, pitch;
+    if (strcmp(command, "quit") == 0)
+        return true;
+    else if (sscanf(command, "pos %lf %lf %lf", &arg.x, &arg.y, &arg.z) == 3)
+        camera->center = arg;
+    else if (sscanf(command, "move %lf %lf %lf", &arg.x, &arg.y, &arg.z) == 3)
+        camera->center = vec3_add(&camera->center, &arg);
+    else if (sscanf(command, "look %lf %lf %lf", &arg.x, &arg.y, &arg.z) == 3)
+    {
+        struct vec3 forward = vec3_sub(&arg, &camera->center);
+        if (vec3_length(&forward) == 0)
+            return false;
+        vec3_normalize(&forward);
+        camera->forward = forward;
+    }
+    else if (sscanf(command, "turn %lf %lf", &yaw, &pitch) == 2)
+    {
+        struct vec3 right = vec3_cross(&camera->forward, &camera->up);
+        vec3_normalize(&right);
+        camera->forward = rotate_around(&camera->forward, &camera->up,
+                                        -yaw * M_PI / 180);
+        camera->forward = rotate_around(&camera->forward, &right,
+                                        pitch * M_PI / 180);
+        camera->up = rotate_around(&camera->up, &right, pitch * M_PI / 180);
+        vec3_normalize(&camera->forward);
+        vec3_normalize(&camera->up);
+    }
+    else
+    {
+        warnx("REALTIME - Unknown command '%s'", command);
+        return false;
+    }
+
+    *moved = true;
+    return false;
+}
+
+/*
+** Apply the commands which arrived since the last frame. Returns true when
+** asked to quit.
+*/
+static bool control_poll(struct realtime_control *control,
+                         struct camera *camera, bool *moved)
+{
+    if (control->fd < 0)
+        return false;
+
+    char buffer[CONTROL_LINE_MAX];
+    ssize_t size;
+    while ((size = read(control->fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t i = 0; i < size; i++)
+        {
+            if (buffer[i] != '\n')
+            {
+                // overlong commands are truncated
+                if (control->line_size + 1 < CONTROL_LINE_MAX)
+                    control->line[control->line_size++] = buffer[i];
+                continue;
+            }
+
+            control->line[control->line_size] = '\0';
+            control->line_size = 0;
+            if (control_command(control->line, camera, moved))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+int runner_realtime(struct rgb_image *image, struct scene *scene,
+                    const struct render_mode *renderer,
+                    const struct runner_options *options)
+{
+    struct frame_sink sink;
+    if (frame_sink_open(&sink, options->sink, image->width, image->height))
+        return 1;
+
+    // The writer may come and go, so the pipe never blocks
+    struct realtime_control control = {.fd = -1};
+    if (options->control != NULL)
+    {
+        control.fd = open(options->control, O_RDONLY | O_NONBLOCK);
+        if (control.fd < 0)
+        {
+            warn("failed to open the control pipe '%s'", options->control);
+            frame_sink_close(&sink);
+            return 1;
+        }
+    }
+
+    struct sigaction action = {.sa_handler = realtime_interrupt};
+    struct sigaction previous_action;
+    sigemptyset(&action.sa_mask);
+    realtime_interrupted = 0;
+    sigaction(SIGINT, &action, &previous_action);
+
+    warnx("REALTIME RUNNER - Using %li threads, %.2fms per frame",
+          options->threads, 1e3 * options->frame_budget);
+
+    struct frame_timing timing;
+    frame_timing_init(&timing);
+    struct rgb_pixel background = {0};
+    int res = 0;
+
+    // Scaled frames are rendered in a buffer large enough for the full
+    // resolution, then upscaled to the image
+    struct dynres_controller dynres;
+    dynres_init(&dynres, image->width, image->height, options->frame_budget,
+                options->min_scale);
+    struct rgb_image *scaled = NULL;
+    if (options->min_scale > 0)
+        scaled = rgb_image_alloc(image->width, image->height);
+    double scale_sum = 0;
+    double scale_min = 1;
+
+    // Reusing pixels needs the depth of the rendered ones
+    bool temporal_reuse = options->temporal_refresh != 0;
+    struct temporal_history temporal;
+    struct gbuffer *temporal_gbuffer = NULL;
+    if (temporal_reuse)
+    {
+        temporal_init(&temporal, image->width, image->height,
+                      options->temporal_refresh);
+        if (scene->gbuffer == NULL)
+            scene->gbuffer = temporal_gbuffer
+                = gbuffer_alloc(image->width, image->height);
+    }
+
+    for (size_t frame = 0; options->frames == 0 || frame < options->frames;
+         frame++)
+    {
+        double start = clock_seconds();
+
+        bool moved = false;
+        if (realtime_interrupted
+            || control_poll(&control, &scene->camera, &moved))
+            break;
+
+        // Path traced pixels keep converging while the camera stays still
+        if (moved && scene->accum != NULL)
+            accum_buffer_clear(scene->accum);
+
+        struct rgb_image *target = image;
+        if (dynres.width != image->width || dynres.height != image->height)
+        {
+            target = scaled;
+            target->width = dynres.width;
+            target->height = dynres.height;
+        }
+
+        // Only render the pixels the last frame can't provide
+        const uint8_t *mask = NULL;
+        if (temporal_reuse)
+        {
+            temporal_reproject(&temporal, target, scene, options->threads);
+            mask = temporal.retrace;
+        }
+        else
+            rgb_image_clear(target, &background);
+
+        if (runner_multithread_frame(target, scene, renderer, options->threads,
+                                     options->tile_size, mask))
+        {
+            res = 1;
+            break;
+        }
+        if (temporal_reuse)
+            temporal_store(&temporal, target, scene->gbuffer, &scene->camera,
+                           options->threads);
+        if (target != image)
+            image_resample(target, image, RESAMPLE_LANCZOS, options->threads);
+        if (frame_sink_write(&sink, image))
+        {
+            res = 1;
+            break;
+        }
+
+        double elapsed = clock_seconds() - start;
+        frame_timing_add(&timing, elapsed);
+        scale_sum += dynres.scale;
+        if (dynres.scale < scale_min)
+            scale_min = dynres.scale;
+
+        // Accumulated samples belong to pixels of the previous size
+        if (scaled != NULL && dynres_update(&dynres, elapsed))
+        {
+            warnx("DRS - Frame %li: rendering at %lix%li, scale %.2f", frame,
+                  dynres.width, dynres.height, dynres.scale);
+            if (scene->accum != NULL)
+                accum_buffer_clear(scene->accum);
+        }
+
+        if (elapsed < options->frame_budget)
+            clock_sleep(options->frame_budget - elapsed);
+    }
+
+    sigaction(SIGINT, &previous_action, NULL);
+    frame_timing_report(&timing, options->frame_budget);
+    frame_timing_histogram(&timing, options->frame_budget);
+    if (scaled != NULL && timing.count != 0)
+        warnx("DRS - Scale %.2f on average, %.2f at least",
+              scale_sum / timing.count, scale_min);
+    frame_timing_destroy(&timing);
+    free(scaled);
+    if (temporal_reuse)
+    {
+        temporal_report(&temporal);
+        temporal_destroy(&temporal);
+    }
+    if (temporal_gbuffer != NULL)
+    {
+        scene->gbuffer = NULL;
+        free(temporal_gbuffer);
+    }
+    if (control.fd >= 0)
+        close(control.fd);
+    frame_sink_close(&sink);
+
+    warnx("REALTIME - Complete");
+    return res;
+}
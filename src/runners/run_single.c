@@ -1,12 +1,17 @@
+#include <err.h>
+#include <stdlib.h>
+
 #include "bmp.h"
 #include "camera.h"
 #include "image.h"
 #include "normal_material.h"
 #include "obj_loader.h"
 #include "phong_material.h"
+#include "pixel_order.h"
 #include "rendering.h"
 #include "scene.h"
 #include "sphere.h"
+#include "stats.h"
 #include "triangle.h"
 #include "vec3.h"
 
@@ -14,12 +19,34 @@
 ** Single thread runner, not using pthread. This is a minimal runner
 */
 int runner_singlethread(struct rgb_image *image, struct scene *scene,
-                        render_mode_f renderer)
+                        const struct render_mode *renderer,
+                        const struct runner_options *options)
 {
-    // Apply the renderer to every pixels of the image
-    for (size_t y = 0; y < image->height; y++)
-        for (size_t x = 0; x < image->width; x++)
-            renderer(image, scene, x, y);
+    size_t tile_size = options->tile_size;
+    if (tile_size == 0)
+    {
+        warnx("Invalid tile size - Got 0, expected at least 1");
+        return 1;
+    }
+
+    // Apply the renderer to every tiles of the image, along the selected
+    // order
+    size_t tiles_x = (image->width + tile_size - 1) / tile_size;
+    size_t tiles_y = (image->height + tile_size - 1) / tile_size;
+    struct pixel_pos *order = pixel_order_build(tiles_x, tiles_y);
+    struct render_ctx ctx;
+    render_ctx_init(&ctx, scene, renderer, NULL, tile_size);
+    for (size_t i = 0; i < tiles_x * tiles_y; i++)
+    {
+        size_t tile_x = order ? order[i].x : i % tiles_x;
+        size_t tile_y = order ? order[i].y : i / tiles_x;
+        render_tile(&ctx, tile_x * tile_size, tile_y * tile_size, tile_size,
+                    tile_size, image);
+    }
+    render_ctx_destroy(&ctx);
+    free(order);
+
+    stats_flush();
 
     // Success!
     return 0;
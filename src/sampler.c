@@ -0,0 +1,367 @@
+#include "sampler.h"
+#include "utils/alloc.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// converts 32 bits fixed point numbers to [0, 1)
+#define U32_TO_UNIT (1.0 / 4294967296.0)
+// the fractional part of the golden ratio, which rotates blue noise
+#define GOLDEN_RATIO_FRAC 0.61803398874989484820
+// the size of the gaussian kernel used to build the blue noise tile
+#define BLUE_NOISE_SIGMA 1.5
+// the part of the tile initially covered with points
+#define BLUE_NOISE_INITIAL_DENSITY 0.1
+
+#define BLUE_NOISE_PIXELS (SAMPLER_BLUE_NOISE_SIZE * SAMPLER_BLUE_NOISE_SIZE)
+#define BLUE_NOISE_MASK (SAMPLER_BLUE_NOISE_SIZE - 1)
+
+static enum sampler_type sampler_type = SAMPLER_SOBOL;
+// the rank of each pixel of the blue noise tile
+static uint16_t blue_noise[BLUE_NOISE_PIXELS];
+
+/*
+** The state of the sample stream of a thread: the sample being taken, and
+** the next dimension to hand out.
+*/
+struct sample_stream
+{
+    size_t x;
+    size_t y;
+    uint32_t index;
+    uint32_t count;
+    uint32_t dimension;
+};
+
+static __thread struct sample_stream stream;
+
+enum sampler_type select_sampler_opt(const char *option)
+{
+    if (strcmp(option, "=sobol") == 0)
+        return SAMPLER_SOBOL;
+    else if (strcmp(option, "=bluenoise") == 0)
+        return SAMPLER_BLUE_NOISE;
+    else if (strcmp(option, "=stratified") == 0)
+        return SAMPLER_STRATIFIED;
+    return SAMPLER_UNKNOWN;
+}
+
+static uint32_t hash_u32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    return x ^ (x >> 16);
+}
+
+static uint32_t hash_combine(uint32_t seed, uint32_t value)
+{
+    return hash_u32(seed ^ (value * 0x9E3779B9u + 0x7F4A7C15u));
+}
+
+/*
+** Hash a pixel and a seed into a well distributed integer
+*/
+static uint32_t pixel_hash(size_t x, size_t y, uint32_t seed)
+{
+    uint32_t h = seed;
+    h ^= (uint32_t)x * 0x9E3779B1u;
+    h = (h ^ (h >> 16)) * 0x85EBCA6Bu;
+    h ^= (uint32_t)y * 0xC2B2AE35u;
+    h = (h ^ (h >> 13)) * 0x27D4EB2Fu;
+    return h ^ (h >> 16);
+}
+
+static uint32_t reverse_bits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+/*
+** The first dimension of the Sobol sequence is the van der Corput sequence,
+** which mirrors the bits of the index.
+*/
+static uint32_t sobol_dim0(uint32_t index)
+{
+    return reverse_bits(index);
+}
+
+/*
+** The second dimension of the Sobol sequence, whose direction numbers
+** are given by the recurrence v(i+1) = v(i) ^ (v(i) >> 1)
+*/
+static uint32_t sobol_dim1(uint32_t index)
+{
+    uint32_t res = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+        if (index & 1)
+            res ^= v;
+    return res;
+}
+
+/*
+** Owen scrambling, using a hash where each bit only depends on the lower
+** bits (Laine-Karras), applied to the reversed bits so that each bit only
+** depends on the higher ones.
+*/
+static uint32_t owen_scramble(uint32_t x, uint32_t seed)
+{
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6C50B47Cu;
+    x ^= x * 0xB82F1E52u;
+    x ^= x * 0xC7AFE638u;
+    x ^= x * 0x8D22F6E6u;
+    return reverse_bits(x);
+}
+
+/*
+** Dimensions are taken by pairs from the 2D Sobol sequence. Each pair
+** shuffles the order of the points, so pairs aren't correlated with each
+** other, and scrambles them, so pixels aren't correlated with each other.
+*/
+static double sobol_sample(size_t x, size_t y, uint32_t index,
+                           uint32_t dimension)
+{
+    uint32_t seed = hash_combine(pixel_hash(x, y, 0x68E31DA4u), dimension / 2);
+    uint32_t shuffled = owen_scramble(index, seed);
+    uint32_t point = dimension % 2 ? sobol_dim1(shuffled)
+                                   : sobol_dim0(shuffled);
+    return owen_scramble(point, hash_combine(seed, dimension % 2 + 1))
+           * U32_TO_UNIT;
+}
+
+/*
+** Each dimension looks up the tile at a different offset, and samples
+** rotate the values by the golden ratio, which keeps them evenly spread.
+*/
+static double blue_noise_sample(size_t x, size_t y, uint32_t index,
+                                uint32_t dimension)
+{
+    uint32_t offset = hash_combine(0xB5297A4Du, dimension);
+    size_t tile_x = (x + offset) & BLUE_NOISE_MASK;
+    size_t tile_y = (y + (offset >> 16)) & BLUE_NOISE_MASK;
+    double rank = blue_noise[tile_y * SAMPLER_BLUE_NOISE_SIZE + tile_x];
+
+    double res = (rank + 0.5) / BLUE_NOISE_PIXELS + index * GOLDEN_RATIO_FRAC;
+    return res - floor(res);
+}
+
+/*
+** A pseudo random permutation of [0, length), picked by seed (Kensler).
+** Values outside the range are permuted again until they fall inside it.
+*/
+static uint32_t permute(uint32_t i, uint32_t length, uint32_t seed)
+{
+    uint32_t mask = length - 1;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+
+    do
+    {
+        i ^= seed;
+        i *= 0xE170893Du;
+        i ^= seed >> 16;
+        i ^= (i & mask) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929EB3Fu;
+        i ^= seed >> 23;
+        i ^= (i & mask) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935FA69u;
+        i ^= (i & mask) >> 11;
+        i *= 0x74DCB303u;
+        i ^= (i & mask) >> 2;
+        i *= 0x9E501CC3u;
+        i ^= (i & mask) >> 2;
+        i *= 0xC860A3DFu;
+        i &= mask;
+        i ^= i >> 5;
+    } while (i >= length);
+
+    return (i + seed) % length;
+}
+
+/*
+** Each sample falls in its own stratum, at a random position inside it.
+** Strata are shuffled differently in each dimension.
+*/
+static double stratified_sample(size_t x, size_t y, uint32_t index,
+                                uint32_t count, uint32_t dimension)
+{
+    if (count == 0)
+        count = 1;
+
+    uint32_t seed = hash_combine(pixel_hash(x, y, 0x2C1B3C6Du), dimension);
+    uint32_t stratum = permute(index % count, count, seed);
+    double jitter = hash_combine(seed, index) * U32_TO_UNIT;
+    return (stratum + jitter) / count;
+}
+
+double sampler_get(size_t x, size_t y, uint32_t index, uint32_t count,
+                   uint32_t dimension)
+{
+    if (sampler_type == SAMPLER_BLUE_NOISE)
+        return blue_noise_sample(x, y, index, dimension);
+    else if (sampler_type == SAMPLER_STRATIFIED)
+        return stratified_sample(x, y, index, count, dimension);
+    return sobol_sample(x, y, index, dimension);
+}
+
+void sampler_get_2d(size_t x, size_t y, uint32_t index, uint32_t count,
+                    uint32_t dimension, double *u, double *v)
+{
+    *u = sampler_get(x, y, index, count, dimension);
+    *v = sampler_get(x, y, index, count, dimension + 1);
+}
+
+void sampler_start(size_t x, size_t y, uint32_t index, uint32_t count)
+{
+    stream.x = x;
+    stream.y = y;
+    stream.index = index;
+    stream.count = count;
+    stream.dimension = SAMPLER_DIM_STREAM;
+}
+
+double sampler_next(void)
+{
+    return sampler_get(stream.x, stream.y, stream.index, stream.count,
+                       stream.dimension++);
+}
+
+void sampler_next_2d(double *u, double *v)
+{
+    // Sobol points are only well distributed along pairs of dimensions
+    stream.dimension += stream.dimension % 2;
+    sampler_get_2d(stream.x, stream.y, stream.index, stream.count,
+                   stream.dimension, u, v);
+    stream.dimension += 2;
+}
+
+/*
+** Add or remove the energy of a point of the blue noise tile, which
+** decreases with the distance to it, wrapping around the tile.
+*/
+static void energy_update(float *energy, const float *kernel, size_t point,
+                          float sign)
+{
+    size_t point_x = point % SAMPLER_BLUE_NOISE_SIZE;
+    size_t point_y = point / SAMPLER_BLUE_NOISE_SIZE;
+    for (size_t y = 0; y < SAMPLER_BLUE_NOISE_SIZE; y++)
+    {
+        const float *row = &kernel[((y - point_y) & BLUE_NOISE_MASK)
+                                   * SAMPLER_BLUE_NOISE_SIZE];
+        for (size_t x = 0; x < SAMPLER_BLUE_NOISE_SIZE; x++)
+            energy[y * SAMPLER_BLUE_NOISE_SIZE + x]
+                += sign * row[(x - point_x) & BLUE_NOISE_MASK];
+    }
+}
+
+/*
+** Find the tightest cluster, the point with the highest energy, or the
+** largest void, the empty pixel with the lowest energy.
+*/
+static size_t find_extreme(const bool *points, const float *energy,
+                           bool cluster)
+{
+    size_t res = BLUE_NOISE_PIXELS;
+    for (size_t i = 0; i < BLUE_NOISE_PIXELS; i++)
+    {
+        if (points[i] != cluster)
+            continue;
+        if (res == BLUE_NOISE_PIXELS
+            || (cluster ? energy[i] > energy[res] : energy[i] < energy[res]))
+            res = i;
+    }
+    return res;
+}
+
+/*
+** Build the blue noise tile using the void and cluster method: points are
+** first spread evenly, then ranked by removing the tightest clusters, and
+** the remaining pixels are ranked by filling the largest voids.
+*/
+static void blue_noise_build(void)
+{
+    float *kernel = xcalloc(BLUE_NOISE_PIXELS, sizeof(*kernel));
+    float *energy = xcalloc(BLUE_NOISE_PIXELS, sizeof(*energy));
+    float *ranking_energy = xcalloc(BLUE_NOISE_PIXELS, sizeof(*energy));
+    bool *points = xcalloc(BLUE_NOISE_PIXELS, sizeof(*points));
+    bool *ranking_points = xcalloc(BLUE_NOISE_PIXELS, sizeof(*points));
+
+    for (size_t y = 0; y < SAMPLER_BLUE_NOISE_SIZE; y++)
+        for (size_t x = 0; x < SAMPLER_BLUE_NOISE_SIZE; x++)
+        {
+            double dx = fmin(x, SAMPLER_BLUE_NOISE_SIZE - x);
+            double dy = fmin(y, SAMPLER_BLUE_NOISE_SIZE - y);
+            kernel[y * SAMPLER_BLUE_NOISE_SIZE + x] = exp(
+                -(dx * dx + dy * dy) / (2 * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+        }
+
+    size_t initial_count = 0;
+    for (size_t i = 0; i < BLUE_NOISE_PIXELS; i++)
+        if (hash_combine(0x3C6EF372u, i) * U32_TO_UNIT
+            < BLUE_NOISE_INITIAL_DENSITY)
+        {
+            points[i] = true;
+            energy_update(energy, kernel, i, 1);
+            initial_count++;
+        }
+
+    // move points from clusters to voids until it doesn't change anything
+    for (size_t i = 0; i < BLUE_NOISE_PIXELS; i++)
+    {
+        size_t cluster = find_extreme(points, energy, true);
+        points[cluster] = false;
+        energy_update(energy, kernel, cluster, -1);
+
+        size_t empty = find_extreme(points, energy, false);
+        points[empty] = true;
+        energy_update(energy, kernel, empty, 1);
+        if (empty == cluster)
+            break;
+    }
+
+    memcpy(ranking_points, points, BLUE_NOISE_PIXELS * sizeof(*points));
+    memcpy(ranking_energy, energy, BLUE_NOISE_PIXELS * sizeof(*energy));
+    for (size_t rank = initial_count; rank-- > 0;)
+    {
+        size_t cluster = find_extreme(ranking_points, ranking_energy, true);
+        ranking_points[cluster] = false;
+        energy_update(ranking_energy, kernel, cluster, -1);
+        blue_noise[cluster] = rank;
+    }
+
+    for (size_t rank = initial_count; rank < BLUE_NOISE_PIXELS; rank++)
+    {
+        size_t empty = find_extreme(points, energy, false);
+        points[empty] = true;
+        energy_update(energy, kernel, empty, 1);
+        blue_noise[empty] = rank;
+    }
+
+    free(ranking_points);
+    free(points);
+    free(ranking_energy);
+    free(energy);
+    free(kernel);
+}
+
+void sampler_init(enum sampler_type type)
+{
+    sampler_type = type;
+    if (type == SAMPLER_BLUE_NOISE)
+        blue_noise_build();
+}
@@ -1,5 +1,17 @@
 #include "scene.h"
 
+#include <math.h>
+#include <stdlib.h>
+
+/*
+** The index of the last object which blocked a shadow ray, per thread, and
+** the scene it is from, which is only compared and never dereferenced.
+** Shadow rays of neighboring pixels are very likely to be blocked by the same
+** object, so testing it first often avoids going through the whole scene.
+*/
+static __thread const struct scene *occluder_scene;
+static __thread size_t last_occluder;
+
 void scene_destroy(struct scene *scene)
 {
     for (size_t i = 0; i < object_vect_size(&scene->objects); i++)
@@ -10,4 +22,75 @@ void scene_destroy(struct scene *scene)
     }
 
     object_vect_destroy(&scene->objects);
+
+    for (size_t i = 0; i < light_vect_size(&scene->lights); i++)
+        free(light_vect_get(&scene->lights, i));
+
+    light_vect_destroy(&scene->lights);
+    light_tree_destroy(&scene->light_tree);
+    texture_cache_destroy(&scene->textures);
+}
+
+double scene_intersect_ray(struct object_intersection *closest_intersection,
+                           const struct scene *scene, const struct ray *ray)
+{
+    // we will now try to find the closest object in the scene
+    // intersecting this ray
+    double closest_intersection_dist = INFINITY;
+
+    for (size_t i = 0; i < object_vect_size(&scene->objects); i++)
+    {
+        struct object *obj = object_vect_get(&scene->objects, i);
+        struct object_intersection intersection;
+        // if there's no intersection between the ray and this object, skip it
+        double intersection_dist = obj->intersect(&intersection, obj, ray);
+        if (intersection_dist >= closest_intersection_dist)
+            continue;
+
+        closest_intersection_dist = intersection_dist;
+        *closest_intersection = intersection;
+        closest_intersection->object = obj;
+    }
+
+    return closest_intersection_dist;
+}
+
+static inline bool object_occludes(const struct object *obj,
+                                   const struct ray *ray, double max_dist)
+{
+    struct object_intersection intersection;
+    return obj->intersect(&intersection, obj, ray) < max_dist;
+}
+
+bool scene_occluded(const struct scene *scene, const struct ray *ray,
+                    double max_dist)
+{
+    // a cached index from another scene means nothing here
+    if (occluder_scene != scene)
+    {
+        occluder_scene = scene;
+        last_occluder = (size_t)-1;
+    }
+
+    // try the cached occluder first, the index is checked in case objects
+    // were removed since
+    size_t objects_count = object_vect_size(&scene->objects);
+    size_t cached = last_occluder;
+    if (cached < objects_count
+        && object_occludes(object_vect_get(&scene->objects, cached), ray,
+                           max_dist))
+        return true;
+
+    // any hit will do, no need to look for the closest one
+    for (size_t i = 0; i < objects_count; i++)
+    {
+        struct object *obj = object_vect_get(&scene->objects, i);
+        if (i == cached || !object_occludes(obj, ray, max_dist))
+            continue;
+
+        last_occluder = i;
+        return true;
+    }
+
+    return false;
 }
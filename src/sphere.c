@@ -30,6 +30,10 @@ static double sphere_ray_intersect(struct intersection *intersection,
     intersection->point = vec3_add(&ray->source, &point_offset);
     intersection->normal = vec3_sub(&intersection->point, &sphere->center);
     vec3_normalize(&intersection->normal);
+    // spheres aren't textured
+    intersection->u = 0;
+    intersection->v = 0;
+    intersection->uv_scale = 0;
     // compute intersection coord / normal
     return t;
 }
@@ -0,0 +1,78 @@
+#include "stats.h"
+
+#include <err.h>
+
+__thread struct render_stats stats_local;
+static struct render_stats stats_total;
+
+void stats_flush(void)
+{
+    __atomic_fetch_add(&stats_total.shadow_rays, stats_local.shadow_rays,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_total.occlusion_rays,
+                       stats_local.occlusion_rays, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_total.path_samples, stats_local.path_samples,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_total.irradiance_lookups,
+                       stats_local.irradiance_lookups, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_total.irradiance_hits,
+                       stats_local.irradiance_hits, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_total.irradiance_records,
+                       stats_local.irradiance_records, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_total.texture_lookups,
+                       stats_local.texture_lookups, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats_total.texture_misses,
+                       stats_local.texture_misses, __ATOMIC_RELAXED);
+    stats_local = (struct render_stats){0};
+}
+
+void stats_print(size_t pixels)
+{
+    // include the counters of the main thread
+    stats_flush();
+
+    uint64_t shadow_rays
+        = __atomic_load_n(&stats_total.shadow_rays, __ATOMIC_RELAXED);
+    warnx("STATS - Shadow rays: %llu (%.2f per pixel)",
+          (unsigned long long)shadow_rays, (double)shadow_rays / pixels);
+
+    uint64_t occlusion_rays
+        = __atomic_load_n(&stats_total.occlusion_rays, __ATOMIC_RELAXED);
+    if (occlusion_rays != 0)
+        warnx("STATS - Occlusion rays: %llu (%.2f per pixel)",
+              (unsigned long long)occlusion_rays,
+              (double)occlusion_rays / pixels);
+
+    uint64_t path_samples
+        = __atomic_load_n(&stats_total.path_samples, __ATOMIC_RELAXED);
+    if (path_samples != 0)
+        warnx("STATS - Path samples: %llu (%.2f per pixel)",
+              (unsigned long long)path_samples,
+              (double)path_samples / pixels);
+
+    uint64_t irradiance_lookups
+        = __atomic_load_n(&stats_total.irradiance_lookups, __ATOMIC_RELAXED);
+    if (irradiance_lookups != 0)
+    {
+        uint64_t hits
+            = __atomic_load_n(&stats_total.irradiance_hits, __ATOMIC_RELAXED);
+        uint64_t records = __atomic_load_n(&stats_total.irradiance_records,
+                                           __ATOMIC_RELAXED);
+        warnx("STATS - Irradiance cache: %llu records, %.2f%% hit rate",
+              (unsigned long long)records,
+              100. * hits / irradiance_lookups);
+    }
+
+    uint64_t texture_lookups
+        = __atomic_load_n(&stats_total.texture_lookups, __ATOMIC_RELAXED);
+    if (texture_lookups != 0)
+    {
+        uint64_t misses
+            = __atomic_load_n(&stats_total.texture_misses, __ATOMIC_RELAXED);
+        warnx("STATS - Texture cache: %llu texel reads, %llu tile loads "
+              "(%.2f%% hit rate)",
+              (unsigned long long)texture_lookups,
+              (unsigned long long)misses,
+              100. * (texture_lookups - misses) / texture_lookups);
+    }
+}
@@ -0,0 +1,449 @@
+#include "temporal.h"
+#include "utils/alloc.h"
+#include "utils/parallel.h"
+
+#include <err.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+** The number of traced depths along a side of the frame: one every
+** TEMPORAL_DEPTH_STEP pixels, and one past the last step so that every pixel
+** lies between traced ones.
+*/
+static size_t coarse_size(size_t size)
+{
+    return size == 0 ? 0 : (size - 1) / TEMPORAL_DEPTH_STEP + 2;
+}
+
+void temporal_init(struct temporal_history *history, size_t width,
+                   size_t height, size_t refresh)
+{
+    size_t capacity = width * height;
+    history->width = 0;
+    history->height = 0;
+    history->capacity = capacity;
+    history->valid = false;
+    history->colors = xcalloc(capacity, sizeof(*history->colors));
+    history->depths = xcalloc(capacity, sizeof(*history->depths));
+    history->reprojected = xcalloc(capacity, sizeof(*history->reprojected));
+    history->landed = xcalloc(capacity, sizeof(*history->landed));
+    history->coarse_depths = xcalloc(coarse_size(width) * coarse_size(height),
+                                     sizeof(*history->coarse_depths));
+    history->retrace = xcalloc(capacity, sizeof(*history->retrace));
+    history->refresh = refresh > 0 ? refresh : 1;
+    history->frame = 0;
+    history->retraced = 0;
+    history->reused = 0;
+}
+
+void temporal_destroy(struct temporal_history *history)
+{
+    free(history->colors);
+    free(history->depths);
+    free(history->reprojected);
+    free(history->landed);
+    free(history->coarse_depths);
+    free(history->retrace);
+}
+
+/*
+** What projecting directions on the image plane of a camera needs, computed
+** once per frame.
+*/
+struct projection
+{
+    const struct camera *camera;
+    struct camera_view view;
+    // the normal of the image plane, towards the scene. The plane goes
+    // through the center of the camera, along right and up, which may not
+    // be orthogonal to forward.
+    struct vec3 normal;
+    // the dot products solving offset = a * right + b * up, the inverse of
+    // camera_cast_ray
+    double rr;
+    double ru;
+    double uu;
+    double det;
+    size_t width;
+    size_t height;
+};
+
+static void projection_init(struct projection *proj,
+                            const struct camera *camera,
+                            const struct camera_view *view, size_t width,
+                            size_t height)
+{
+    proj->camera = camera;
+    proj->view = *view;
+    proj->normal = vec3_cross(&view->right, &camera->up);
+    if (vec3_dot(&proj->normal, &camera->forward) < 0)
+        proj->normal = vec3_mul(&proj->normal, -1);
+    proj->rr = vec3_dot(&view->right, &view->right);
+    proj->ru = vec3_dot(&view->right, &camera->up);
+    proj->uu = vec3_dot(&camera->up, &camera->up);
+    proj->det = proj->rr * proj->uu - proj->ru * proj->ru;
+    proj->width = width;
+    proj->height = height;
+}
+
+/*
+** Find the pixel whose camera ray goes in a direction, from the vantage
+** point of the camera, and where the ray leaves the image plane. Returns
+** false if the direction isn't in view.
+*/
+static bool project_direction(const struct projection *proj,
+                              const struct vec3 *direction, size_t *x,
+                              size_t *y, struct vec3 *plane_point)
+{
+    const struct camera *camera = proj->camera;
+    const struct vec3 *vantage = &proj->view.vantage_point;
+    double facing = vec3_dot(direction, &proj->normal);
+    if (facing <= 0 || proj->det == 0)
+        return false;
+
+    struct vec3 to_center = vec3_sub(&camera->center, vantage);
+    struct vec3 to_plane
+        = vec3_mul(direction, vec3_dot(&to_center, &proj->normal) / facing);
+    *plane_point = vec3_add(vantage, &to_plane);
+    struct vec3 offset = vec3_sub(plane_point, &camera->center);
+
+    double ro = vec3_dot(&proj->view.right, &offset);
+    double uo = vec3_dot(&camera->up, &offset);
+    double cam_x = (ro * proj->uu - uo * proj->ru) / proj->det / camera->width;
+    double cam_y = (uo * proj->rr - ro * proj->ru) / proj->det / camera->height;
+
+    // image_cast_ray casts pixel x at x / width - 0.5
+    double pixel_x = round((cam_x + 0.5) * proj->width);
+    double pixel_y = round((cam_y + 0.5) * proj->height);
+    if (pixel_x < 0 || pixel_y < 0 || pixel_x >= proj->width
+        || pixel_y >= proj->height)
+        return false;
+
+    *x = pixel_x;
+    *y = pixel_y;
+    return true;
+}
+
+static void pixel_cast_ray(struct ray *ray, const struct projection *proj,
+                           size_t x, size_t y)
+{
+    camera_view_cast_ray(ray, &proj->view, proj->camera,
+                         (double)x / proj->width - 0.5,
+                         (double)y / proj->height - 0.5);
+}
+
+/*
+** The state shared by the passes of a reprojection
+*/
+struct reproject_pass
+{
+    struct temporal_history *history;
+    struct rgb_image *image;
+    const struct scene *scene;
+    // the camera of the stored frame, and the current one
+    struct projection before;
+    struct projection now;
+    // whether objects may have come in front of reprojected pixels
+    bool check_depth;
+    // whether the background can be reused
+    bool same_vantage;
+    size_t retrace_count;
+};
+
+/*
+** Trace the depth of the current frame every TEMPORAL_DEPTH_STEP pixels
+*/
+static void coarse_depth_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct reproject_pass *pass = data;
+    const struct projection *now = &pass->now;
+    size_t coarse_width = coarse_size(now->width);
+
+    for (size_t cy = y_from; cy < y_to; cy++)
+        for (size_t cx = 0; cx < coarse_width; cx++)
+        {
+            size_t x = cx * TEMPORAL_DEPTH_STEP;
+            size_t y = cy * TEMPORAL_DEPTH_STEP;
+            if (x >= now->width)
+                x = now->width - 1;
+            if (y >= now->height)
+                y = now->height - 1;
+
+            struct ray ray;
+            pixel_cast_ray(&ray, now, x, y);
+            struct object_intersection inter;
+            pass->history->coarse_depths[cy * coarse_width + cx]
+                = scene_intersect_ray(&inter, pass->scene, &ray);
+        }
+}
+
+/*
+** Whether a pixel of the current frame at some depth is behind the traced
+** depths around it. A pixel is only hidden when all the traced depths
+** around it are closer, so that pixels along the edges of objects aren't
+** mistaken for hidden ones.
+*/
+static bool coarse_hidden(const struct reproject_pass *pass, size_t x,
+                          size_t y, float depth)
+{
+    size_t coarse_width = coarse_size(pass->now.width);
+    size_t cx = x / TEMPORAL_DEPTH_STEP;
+    size_t cy = y / TEMPORAL_DEPTH_STEP;
+    const float *row = &pass->history->coarse_depths[cy * coarse_width + cx];
+
+    float farthest = 0;
+    for (size_t dy = 0; dy < 2; dy++)
+        for (size_t dx = 0; dx < 2; dx++)
+            if (row[dy * coarse_width + dx] > farthest)
+                farthest = row[dy * coarse_width + dx];
+    return depth > farthest * (1 + TEMPORAL_DEPTH_TOLERANCE);
+}
+
+/*
+** Keep the closest stored pixel landing on a pixel. Positive floats order
+** like their bits, so the depth and index pack into a key compared at once.
+*/
+static void land_pixel(uint64_t *landed, float depth, size_t index)
+{
+    uint32_t depth_bits;
+    memcpy(&depth_bits, &depth, sizeof(depth_bits));
+    uint64_t key = (uint64_t)depth_bits << 32 | index;
+
+    uint64_t cur = __atomic_load_n(landed, __ATOMIC_RELAXED);
+    while (key < cur
+           && !__atomic_compare_exchange_n(landed, &cur, key, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        continue;
+}
+
+/*
+** Move the stored pixels of objects of some rows to where the camera sees
+** them now.
+*/
+static void scatter_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct reproject_pass *pass = data;
+    struct temporal_history *history = pass->history;
+    const struct vec3 *vantage = &pass->now.view.vantage_point;
+
+    for (size_t y = y_from; y < y_to; y++)
+        for (size_t x = 0; x < history->width; x++)
+        {
+            size_t index = y * history->width + x;
+            if (isinf(history->depths[index]))
+                continue;
+
+            // the point the stored pixel was rendered at
+            struct ray ray;
+            pixel_cast_ray(&ray, &pass->before, x, y);
+            struct vec3 offset
+                = vec3_mul(&ray.direction, history->depths[index]);
+            struct vec3 point = vec3_add(&ray.source, &offset);
+
+            struct vec3 direction = vec3_sub(&point, vantage);
+            if (vec3_length(&direction) == 0)
+                continue;
+            vec3_normalize(&direction);
+
+            size_t new_x, new_y;
+            struct vec3 plane_point;
+            if (!project_direction(&pass->now, &direction, &new_x, &new_y,
+                                   &plane_point))
+                continue;
+
+            // points between the vantage point and the image plane aren't
+            // seen
+            struct vec3 from_plane = vec3_sub(&point, &plane_point);
+            if (vec3_dot(&from_plane, &direction) < 0)
+                continue;
+
+            float depth = vec3_length(&from_plane);
+            if (pass->check_depth && coarse_hidden(pass, new_x, new_y, depth))
+                continue;
+
+            size_t new_index = new_y * pass->image->width + new_x;
+            land_pixel(&history->landed[new_index], depth, index);
+        }
+}
+
+/*
+** Fill a pixel no object landed on with the stored background, when rays
+** still come from the same point. The background is infinitely far, so only
+** the direction of its pixels matter.
+*/
+static bool reuse_background(struct reproject_pass *pass, size_t x, size_t y)
+{
+    const struct temporal_history *history = pass->history;
+    struct ray ray;
+    pixel_cast_ray(&ray, &pass->now, x, y);
+
+    size_t old_x, old_y;
+    struct vec3 plane_point;
+    if (!project_direction(&pass->before, &ray.direction, &old_x, &old_y,
+                           &plane_point))
+        return false;
+
+    size_t old_index = old_y * history->width + old_x;
+    if (!isinf(history->depths[old_index]))
+        return false;
+    pass->image->data[y * pass->image->width + x]
+        = history->colors[old_index];
+    return true;
+}
+
+/*
+** Take the closest stored pixel landing on each pixel of some rows, and mark
+** the others, and the pixels due for a refresh, to be rendered.
+*/
+static void resolve_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct reproject_pass *pass = data;
+    struct temporal_history *history = pass->history;
+    struct rgb_image *image = pass->image;
+    size_t phase = (history->frame - 1) % history->refresh;
+    struct rgb_pixel background = {0};
+    size_t retrace_count = 0;
+
+    for (size_t y = y_from; y < y_to; y++)
+        for (size_t x = 0; x < image->width; x++)
+        {
+            size_t index = y * image->width + x;
+            uint64_t key = history->landed[index];
+            uint8_t retrace = key == UINT64_MAX;
+            history->reprojected[index] = INFINITY;
+            if (!retrace)
+            {
+                uint32_t depth_bits = key >> 32;
+                memcpy(&history->reprojected[index], &depth_bits,
+                       sizeof(depth_bits));
+                image->data[index] = history->colors[(uint32_t)key];
+            }
+            // the background may hide objects which came in view since,
+            // unless rays come from the same point
+            else if (pass->same_vantage)
+                retrace = !reuse_background(pass, x, y);
+
+            // refresh a rotating subset of the pixels, spread over the image
+            if ((x + 3 * y) % history->refresh == phase)
+                retrace = 1;
+            if (retrace)
+            {
+                image->data[index] = background;
+                retrace_count++;
+            }
+            history->retrace[index] = retrace;
+        }
+
+    __atomic_fetch_add(&pass->retrace_count, retrace_count, __ATOMIC_RELAXED);
+}
+
+size_t temporal_reproject(struct temporal_history *history,
+                          struct rgb_image *image, const struct scene *scene,
+                          size_t threads)
+{
+    const struct camera *camera = &scene->camera;
+    struct reproject_pass pass = {
+        .history = history,
+        .image = image,
+        .scene = scene,
+    };
+    struct camera_view view;
+    camera_view_init(&view, camera);
+    projection_init(&pass.now, camera, &view, image->width, image->height);
+
+    size_t pixels = image->width * image->height;
+    memset(history->landed, 0xff, pixels * sizeof(*history->landed));
+    history->frame++;
+
+    if (history->valid && history->width == image->width
+        && history->height == image->height)
+    {
+        projection_init(&pass.before, &history->camera, &history->view,
+                        history->width, history->height);
+
+        // objects only come in front of reprojected pixels when the camera
+        // moves, which the depth traced here and there tells
+        pass.check_depth
+            = memcmp(&history->camera, camera, sizeof(*camera)) != 0;
+        if (pass.check_depth)
+            parallel_rows(coarse_size(image->height), threads,
+                          coarse_depth_rows, &pass);
+
+        // each pixel lands on the closest pixel of the new frame, and the
+        // closest to the camera wins. Pixels nothing landed on were hidden
+        // or out of view.
+        parallel_rows(history->height, threads, scatter_rows, &pass);
+
+        struct vec3 moved = vec3_sub(&view.vantage_point,
+                                     &history->view.vantage_point);
+        pass.same_vantage = vec3_length(&moved) == 0;
+    }
+
+    parallel_rows(image->height, threads, resolve_rows, &pass);
+
+    history->retraced += pass.retrace_count;
+    history->reused += pixels - pass.retrace_count;
+    return pass.retrace_count;
+}
+
+/*
+** Keep the depth of the pixels of some rows
+*/
+struct store_pass
+{
+    struct temporal_history *history;
+    struct gbuffer *gbuffer;
+};
+
+static void store_rows(void *data, size_t y_from, size_t y_to)
+{
+    struct store_pass *pass = data;
+    struct temporal_history *history = pass->history;
+
+    for (size_t y = y_from; y < y_to; y++)
+        for (size_t x = 0; x < history->width; x++)
+        {
+            size_t index = y * history->width + x;
+            if (!history->retrace[index])
+            {
+                history->depths[index] = history->reprojected[index];
+                continue;
+            }
+
+            struct gbuffer_pixel *pixel = gbuffer_get(pass->gbuffer, x, y);
+            history->depths[index]
+                = pixel->object == NULL ? INFINITY : pixel->depth;
+        }
+}
+
+void temporal_store(struct temporal_history *history,
+                    const struct rgb_image *image, struct gbuffer *gbuffer,
+                    const struct camera *camera, size_t threads)
+{
+    history->width = image->width;
+    history->height = image->height;
+    history->camera = *camera;
+    camera_view_init(&history->view, camera);
+    history->valid = true;
+
+    size_t pixels = image->width * image->height;
+    memcpy(history->colors, image->data, pixels * sizeof(*image->data));
+    struct store_pass pass = {history, gbuffer};
+    parallel_rows(image->height, threads, store_rows, &pass);
+}
+
+void temporal_report(const struct temporal_history *history)
+{
+    size_t total = history->retraced + history->reused;
+    if (total == 0)
+        return;
+
+    warnx("TEMPORAL - %li pixels rendered, %li reused (%.1f%% rendered)",
+          history->retraced, history->reused,
+          100. * history->retraced / total);
+    if (history->reused != 0)
+        warnx("TEMPORAL - %.3f rendered pixels per reused pixel",
+              (double)history->retraced / history->reused);
+}
@@ -0,0 +1,262 @@
+#include "texture.h"
+#include "bmp.h"
+#include "utils/alloc.h"
+
+#include <err.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+** A mip level being built, in floating point to avoid accumulating
+** rounding errors from a level to the next.
+*/
+struct float_level
+{
+    size_t width;
+    size_t height;
+    struct vec3 *data;
+};
+
+static struct float_level level_from_image(const struct rgb_image *image)
+{
+    struct float_level res = {image->width, image->height, NULL};
+    res.data = xcalloc(res.width * res.height, sizeof(*res.data));
+    for (size_t i = 0; i < res.width * res.height; i++)
+    {
+        const struct rgb_pixel *pixel = &image->data[i];
+        res.data[i] = (struct vec3){pixel->r / 255., pixel->g / 255.,
+                                    pixel->b / 255.};
+    }
+    return res;
+}
+
+/*
+** Build the next level using a 2x2 box filter. Levels with an odd size
+** reuse their last row or column.
+*/
+static struct float_level level_downsample(const struct float_level *level)
+{
+    struct float_level res = {
+        level->width > 1 ? level->width / 2 : 1,
+        level->height > 1 ? level->height / 2 : 1,
+        NULL,
+    };
+    res.data = xcalloc(res.width * res.height, sizeof(*res.data));
+
+    for (size_t y = 0; y < res.height; y++)
+    {
+        size_t y0 = 2 * y < level->height ? 2 * y : level->height - 1;
+        size_t y1 = y0 + 1 < level->height ? y0 + 1 : y0;
+        for (size_t x = 0; x < res.width; x++)
+        {
+            size_t x0 = 2 * x < level->width ? 2 * x : level->width - 1;
+            size_t x1 = x0 + 1 < level->width ? x0 + 1 : x0;
+
+            struct vec3 sum = level->data[y0 * level->width + x0];
+            sum = vec3_add(&sum, &level->data[y0 * level->width + x1]);
+            sum = vec3_add(&sum, &level->data[y1 * level->width + x0]);
+            sum = vec3_add(&sum, &level->data[y1 * level->width + x1]);
+            res.data[y * res.width + x] = vec3_mul(&sum, 0.25);
+        }
+    }
+
+    return res;
+}
+
+/*
+** Cut a level into tiles and add them to the cache. Tiles overlapping the
+** edge of the level are padded with its last texels.
+*/
+static int level_store(struct texture_cache *cache,
+                       struct texture_level *level,
+                       const struct float_level *data)
+{
+    level->width = data->width;
+    level->height = data->height;
+    level->tiles_x = (data->width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+    size_t tiles_y
+        = (data->height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+
+    struct texture_tile tile;
+    for (size_t tile_y = 0; tile_y < tiles_y; tile_y++)
+    {
+        for (size_t tile_x = 0; tile_x < level->tiles_x; tile_x++)
+        {
+            for (size_t y = 0; y < TEXTURE_TILE_SIZE; y++)
+            {
+                size_t src_y = tile_y * TEXTURE_TILE_SIZE + y;
+                if (src_y >= data->height)
+                    src_y = data->height - 1;
+
+                for (size_t x = 0; x < TEXTURE_TILE_SIZE; x++)
+                {
+                    size_t src_x = tile_x * TEXTURE_TILE_SIZE + x;
+                    if (src_x >= data->width)
+                        src_x = data->width - 1;
+
+                    tile.texels[y * TEXTURE_TILE_SIZE + x]
+                        = rgb_color_from_light(
+                            &data->data[src_y * data->width + src_x]);
+                }
+            }
+
+            size_t index = texture_cache_add_tile(cache, &tile);
+            if (index == (size_t)-1)
+                return -1;
+            if (tile_x == 0 && tile_y == 0)
+                level->first_tile = index;
+        }
+    }
+
+    return 0;
+}
+
+static struct texture *texture_build(struct texture_cache *cache,
+                                     const struct rgb_image *image)
+{
+    struct texture *res = zalloc(sizeof(*res));
+    res->cache = cache;
+    struct float_level level = level_from_image(image);
+
+    while (true)
+    {
+        if (level_store(cache, &res->levels[res->levels_count], &level))
+        {
+            free(level.data);
+            free(res);
+            return NULL;
+        }
+        res->levels_count++;
+
+        if ((level.width == 1 && level.height == 1)
+            || res->levels_count == TEXTURE_MAX_LEVELS)
+            break;
+
+        struct float_level next = level_downsample(&level);
+        free(level.data);
+        level = next;
+    }
+
+    free(level.data);
+    return res;
+}
+
+struct texture *texture_load(struct texture_cache *cache, const char *path)
+{
+    // materials often share textures
+    for (struct texture *it = cache->textures; it; it = it->next)
+        if (strcmp(it->path, path) == 0)
+            return it;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        warn("failed to open texture '%s'", path);
+        return NULL;
+    }
+
+    struct rgb_image *image = bmp_read(fp);
+    fclose(fp);
+    if (image == NULL)
+    {
+        warnx("failed to load texture '%s'", path);
+        return NULL;
+    }
+
+    struct texture *res = texture_build(cache, image);
+    free(image);
+    if (res == NULL)
+        return NULL;
+
+    warnx("Loaded texture '%s' (%lix%li, %li levels)", path,
+          res->levels[0].width, res->levels[0].height, res->levels_count);
+    res->path = strdup(path);
+    res->next = cache->textures;
+    cache->textures = res;
+    return res;
+}
+
+void texture_free(struct texture *texture)
+{
+    free(texture->path);
+    free(texture);
+}
+
+static struct vec3 level_texel(struct texture_cache *cache,
+                               const struct texture_level *level, size_t x,
+                               size_t y)
+{
+    size_t tile = level->first_tile + (y / TEXTURE_TILE_SIZE) * level->tiles_x
+                  + x / TEXTURE_TILE_SIZE;
+    struct rgb_pixel texel = texture_cache_texel(
+        cache, tile, x % TEXTURE_TILE_SIZE, y % TEXTURE_TILE_SIZE);
+    return (struct vec3){texel.r / 255., texel.g / 255., texel.b / 255.};
+}
+
+static size_t wrap(long coord, size_t size)
+{
+    long res = coord % (long)size;
+    return res < 0 ? res + (long)size : res;
+}
+
+/*
+** Bilinear filtering inside a level.
+*/
+static struct vec3 level_sample(struct texture_cache *cache,
+                                const struct texture_level *level, double u,
+                                double v)
+{
+    double x = u * level->width - 0.5;
+    double y = v * level->height - 0.5;
+    double x_floor = floor(x);
+    double y_floor = floor(y);
+    double fx = x - x_floor;
+    double fy = y - y_floor;
+
+    size_t x0 = wrap(x_floor, level->width);
+    size_t x1 = wrap(x_floor + 1, level->width);
+    size_t y0 = wrap(y_floor, level->height);
+    size_t y1 = wrap(y_floor + 1, level->height);
+
+    struct vec3 c00 = level_texel(cache, level, x0, y0);
+    struct vec3 c10 = level_texel(cache, level, x1, y0);
+    struct vec3 c01 = level_texel(cache, level, x0, y1);
+    struct vec3 c11 = level_texel(cache, level, x1, y1);
+
+    c00 = vec3_mul(&c00, (1 - fx) * (1 - fy));
+    c10 = vec3_mul(&c10, fx * (1 - fy));
+    c01 = vec3_mul(&c01, (1 - fx) * fy);
+    c11 = vec3_mul(&c11, fx * fy);
+
+    struct vec3 res = vec3_add(&c00, &c10);
+    res = vec3_add(&res, &c01);
+    return vec3_add(&res, &c11);
+}
+
+struct vec3 texture_sample(const struct texture *texture, double u, double v,
+                           double width)
+{
+    struct texture_cache *cache = texture->cache;
+    // pick the levels where the footprint is about a texel wide
+    const struct texture_level *base = &texture->levels[0];
+    double texels = width * sqrt((double)base->width * base->height);
+    double lod = texels > 1 ? log2(texels) : 0;
+    double max_lod = texture->levels_count - 1;
+    if (lod >= max_lod)
+        return level_sample(cache, &texture->levels[texture->levels_count - 1],
+                            u, v);
+
+    // blend the two closest levels
+    size_t level = lod;
+    double blend = lod - level;
+    struct vec3 fine = level_sample(cache, &texture->levels[level], u, v);
+    if (blend == 0)
+        return fine;
+
+    struct vec3 coarse = level_sample(cache, &texture->levels[level + 1], u, v);
+    fine = vec3_mul(&fine, 1 - blend);
+    coarse = vec3_mul(&coarse, blend);
+    return vec3_add(&fine, &coarse);
+}
@@ -0,0 +1,256 @@
+#include "texture_cache.h"
+#include "stats.h"
+#include "texture.h"
+#include "utils/alloc.h"
+
+#include <err.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+** A tile in memory, linked both in its hash bucket and in the LRU list.
+*/
+struct texture_slot
+{
+    size_t tile_index;
+    struct texture_slot *bucket_next;
+    struct texture_slot *lru_prev;
+    struct texture_slot *lru_next;
+    struct texture_tile tile;
+};
+
+/*
+** The copy of a tile a thread keeps, from the cache of the given id, 0 when
+** empty.
+*/
+struct thread_tile
+{
+    size_t cache_id;
+    size_t tile_index;
+    struct texture_tile tile;
+};
+
+static __thread struct thread_tile thread_tiles[TEXTURE_CACHE_THREAD_TILES];
+static size_t next_cache_id = 1;
+
+void texture_cache_init(struct texture_cache *cache, size_t size)
+{
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->backing = NULL;
+    cache->tiles_count = 0;
+    cache->id = __atomic_fetch_add(&next_cache_id, 1, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < TEXTURE_CACHE_SHARDS; i++)
+    {
+        struct texture_shard *shard = &cache->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->slots_count = 0;
+        shard->buckets = NULL;
+        shard->lru_first = NULL;
+        shard->lru_last = NULL;
+    }
+    texture_cache_resize(cache, size);
+    cache->textures = NULL;
+}
+
+void texture_cache_resize(struct texture_cache *cache, size_t size)
+{
+    size_t capacity = (size << 20) / sizeof(struct texture_tile);
+    capacity /= TEXTURE_CACHE_SHARDS;
+    if (capacity == 0)
+        capacity = 1;
+    for (size_t i = 0; i < TEXTURE_CACHE_SHARDS; i++)
+    {
+        cache->shards[i].capacity = capacity;
+        cache->shards[i].buckets_count = capacity;
+    }
+}
+
+void texture_cache_destroy(struct texture_cache *cache)
+{
+    for (size_t i = 0; i < TEXTURE_CACHE_SHARDS; i++)
+    {
+        struct texture_shard *shard = &cache->shards[i];
+        struct texture_slot *slot = shard->lru_first;
+        while (slot != NULL)
+        {
+            struct texture_slot *next = slot->lru_next;
+            free(slot);
+            slot = next;
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+
+    struct texture *texture = cache->textures;
+    while (texture != NULL)
+    {
+        struct texture *next = texture->next;
+        texture_free(texture);
+        texture = next;
+    }
+
+    if (cache->backing != NULL)
+        fclose(cache->backing);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+size_t texture_cache_add_tile(struct texture_cache *cache,
+                              const struct texture_tile *tile)
+{
+    size_t res = (size_t)-1;
+    pthread_mutex_lock(&cache->lock);
+
+    if (cache->backing == NULL)
+    {
+        cache->backing = tmpfile();
+        for (size_t i = 0; i < TEXTURE_CACHE_SHARDS; i++)
+            cache->shards[i].buckets
+                = xcalloc(cache->shards[i].buckets_count,
+                          sizeof(*cache->shards[i].buckets));
+    }
+
+    // tiles are read back without the stream, which must be flushed
+    if (cache->backing == NULL)
+        warn("failed to create the texture cache file");
+    else if (fseeko(cache->backing, (off_t)cache->tiles_count * sizeof(*tile),
+                    SEEK_SET)
+                 != 0
+             || fwrite(tile, sizeof(*tile), 1, cache->backing) != 1
+             || fflush(cache->backing) != 0)
+        warn("failed to write to the texture cache file");
+    else
+        res = cache->tiles_count++;
+
+    pthread_mutex_unlock(&cache->lock);
+    return res;
+}
+
+static void lru_unlink(struct texture_shard *shard, struct texture_slot *slot)
+{
+    if (slot->lru_prev)
+        slot->lru_prev->lru_next = slot->lru_next;
+    else
+        shard->lru_first = slot->lru_next;
+
+    if (slot->lru_next)
+        slot->lru_next->lru_prev = slot->lru_prev;
+    else
+        shard->lru_last = slot->lru_prev;
+}
+
+static void lru_push_front(struct texture_shard *shard,
+                           struct texture_slot *slot)
+{
+    slot->lru_prev = NULL;
+    slot->lru_next = shard->lru_first;
+    if (shard->lru_first)
+        shard->lru_first->lru_prev = slot;
+    else
+        shard->lru_last = slot;
+    shard->lru_first = slot;
+}
+
+static struct texture_slot **shard_bucket(struct texture_shard *shard,
+                                          size_t tile_index)
+{
+    size_t key = tile_index / TEXTURE_CACHE_SHARDS;
+    return &shard->buckets[key % shard->buckets_count];
+}
+
+static void bucket_remove(struct texture_shard *shard,
+                          struct texture_slot *slot)
+{
+    struct texture_slot **it = shard_bucket(shard, slot->tile_index);
+    while (*it != slot)
+        it = &(*it)->bucket_next;
+    *it = slot->bucket_next;
+}
+
+/*
+** Find a free slot, evicting the least recently used tile if the shard is
+** full. The shard must be locked.
+*/
+static struct texture_slot *slot_alloc(struct texture_shard *shard)
+{
+    if (shard->slots_count < shard->capacity)
+    {
+        shard->slots_count++;
+        return xalloc(sizeof(struct texture_slot));
+    }
+
+    struct texture_slot *slot = shard->lru_last;
+    lru_unlink(shard, slot);
+    bucket_remove(shard, slot);
+    return slot;
+}
+
+/*
+** Find a tile in memory, and mark it as the most recently used one. The
+** shard must be locked.
+*/
+static struct texture_slot *slot_find(struct texture_shard *shard,
+                                      size_t tile_index)
+{
+    struct texture_slot *slot = *shard_bucket(shard, tile_index);
+    for (; slot; slot = slot->bucket_next)
+        if (slot->tile_index == tile_index)
+        {
+            lru_unlink(shard, slot);
+            lru_push_front(shard, slot);
+            return slot;
+        }
+    return NULL;
+}
+
+/*
+** Copy a tile to the thread's copy, from memory, or from the backing file
+** without holding the lock of the shard meanwhile.
+*/
+static void tile_fetch(struct texture_cache *cache, size_t tile_index,
+                       struct thread_tile *copy)
+{
+    struct texture_shard *shard
+        = &cache->shards[tile_index % TEXTURE_CACHE_SHARDS];
+    copy->cache_id = cache->id;
+    copy->tile_index = tile_index;
+
+    pthread_mutex_lock(&shard->lock);
+    struct texture_slot *slot = slot_find(shard, tile_index);
+    if (slot != NULL)
+        copy->tile = slot->tile;
+    pthread_mutex_unlock(&shard->lock);
+    if (slot != NULL)
+        return;
+
+    stats_count_texture_miss();
+    off_t offset = (off_t)tile_index * sizeof(copy->tile);
+    if (pread(fileno(cache->backing), &copy->tile, sizeof(copy->tile), offset)
+        != sizeof(copy->tile))
+        errx(1, "failed to read tile %li from the texture cache", tile_index);
+
+    // another thread may have paged the same tile in meanwhile
+    pthread_mutex_lock(&shard->lock);
+    if (slot_find(shard, tile_index) == NULL)
+    {
+        slot = slot_alloc(shard);
+        slot->tile_index = tile_index;
+        slot->tile = copy->tile;
+        struct texture_slot **bucket = shard_bucket(shard, tile_index);
+        slot->bucket_next = *bucket;
+        *bucket = slot;
+        lru_push_front(shard, slot);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+struct rgb_pixel texture_cache_texel(struct texture_cache *cache,
+                                     size_t tile_index, size_t x, size_t y)
+{
+    stats_count_texture_lookup();
+
+    struct thread_tile *copy
+        = &thread_tiles[tile_index % TEXTURE_CACHE_THREAD_TILES];
+    if (copy->cache_id != cache->id || copy->tile_index != tile_index)
+        tile_fetch(cache, tile_index, copy);
+    return copy->tile.texels[y * TEXTURE_TILE_SIZE + x];
+}
@@ -73,12 +73,49 @@ double object_triangle_ray_intersect(struct object_intersection *inter,
     // if P is on the right side of the triangle's edges,
     // it is inside the triangle, and there is an intersection
     inter->material = trian->material;
+    inter->location.u = 0;
+    inter->location.v = 0;
+    inter->location.uv_scale = 0;
+    if (trian->textured)
+    {
+        // the barycentric coordinates of P are the areas of the triangles
+        // it forms with each edge
+        double area = vec3_dot(&n, &n);
+        double w0 = vec3_dot(&v1_cross, &n) / area;
+        double w1 = vec3_dot(&v2_cross, &n) / area;
+        double w2 = 1 - w0 - w1;
+        const struct texcoord *uv = trian->texcoords;
+        inter->location.u = w0 * uv[0].u + w1 * uv[1].u + w2 * uv[2].u;
+        inter->location.v = w0 * uv[0].v + w1 * uv[1].v + w2 * uv[2].v;
+        inter->location.uv_scale = trian->uv_scale;
+    }
+
     vec3_normalize(&n);
     inter->location.normal = n;
     inter->location.point = P;
     return t;
 }
 
+void triangle_set_texcoords(struct triangle *trian,
+                            const struct texcoord texcoords[3])
+{
+    trian->textured = true;
+    for (size_t i = 0; i < 3; i++)
+        trian->texcoords[i] = texcoords[i];
+
+    // compare the area of the triangle in texture space and in the scene
+    struct vec3 a = vec3_sub(&trian->points[1], &trian->points[0]);
+    struct vec3 c = vec3_sub(&trian->points[2], &trian->points[0]);
+    struct vec3 n = vec3_cross(&a, &c);
+    double area = vec3_length(&n);
+
+    double uv_area = fabs((texcoords[1].u - texcoords[0].u)
+                              * (texcoords[2].v - texcoords[0].v)
+                          - (texcoords[2].u - texcoords[0].u)
+                              * (texcoords[1].v - texcoords[0].v));
+    trian->uv_scale = area > 0 ? sqrt(uv_area / area) : 0;
+}
+
 void triangle_free(struct object *obj)
 {
     struct triangle *trian = (struct triangle *)obj;
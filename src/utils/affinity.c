@@ -0,0 +1,191 @@
+#include "utils/affinity.h"
+#include "utils/alloc.h"
+
+#include <dirent.h>
+#include <err.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NODES_PATH "/sys/devices/system/node"
+
+struct cpu_slot
+{
+    int cpu;
+    size_t node;
+};
+
+/*
+** The CPU of each thread index, in the order of the policy
+*/
+static struct
+{
+    enum pin_policy policy;
+    struct cpu_slot *slots;
+    size_t count;
+    size_t capacity;
+} affinity;
+
+enum pin_policy select_pin_opt(const char *option)
+{
+    if (strcmp(option, "=compact") == 0)
+        return PIN_COMPACT;
+    else if (strcmp(option, "=scatter") == 0)
+        return PIN_SCATTER;
+    else if (strcmp(option, "=none") == 0)
+        return PIN_NONE;
+
+    // Wrong option
+    return PIN_UNKNOWN;
+}
+
+static void add_cpu(int cpu, size_t node)
+{
+    if (affinity.count == affinity.capacity)
+    {
+        affinity.capacity = affinity.capacity ? 2 * affinity.capacity : 16;
+        affinity.slots = xrealloc(affinity.slots,
+                                  affinity.capacity * sizeof(*affinity.slots));
+    }
+    affinity.slots[affinity.count++] = (struct cpu_slot){cpu, node};
+}
+
+/*
+** Add the allowed CPUs of a node, listed as ranges like '0-3,8-11'
+*/
+static void read_node(size_t node, const cpu_set_t *allowed)
+{
+    char path[64];
+    snprintf(path, sizeof(path), NODES_PATH "/node%zu/cpulist", node);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return;
+
+    int first, last;
+    while (fscanf(file, "%d", &first) == 1)
+    {
+        last = first;
+        int separator = fgetc(file);
+        if (separator == '-')
+        {
+            if (fscanf(file, "%d", &last) != 1)
+                break;
+            separator = fgetc(file);
+        }
+
+        for (int cpu = first; cpu <= last; cpu++)
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, allowed))
+                add_cpu(cpu, node);
+        if (separator != ',')
+            break;
+    }
+    fclose(file);
+}
+
+static int compare_slots(const void *a, const void *b)
+{
+    const struct cpu_slot *slot_a = a;
+    const struct cpu_slot *slot_b = b;
+    if (slot_a->node != slot_b->node)
+        return slot_a->node < slot_b->node ? -1 : 1;
+    return slot_a->cpu - slot_b->cpu;
+}
+
+/*
+** Reorder the CPUs so that consecutive ones are on different nodes, taking
+** the first CPU of each node, then the second, and so on.
+*/
+static void scatter_slots(void)
+{
+    struct cpu_slot *sorted = affinity.slots;
+    // where the CPUs of each node start, and where the last ones end
+    size_t *begin = xcalloc(affinity.count + 1, sizeof(*begin));
+    size_t nodes = 0;
+    for (size_t i = 0; i < affinity.count; i++)
+        if (i == 0 || sorted[i].node != sorted[i - 1].node)
+            begin[nodes++] = i;
+    begin[nodes] = affinity.count;
+
+    struct cpu_slot *res = xcalloc(affinity.count, sizeof(*res));
+    size_t placed = 0;
+    for (size_t round = 0; placed < affinity.count; round++)
+        for (size_t node = 0; node < nodes; node++)
+            if (begin[node] + round < begin[node + 1])
+                res[placed++] = sorted[begin[node] + round];
+
+    free(begin);
+    free(affinity.slots);
+    affinity.slots = res;
+    affinity.capacity = affinity.count;
+}
+
+void affinity_init(enum pin_policy policy, size_t threads)
+{
+    affinity.policy = policy;
+    if (policy == PIN_NONE)
+        return;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        warn("AFFINITY - Failed to get the allowed CPUs, not pinning");
+        affinity.policy = PIN_NONE;
+        return;
+    }
+
+    DIR *nodes = opendir(NODES_PATH);
+    if (nodes != NULL)
+    {
+        struct dirent *entry;
+        size_t node;
+        while ((entry = readdir(nodes)) != NULL)
+            if (sscanf(entry->d_name, "node%zu", &node) == 1)
+                read_node(node, &allowed);
+        closedir(nodes);
+    }
+
+    // without NUMA support, all the CPUs are on a single node
+    if (affinity.count == 0)
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed))
+                add_cpu(cpu, 0);
+
+    qsort(affinity.slots, affinity.count, sizeof(*affinity.slots),
+          compare_slots);
+    size_t nodes_count = 0;
+    for (size_t i = 0; i < affinity.count; i++)
+        nodes_count += i == 0
+                       || affinity.slots[i].node != affinity.slots[i - 1].node;
+    if (policy == PIN_SCATTER)
+        scatter_slots();
+
+    warnx("AFFINITY - %li CPUs on %li NUMA nodes, pinning %li threads %s",
+          affinity.count, nodes_count, threads,
+          policy == PIN_COMPACT ? "compactly" : "scattered");
+    if (threads > affinity.count)
+        warnx("AFFINITY - More threads than CPUs, some will share them");
+}
+
+void affinity_destroy(void)
+{
+    free(affinity.slots);
+    affinity.slots = NULL;
+    affinity.count = 0;
+    affinity.capacity = 0;
+}
+
+void affinity_pin(size_t thread)
+{
+    if (affinity.policy == PIN_NONE || affinity.count == 0)
+        return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(affinity.slots[thread % affinity.count].cpu, &set);
+    int res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (res != 0)
+        warnx("AFFINITY - Failed to pin thread %li: %s", thread,
+              strerror(res));
+}
@@ -0,0 +1,42 @@
+#include "utils/parallel.h"
+#include "stats.h"
+#include "utils/thread_pool.h"
+
+struct parallel_bands
+{
+    parallel_rows_f func;
+    void *data;
+    size_t height;
+    size_t count;
+};
+
+/*
+** Process a band of rows, spreading the remainder over the first bands.
+** Pool threads outlive the task, so their counters are flushed here.
+*/
+static void parallel_band(void *arg, size_t index)
+{
+    struct parallel_bands *bands = arg;
+    size_t rows = bands->height / bands->count;
+    size_t remainder = bands->height % bands->count;
+    size_t y_from = index * rows + (index < remainder ? index : remainder);
+    size_t y_to = y_from + rows + (index < remainder);
+    bands->func(bands->data, y_from, y_to);
+    stats_flush();
+}
+
+void parallel_rows(size_t height, size_t threads, parallel_rows_f func,
+                   void *data)
+{
+    if (threads > height)
+        threads = height;
+
+    if (threads <= 1)
+    {
+        func(data, 0, height);
+        return;
+    }
+
+    struct parallel_bands bands = {func, data, height, threads};
+    thread_pool_run(threads, parallel_band, &bands);
+}
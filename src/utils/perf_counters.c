@@ -0,0 +1,107 @@
+#include "utils/perf_counters.h"
+#include "utils/alloc.h"
+#include "utils/thread_pool.h"
+
+#include <err.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const uint64_t perf_events[] = {
+    PERF_COUNT_HW_CACHE_REFERENCES,
+    PERF_COUNT_HW_CACHE_MISSES,
+};
+#define PERF_EVENTS (sizeof(perf_events) / sizeof(*perf_events))
+
+/*
+** Count an event of the calling thread, on any CPU, in user space
+*/
+static int open_counter(uint64_t event)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = event;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void start_task(void *data, size_t thread)
+{
+    struct perf_counters *counters = data;
+    int *fds = &counters->fds[thread * PERF_EVENTS];
+    for (size_t i = 0; i < PERF_EVENTS; i++)
+    {
+        fds[i] = open_counter(perf_events[i]);
+        if (fds[i] < 0)
+        {
+            // the error of the first thread is reported
+            if (thread == 0 && i == 0)
+                warn("PERF - Cache counters are unavailable");
+            continue;
+        }
+        ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perf_counters_start(struct perf_counters *counters)
+{
+    *counters = (struct perf_counters){
+        .threads = thread_pool_size(),
+    };
+    counters->fds = xalloc(counters->threads * PERF_EVENTS * sizeof(int));
+
+    // counters opened by a thread only count its own events
+    thread_pool_run(counters->threads, start_task, counters);
+}
+
+void perf_counters_stop(struct perf_counters *counters)
+{
+    uint64_t *totals[PERF_EVENTS] = {&counters->references,
+                                     &counters->misses};
+    counters->available = true;
+    for (size_t thread = 0; thread < counters->threads; thread++)
+        for (size_t i = 0; i < PERF_EVENTS; i++)
+        {
+            int fd = counters->fds[thread * PERF_EVENTS + i];
+            uint64_t count;
+            if (fd < 0)
+            {
+                counters->available = false;
+                continue;
+            }
+
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) == sizeof(count))
+                *totals[i] += count;
+            else
+                counters->available = false;
+            close(fd);
+        }
+
+    free(counters->fds);
+    counters->fds = NULL;
+}
+
+void perf_counters_print(const struct perf_counters *counters, size_t pixels)
+{
+    if (!counters->available || pixels == 0)
+        return;
+
+    warnx("STATS - Cache references: %llu (%.2f per pixel)",
+          (unsigned long long)counters->references,
+          (double)counters->references / pixels);
+    warnx("STATS - Cache misses: %llu (%.2f per pixel, %.2f%% of references)",
+          (unsigned long long)counters->misses,
+          (double)counters->misses / pixels,
+          counters->references ? 100. * counters->misses / counters->references
+                               : 0.);
+}
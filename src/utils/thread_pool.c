@@ -0,0 +1,191 @@
+#include "utils/thread_pool.h"
+#include "utils/affinity.h"
+#include "utils/alloc.h"
+
+#include <err.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+** The pool runs a single batch at a time. Workers sleep until the
+** generation changes, then take indices from the shared counter until the
+** batch is exhausted.
+*/
+struct thread_pool
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    // only one thread submits at a time
+    pthread_mutex_t submit_lock;
+
+    pthread_t *workers;
+    size_t workers_count;
+    bool stopping;
+
+    // the current batch
+    size_t generation;
+    thread_pool_task_f func;
+    void *data;
+    size_t count;
+    // the next index to run, taken without the lock
+    size_t next;
+    // the tasks of the batch which haven't completed yet
+    size_t pending;
+    // the workers currently taking tasks
+    size_t active;
+};
+
+static struct thread_pool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work_ready = PTHREAD_COND_INITIALIZER,
+    .work_done = PTHREAD_COND_INITIALIZER,
+    .submit_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/*
+** Run tasks of the batch until there are none left, and report how many
+** were completed. Workers only join batches with tasks left, and are then
+** counted as active, so the submitter waits for them before the next batch
+** can start. Batches of one task per thread are bound: each thread runs the
+** task of its own index.
+*/
+static void run_tasks(thread_pool_task_f func, void *data, size_t count,
+                      size_t thread)
+{
+    size_t done = 0;
+    size_t index;
+    if (count == pool.workers_count + 1)
+    {
+        func(data, thread);
+        done++;
+    }
+    else
+        while ((index = __atomic_fetch_add(&pool.next, 1, __ATOMIC_RELAXED))
+               < count)
+        {
+            func(data, index);
+            done++;
+        }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.pending -= done;
+    if (pool.pending == 0)
+        pthread_cond_broadcast(&pool.work_done);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static void *pool_worker(void *arg)
+{
+    // the calling thread of batches is thread 0
+    size_t thread = (uintptr_t)arg;
+    affinity_pin(thread);
+    size_t seen = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    while (true)
+    {
+        while (!pool.stopping && pool.generation == seen)
+            pthread_cond_wait(&pool.work_ready, &pool.lock);
+        if (pool.stopping)
+            break;
+
+        // a worker waking up late may find the batch over, and its data
+        // gone: it must not take indices, which belong to the next batch
+        seen = pool.generation;
+        bool bound = pool.count == pool.workers_count + 1;
+        if (!bound && __atomic_load_n(&pool.next, __ATOMIC_RELAXED)
+                          >= pool.count)
+            continue;
+
+        thread_pool_task_f func = pool.func;
+        void *data = pool.data;
+        size_t count = pool.count;
+        pool.active++;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_tasks(func, data, count, thread);
+
+        pthread_mutex_lock(&pool.lock);
+        pool.active--;
+        if (pool.active == 0)
+            pthread_cond_broadcast(&pool.work_done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+void thread_pool_start(size_t threads)
+{
+    affinity_pin(0);
+    if (threads <= 1 || pool.workers != NULL)
+        return;
+
+    pool.workers = xcalloc(threads - 1, sizeof(*pool.workers));
+    pool.stopping = false;
+    for (; pool.workers_count < threads - 1; pool.workers_count++)
+        if (pthread_create(&pool.workers[pool.workers_count], NULL,
+                           pool_worker,
+                           (void *)(uintptr_t)(pool.workers_count + 1))
+            != 0)
+        {
+            warnx("Failed thread creation, using %li threads",
+                  pool.workers_count + 1);
+            break;
+        }
+}
+
+void thread_pool_stop(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = true;
+    pthread_cond_broadcast(&pool.work_ready);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (size_t i = 0; i < pool.workers_count; i++)
+        pthread_join(pool.workers[i], NULL);
+
+    free(pool.workers);
+    pool.workers = NULL;
+    pool.workers_count = 0;
+}
+
+size_t thread_pool_size(void)
+{
+    return pool.workers_count + 1;
+}
+
+void thread_pool_run(size_t count, thread_pool_task_f func, void *data)
+{
+    // small batches aren't worth waking workers up
+    if (pool.workers_count == 0 || count <= 1)
+    {
+        for (size_t i = 0; i < count; i++)
+            func(data, i);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.submit_lock);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.func = func;
+    pool.data = data;
+    pool.count = count;
+    pool.next = 0;
+    pool.pending = count;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work_ready);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_tasks(func, data, count, 0);
+
+    // workers still looking for tasks would take indices of the next batch
+    pthread_mutex_lock(&pool.lock);
+    while (pool.pending != 0 || pool.active != 0)
+        pthread_cond_wait(&pool.work_done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_mutex_unlock(&pool.submit_lock);
+}